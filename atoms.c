@@ -49,69 +49,304 @@ static const char *constant_atoms[CONSTANT_ATOMS] = {
 	"FULL_NAME", "CAP_HEIGHT", "WM_CLASS", "WM_TRANSIENT_FOR"
 };
 
+/* Names are copied into chunks that are only given back when the
+ * table they belong to is gone (which the global one never is). */
+#define ARENA_CHUNK 8192
+
+struct arenachunk {
+	struct arenachunk *next;
+	size_t size;
+	char data[];
+};
+
+struct arena {
+	struct arenachunk *chunks;
+	size_t used;
+};
+
+static void *arena_alloc(struct arena *a, size_t len, size_t align) {
+	struct arenachunk *n;
+	size_t ofs;
+
+	if( a->chunks != NULL ) {
+		ofs = (a->used + align - 1) & ~(align - 1);
+		if( ofs + len <= a->chunks->size ) {
+			a->used = ofs + len;
+			return a->chunks->data + ofs;
+		}
+	}
+	n = malloc(sizeof(struct arenachunk) +
+			((len > ARENA_CHUNK)?len:ARENA_CHUNK));
+	if( n == NULL )
+		abort();
+	n->size = (len > ARENA_CHUNK)?len:ARENA_CHUNK;
+	n->next = a->chunks;
+	a->chunks = n;
+	a->used = len;
+	return n->data;
+}
+
+static const char *arena_strdup(struct arena *a, const char *name, size_t len) {
+	char *n = arena_alloc(a, len + 1, 1);
+
+	memcpy(n, name, len);
+	n[len] = '\0';
+	return n;
+}
+
+/* keep only the newest chunk */
+static void arena_reset(struct arena *a) {
+	struct arenachunk *n;
+
+	if( a->chunks == NULL )
+		return;
+	while( (n = a->chunks->next) != NULL ) {
+		a->chunks->next = n->next;
+		free(n);
+	}
+	a->used = 0;
+}
+
+static void arena_free(struct arena *a) {
+	struct arenachunk *n;
+
+	while( (n = a->chunks) != NULL ) {
+		a->chunks = n->next;
+		free(n);
+	}
+	a->used = 0;
+}
+
+/* Servers give out atoms in increasing order, so they are looked up
+ * with open addressing by multiplicative hashing of the number. */
+#define ATOMTABLE_INITIAL_BITS 8
+
+struct atomslot {
+	uint32_t atom; /* 0 if empty */
+	const char *name;
+};
+
+struct atomtable {
+	struct atomslot *slots;
+	unsigned int bits;
+	size_t count;
+};
+
+static inline size_t atom_hash(uint32_t atom, unsigned int bits) {
+	return (uint32_t)(atom * 0x9E3779B1U) >> (32 - bits);
+}
+
+static const struct atomslot *atomtable_find(const struct atomtable *t, uint32_t atom) {
+	size_t i, mask;
+
+	if( t->count == 0 )
+		return NULL;
+	mask = ((size_t)1 << t->bits) - 1;
+	for( i = atom_hash(atom, t->bits) ; t->slots[i].atom != 0 ;
+			i = (i + 1) & mask ) {
+		if( t->slots[i].atom == atom )
+			return &t->slots[i];
+	}
+	return NULL;
+}
+
+static void atomtable_put(struct atomtable *t, uint32_t atom, const char *name);
+
+static void atomtable_grow(struct atomtable *t) {
+	struct atomslot *old = t->slots;
+	size_t i, oldsize = (old == NULL)?0:((size_t)1 << t->bits);
+
+	t->bits = (old == NULL)?ATOMTABLE_INITIAL_BITS:(t->bits + 1);
+	t->slots = calloc((size_t)1 << t->bits, sizeof(struct atomslot));
+	if( t->slots == NULL )
+		abort();
+	t->count = 0;
+	for( i = 0 ; i < oldsize ; i++ ) {
+		if( old[i].atom != 0 )
+			atomtable_put(t, old[i].atom, old[i].name);
+	}
+	free(old);
+}
+
+/* adds or replaces */
+static void atomtable_put(struct atomtable *t, uint32_t atom, const char *name) {
+	size_t i, mask;
+
+	if( t->slots == NULL || 4 * (t->count + 1) > 3 * ((size_t)1 << t->bits) )
+		atomtable_grow(t);
+	mask = ((size_t)1 << t->bits) - 1;
+	for( i = atom_hash(atom, t->bits) ; t->slots[i].atom != 0 ;
+			i = (i + 1) & mask ) {
+		if( t->slots[i].atom == atom ) {
+			t->slots[i].name = name;
+			return;
+		}
+	}
+	t->slots[i].atom = atom;
+	t->slots[i].name = name;
+	t->count++;
+}
+
+static void atomtable_clear(struct atomtable *t) {
+	free(t->slots);
+	t->slots = NULL;
+	t->bits = 0;
+	t->count = 0;
+}
+
+static struct atomtable atom_table;
+static struct arena atom_names;
+
+/* What a connection knows differently from the global table: atoms
+ * learned while atoms_deferred and atoms the server of this connection
+ * named differently than the one the global table was learned from
+ * (like a restarted server or a replay of several captures). */
+struct localatoms {
+	struct atomtable table;
+	struct arena names;
+	/* the names of InternAtom requests waiting for their reply */
+	struct arena pending;
+	unsigned int pendingcount;
+};
+
+/* while connections are decoded in parallel (see replay.c) the atoms
+ * learned are only kept with the connection until atoms_merge */
+bool atoms_deferred = false;
+
 struct atom {
-	struct atom *left,*right;
-	uint32_t atom;
+	size_t len;
 	char name[];
 };
-/* TODO: add connection specific values, too, to be activated on mismatch */
-struct atom *atom_root = NULL;
 
-struct atom *newAtom(const char *name, size_t len) {
+static struct localatoms *localatoms(struct connection *c) {
+	if( c->atoms == NULL ) {
+		c->atoms = calloc(1, sizeof(struct localatoms));
+		if( c->atoms == NULL )
+			abort();
+	}
+	return c->atoms;
+}
+
+/* remember the name of an atom until the reply tells its number */
+struct atom *newAtom(struct connection *c, const char *name, size_t len) {
+	struct localatoms *l = localatoms(c);
 	struct atom *atom;
-	atom = malloc(sizeof(struct atom)+len+1);
-	if( atom == NULL )
-		abort();
-	memcpy(atom->name,name,len);
-	atom->name[len] = '\0';
+
+	atom = arena_alloc(&l->pending, sizeof(struct atom) + len,
+			sizeof(size_t));
+	atom->len = len;
+	memcpy(atom->name, name, len);
+	l->pendingcount++;
 	return atom;
 }
 
-const char *getAtom(struct connection *c UNUSED, uint32_t atom) {
-	struct atom *p;
+/* the pending name is no longer needed */
+void dropAtom(struct connection *c, struct atom *data) {
+	struct localatoms *l = c->atoms;
+
+	assert( data != NULL && l != NULL && l->pendingcount > 0 );
+	if( --l->pendingcount == 0 )
+		arena_reset(&l->pending);
+}
+
+const char *getAtom(struct connection *c, uint32_t atom) {
+	const struct atomslot *p;
 	if( atom <= 0 )
 		return NULL;
 	if( atom <= CONSTANT_ATOMS )
 		return constant_atoms[atom-1];
-	atom -= CONSTANT_ATOMS;
-	p = atom_root;
-	while( p != NULL ) {
-		if( p->atom == atom )
+	if( c != NULL && c->atoms != NULL ) {
+		p = atomtable_find(&c->atoms->table, atom);
+		if( p != NULL )
 			return p->name;
-		if( p->atom > atom )
-			p = p->left;
-		else
-			p = p->right;
 	}
+	p = atomtable_find(&atom_table, atom);
+	if( p != NULL )
+		return p->name;
 	return NULL;
 }
-void internAtom(struct connection *c UNUSED, uint32_t atom, struct atom *data) {
-	struct atom **p;
 
-	if( atom <= CONSTANT_ATOMS ) {
-		free(data);
+static inline bool samename(const char *known, const char *name, size_t len) {
+	return strncmp(known, name, len) == 0 && known[len] == '\0';
+}
+
+void rememberAtom(struct connection *c, uint32_t atom, const char *name, size_t len) {
+	const struct atomslot *g, *p = NULL;
+	struct localatoms *l;
+
+	if( atom <= CONSTANT_ATOMS )
+		return;
+	if( c->atoms != NULL )
+		p = atomtable_find(&c->atoms->table, atom);
+	if( p != NULL ) {
+		/* (if already known this only compares, so no harm done) */
+		if( !samename(p->name, name, len) ) {
+			fprintf(stderr, "Mismatch in InternAtom: Got %x = '%.*s', but remember = '%s'!\n", (unsigned int)atom, (int)len, name, p->name);
+			l = c->atoms;
+			atomtable_put(&l->table, atom,
+					arena_strdup(&l->names, name, len));
+		}
 		return;
 	}
-	assert( data != NULL );
-	atom -= CONSTANT_ATOMS; /* still always > 0 */
-	data->atom = atom;
-
-	p = &atom_root;
-	while( *p != NULL ) {
-		uint32_t k;
-		k = (*p)->atom;
-		if( atom == k ) {
-			if( strcmp((*p)->name, data->name) != 0 )
-				fprintf(stderr,"Mismatch in InternAtom: Got %x = '%s', but remember = '%s'!\n",(unsigned int)atom,data->name,(*p)->name);
-			free(data);
+	g = atomtable_find(&atom_table, atom);
+	if( g != NULL ) {
+		if( samename(g->name, name, len) )
 			return;
-		} else if( atom > k ) {
-			p = &(*p)->right;
-		} else { /* atom < k */
-			p = &(*p)->left;
-		}
+		fprintf(stderr, "Mismatch in InternAtom: Got %x = '%.*s', but remember = '%s'!\n", (unsigned int)atom, (int)len, name, g->name);
+		/* only this connection sees the new name */
+	} else if( !atoms_deferred ) {
+		atomtable_put(&atom_table, atom,
+				arena_strdup(&atom_names, name, len));
+		return;
 	}
-	*p = data;
-	data->left = NULL;
-	data->right = NULL;
+	l = localatoms(c);
+	atomtable_put(&l->table, atom, arena_strdup(&l->names, name, len));
+}
+
+void internAtom(struct connection *c, uint32_t atom, struct atom *data) {
+	assert( data != NULL );
+	rememberAtom(c, atom, data->name, data->len);
+	dropAtom(c, data);
+}
+
+/* make the atoms a connection learned known to all */
+void atoms_merge(struct connection *c) {
+	struct localatoms *l = c->atoms;
+	struct atomslot *old;
+	size_t i, size;
+
+	if( l == NULL || l->table.count == 0 )
+		return;
+	old = l->table.slots;
+	size = (size_t)1 << l->table.bits;
+	l->table.slots = NULL;
+	l->table.bits = 0;
+	l->table.count = 0;
+	for( i = 0 ; i < size ; i++ ) {
+		const struct atomslot *g;
+
+		if( old[i].atom == 0 )
+			continue;
+		g = atomtable_find(&atom_table, old[i].atom);
+		if( g == NULL )
+			atomtable_put(&atom_table, old[i].atom,
+					arena_strdup(&atom_names, old[i].name,
+						strlen(old[i].name)));
+		else if( strcmp(g->name, old[i].name) != 0 )
+			/* still different, so stays with the connection */
+			atomtable_put(&l->table, old[i].atom, old[i].name);
+	}
+	free(old);
+}
+
+void atoms_free(struct connection *c) {
+	struct localatoms *l = c->atoms;
+
+	if( l == NULL )
+		return;
+	atomtable_clear(&l->table);
+	arena_free(&l->names);
+	arena_free(&l->pending);
+	free(l);
+	c->atoms = NULL;
 }
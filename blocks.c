@@ -0,0 +1,257 @@
+/*  This file is part of "xtrace"
+ *  Copyright (C) 2026 Bernhard R. Link
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <config.h>
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#include "xtrace.h"
+#include "parse.h"
+#include "blocks.h"
+
+/* The finalized data has no information what it is, so starting from
+ * the global tables every pointer is followed knowing what it points
+ * to. (Pointers can also point into the middle of a block, like the
+ * shared empty parameter list in parameter_finalize.) */
+
+const struct block_kind_info block_kinds[bk_COUNT] = {
+	[bk_STRING] = { "char", "builtin_strings", 1 },
+	[bk_INSTRUCTION] = { "struct instruction", "builtin_code",
+		sizeof(struct instruction) },
+	[bk_CONSTANT] = { "struct constant", "builtin_constants",
+		sizeof(struct constant) },
+	[bk_VALUE] = { "struct value", "builtin_values",
+		sizeof(struct value) },
+	[bk_REQUEST] = { "struct request", "builtin_requests",
+		sizeof(struct request) },
+	[bk_EVENT] = { "struct event", "builtin_events",
+		sizeof(struct event) },
+	[bk_EXTENSION] = { "struct extension", "builtin_extensions",
+		sizeof(struct extension) },
+	[bk_ERROR] = { "char * const", "builtin_errors",
+		sizeof(const char *) },
+};
+
+const struct block_function block_functions[] = {
+	{ "requestQueryExtension", (generic_func *)requestQueryExtension },
+	{ "requestInternAtom", (generic_func *)requestInternAtom },
+	{ "requestGetAtomName", (generic_func *)requestGetAtomName },
+	{ "replyListFontsWithInfo", (generic_func *)replyListFontsWithInfo },
+	{ "replyQueryExtension", (generic_func *)replyQueryExtension },
+	{ "replyInternAtom", (generic_func *)replyInternAtom },
+	{ "replyGetAtomName", (generic_func *)replyGetAtomName },
+	{ NULL, NULL }
+};
+
+struct block *blocks = NULL;
+size_t numblocks = 0;
+static size_t blocks_allocated = 0;
+bool blocks_tracking = false;
+static bool sorted = false;
+static bool failed = false;
+
+void blocks_record(const void *data, size_t len, bool string) {
+	if( failed )
+		return;
+	assert( !sorted );
+	if( numblocks >= blocks_allocated ) {
+		struct block *n;
+		size_t count = (blocks_allocated == 0)?1024:2*blocks_allocated;
+
+		n = realloc(blocks, count * sizeof(struct block));
+		if( n == NULL ) {
+			fputs("Out of memory!\n", stderr);
+			failed = true;
+			return;
+		}
+		blocks = n;
+		blocks_allocated = count;
+	}
+	blocks[numblocks].data = data;
+	blocks[numblocks].len = len;
+	blocks[numblocks].kind = string?bk_STRING:bk_NONE;
+	blocks[numblocks].index = 0;
+	numblocks++;
+}
+
+void blocks_done(void) {
+	free(blocks);
+	blocks = NULL;
+	numblocks = 0;
+	blocks_allocated = 0;
+	sorted = false;
+	failed = false;
+}
+
+int blocks_function(generic_func *f) {
+	int i;
+
+	for( i = 0 ; block_functions[i].name != NULL ; i++ ) {
+		if( block_functions[i].f == f )
+			return i;
+	}
+	return -1;
+}
+
+static int compare_blocks(const void *a, const void *b) {
+	const char *da = ((const struct block *)a)->data;
+	const char *db = ((const struct block *)b)->data;
+
+	if( da < db )
+		return -1;
+	return da > db;
+}
+
+const struct block *blocks_find(const void *p) {
+	size_t lo = 0, hi = numblocks;
+
+	assert( sorted );
+	while( lo < hi ) {
+		size_t mid = lo + (hi - lo)/2;
+		const struct block *b = &blocks[mid];
+
+		if( (const char *)p < b->data )
+			hi = mid;
+		/* (empty ones still take a byte, see finalize_data) */
+		else if( (const char *)p - b->data >= (ptrdiff_t)b->len
+				&& (b->len > 0 || p != b->data) )
+			lo = mid + 1;
+		else
+			return b;
+	}
+	return NULL;
+}
+
+enum block_kind blocks_option_kind(enum opcode op) {
+	switch( op ) {
+		case op_LISTofVALUE:
+			return bk_VALUE;
+		case op_LISTofStruct:
+		case op_LISTofVarStruct:
+		case op_Struct:
+		case op_IF8:
+		case op_IF16:
+		case op_IF32:
+		case op_IFATOM:
+			return bk_INSTRUCTION;
+		default:
+			return bk_CONSTANT;
+	}
+}
+
+#define POINTER(type, field, kind) \
+	f(privdata, b, ofs + offsetof(type, field), \
+			((const type *)(b->data + ofs))->field, kind)
+
+void blocks_pointers(const struct block *b, size_t element, block_pointer_func *f, void *privdata) {
+	size_t ofs = element * block_kinds[b->kind].size;
+
+	switch( b->kind ) {
+		case bk_INSTRUCTION:
+			POINTER(struct instruction, o.constants,
+					blocks_option_kind(((const struct instruction *)(b->data + ofs))->op));
+			break;
+		case bk_VALUE:
+			POINTER(struct value, constants, bk_CONSTANT);
+			break;
+		case bk_REQUEST:
+			POINTER(struct request, name, bk_STRING);
+			POINTER(struct request, parameters, bk_INSTRUCTION);
+			POINTER(struct request, answers, bk_INSTRUCTION);
+			break;
+		case bk_EVENT:
+			POINTER(struct event, name, bk_STRING);
+			POINTER(struct event, parameters, bk_INSTRUCTION);
+			break;
+		case bk_EXTENSION:
+			POINTER(struct extension, name, bk_STRING);
+			POINTER(struct extension, subrequests, bk_REQUEST);
+			POINTER(struct extension, events, bk_EVENT);
+			POINTER(struct extension, errors, bk_ERROR);
+			POINTER(struct extension, xgevents, bk_EVENT);
+			break;
+		case bk_ERROR:
+			f(privdata, b, ofs, *(const char * const *)(b->data + ofs),
+					bk_STRING);
+			break;
+		default:
+			break;
+	}
+}
+#undef POINTER
+
+static void mark(const void *p, enum block_kind kind);
+
+static void mark_pointer(void *privdata UNUSED, const struct block *from UNUSED, size_t ofs UNUSED, const void *target, enum block_kind kind) {
+	mark(target, kind);
+}
+
+/* note that p points to something of that kind */
+static void mark(const void *p, enum block_kind kind) {
+	struct block *b;
+	size_t i;
+
+	if( p == NULL )
+		return;
+	b = (struct block *)blocks_find(p);
+	if( b == NULL ) {
+		/* strings can also be literals in translate.c */
+		if( kind != bk_STRING ) {
+			fprintf(stderr, "Pointer %p outside of all finalized data!\n", p);
+			failed = true;
+		}
+		return;
+	}
+	if( b->kind == kind )
+		return;
+	if( b->kind != bk_NONE ) {
+		fprintf(stderr, "Finalized data used as %s and as %s!\n",
+				block_kinds[b->kind].type,
+				block_kinds[kind].type);
+		failed = true;
+		return;
+	}
+	if( b->len % block_kinds[kind].size != 0 ) {
+		fprintf(stderr, "Finalized data of %zu bytes used as array of %s!\n",
+				b->len, block_kinds[kind].type);
+		failed = true;
+		return;
+	}
+	b->kind = kind;
+	for( i = 0 ; i < b->len / block_kinds[kind].size ; i++ )
+		blocks_pointers(b, i, mark_pointer, NULL);
+}
+
+bool blocks_walk(void) {
+	if( failed )
+		return false;
+	qsort(blocks, numblocks, sizeof(struct block), compare_blocks);
+	sorted = true;
+	mark(requests, bk_REQUEST);
+	mark(events, bk_EVENT);
+	mark(errors, bk_ERROR);
+	mark(extensions, bk_EXTENSION);
+	mark(unexpected_reply, bk_INSTRUCTION);
+	mark(setup_parameters, bk_INSTRUCTION);
+	mark(protocol_names, bk_STRING);
+	return !failed;
+}
@@ -0,0 +1,49 @@
+#ifndef XTRACE_BLOCKS_H
+#define XTRACE_BLOCKS_H
+
+/* What the finalized protocol tables are made of (every finalize_data
+ * and string_add while blocks_tracking), to write them somewhere else
+ * (see gentables.c and tablecache.c). */
+
+enum block_kind { bk_NONE = 0, bk_STRING, bk_INSTRUCTION, bk_CONSTANT,
+	bk_VALUE, bk_REQUEST, bk_EVENT, bk_EXTENSION, bk_ERROR, bk_COUNT };
+
+extern const struct block_kind_info {
+	const char *type, *array;
+	size_t size;
+} block_kinds[bk_COUNT];
+
+struct block {
+	const char *data;
+	/* (with the terminating '\0' for strings) */
+	size_t len;
+	enum block_kind kind;
+	/* for the users of this */
+	size_t index;
+};
+extern struct block *blocks;
+extern size_t numblocks;
+extern bool blocks_tracking;
+
+void blocks_record(const void *data, size_t len, bool string);
+/* find out the kind of every block used by the global tables */
+bool blocks_walk(void);
+const struct block *blocks_find(const void *);
+/* what the union in an instruction is used as */
+enum block_kind blocks_option_kind(enum opcode);
+/* called for every pointer to other blocks (or string literals)
+ * within an element of a block */
+typedef void block_pointer_func(void *, const struct block *, size_t ofs, const void *target, enum block_kind);
+void blocks_pointers(const struct block *, size_t element, block_pointer_func *, void *);
+void blocks_done(void);
+
+/* the special functions requests can have, see finalize_requests */
+typedef void generic_func(void);
+extern const struct block_function {
+	const char *name;
+	generic_func *f;
+} block_functions[];
+/* the index into block_functions, or -1 if not found */
+int blocks_function(generic_func *);
+
+#endif
@@ -0,0 +1,200 @@
+/*  This file is part of "xtrace"
+ *  Copyright (C) 2026 Bernhard R. Link
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <config.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#include "capture.h"
+
+/* Records are collected here and only written when it is full or
+ * when the main loop is about to wait (see capture_flush), so that
+ * capturing costs not much more than copying the data once. */
+#define CAPTURE_BUFFER_SIZE (256*1024)
+
+static int capture_fd = -1;
+static bool capture_failed = false;
+static unsigned char *capture_buffer;
+static size_t capture_used;
+
+static uint64_t capture_now(void) {
+#ifdef HAVE_MONOTONIC_CLOCK
+	struct timespec ts;
+
+	if( clock_gettime(CLOCK_MONOTONIC, &ts) == 0 )
+		return ts.tv_sec * (uint64_t)1000000000 + ts.tv_nsec;
+#endif
+	{
+		struct timeval tv;
+
+		gettimeofday(&tv, NULL);
+		return tv.tv_sec * (uint64_t)1000000000 + tv.tv_usec * 1000;
+	}
+}
+
+static inline void put32(unsigned char *p, uint32_t v) {
+	p[0] = v & 0xFF;
+	p[1] = (v >> 8) & 0xFF;
+	p[2] = (v >> 16) & 0xFF;
+	p[3] = v >> 24;
+}
+
+static inline void put64(unsigned char *p, uint64_t v) {
+	put32(p, v & 0xFFFFFFFF);
+	put32(p + 4, v >> 32);
+}
+
+static void capture_write(const void *data, size_t len) {
+	const unsigned char *p = data;
+	ssize_t written;
+
+	while( len > 0 && !capture_failed ) {
+		written = write(capture_fd, p, len);
+		if( written < 0 ) {
+			int e = errno;
+
+			if( e == EINTR )
+				continue;
+			fprintf(stderr, "Error %d writing capture file: %s\n",
+					e, strerror(e));
+			capture_failed = true;
+			return;
+		}
+		p += written;
+		len -= written;
+	}
+}
+
+void capture_flush(void) {
+	if( capture_used == 0 )
+		return;
+	capture_write(capture_buffer, capture_used);
+	capture_used = 0;
+}
+
+bool capture_open(const char *filename) {
+	unsigned char header[CAPTURE_HEADER_SIZE];
+	struct timeval tv;
+
+	capture_buffer = malloc(CAPTURE_BUFFER_SIZE);
+	if( capture_buffer == NULL ) {
+		fputs("Out of memory!\n", stderr);
+		return false;
+	}
+	capture_fd = open(filename, O_WRONLY|O_CREAT|O_TRUNC|O_NOCTTY, 0666);
+	if( capture_fd < 0 ) {
+		int e = errno;
+		fprintf(stderr, "Error opening %s: %s\n", filename, strerror(e));
+		free(capture_buffer);
+		capture_buffer = NULL;
+		return false;
+	}
+	gettimeofday(&tv, NULL);
+	memset(header, 0, sizeof(header));
+	memcpy(header, CAPTURE_MAGIC, sizeof(CAPTURE_MAGIC));
+	put32(header + 16, CAPTURE_VERSION);
+	put64(header + 24, tv.tv_sec * (uint64_t)1000000000 + tv.tv_usec * 1000);
+	put64(header + 32, capture_now());
+	memcpy(capture_buffer, header, sizeof(header));
+	capture_used = sizeof(header);
+	return true;
+}
+
+static void capture_record(int id, enum capture_type type, unsigned int nfds, const struct iovec *iov, size_t len) {
+	unsigned char *p;
+	size_t n;
+
+	if( capture_fd < 0 || capture_failed )
+		return;
+	if( capture_used + CAPTURE_RECORD_SIZE > CAPTURE_BUFFER_SIZE )
+		capture_flush();
+	p = capture_buffer + capture_used;
+	put32(p, id);
+	p[4] = type;
+	p[5] = nfds;
+	p[6] = 0;
+	p[7] = 0;
+	put64(p + 8, capture_now());
+	put32(p + 16, len);
+	capture_used += CAPTURE_RECORD_SIZE;
+	if( capture_used + len > CAPTURE_BUFFER_SIZE ) {
+		capture_flush();
+		if( len >= CAPTURE_BUFFER_SIZE / 2 ) {
+			/* no need to copy that around first */
+			for( ; len > 0 ; iov++ ) {
+				n = iov->iov_len;
+				if( n > len )
+					n = len;
+				capture_write(iov->iov_base, n);
+				len -= n;
+			}
+			return;
+		}
+	}
+	for( ; len > 0 ; iov++ ) {
+		n = iov->iov_len;
+		if( n > len )
+			n = len;
+		memcpy(capture_buffer + capture_used, iov->iov_base, n);
+		capture_used += n;
+		len -= n;
+	}
+}
+
+void capture_connect(int id, const char *from) {
+	struct iovec iov;
+
+	iov.iov_base = (void *)from;
+	iov.iov_len = strlen(from);
+	capture_record(id, ct_CONNECT, 0, &iov, iov.iov_len);
+}
+
+/* len bytes just read into iov */
+void capture_data(int id, bool fromserver, unsigned int nfds, const struct iovec *iov, size_t len) {
+	capture_record(id, fromserver?ct_SERVER:ct_CLIENT, nfds, iov, len);
+}
+
+void capture_close(int id) {
+	capture_record(id, ct_CLOSE, 0, NULL, 0);
+}
+
+/* returns false if anything went wrong */
+bool capture_done(void) {
+	if( capture_fd < 0 )
+		return true;
+	capture_flush();
+	if( close(capture_fd) != 0 && !capture_failed ) {
+		int e = errno;
+		fprintf(stderr, "Error %d writing capture file: %s\n",
+				e, strerror(e));
+		capture_failed = true;
+	}
+	capture_fd = -1;
+	free(capture_buffer);
+	capture_buffer = NULL;
+	return !capture_failed;
+}
@@ -0,0 +1,45 @@
+#ifndef XTRACE_CAPTURE_H
+#define XTRACE_CAPTURE_H
+
+/* A capture file (see --capture) starts with a header of
+ *	16 bytes CAPTURE_MAGIC
+ *	 4 bytes format version (CAPTURE_VERSION)
+ *	 4 bytes zero
+ *	 8 bytes wall clock time at start (ns since the epoch)
+ *	 8 bytes monotonic time at start (ns)
+ * followed by records of
+ *	 4 bytes connection id
+ *	 1 byte  type (enum capture_type)
+ *	 1 byte  number of file descriptors passed along
+ *	 2 bytes zero
+ *	 8 bytes monotonic time (ns)
+ *	 4 bytes length
+ *	 length bytes data
+ * All numbers are little endian. */
+
+#define CAPTURE_MAGIC "xtrace capture\n"
+#define CAPTURE_VERSION 1
+#define CAPTURE_HEADER_SIZE 40
+#define CAPTURE_RECORD_SIZE 20
+
+enum capture_type {
+	/* new connection, data is where it came from */
+	ct_CONNECT = 0,
+	/* data from the client to the server */
+	ct_CLIENT = 1,
+	/* data from the server to the client */
+	ct_SERVER = 2,
+	/* connection closed, no data */
+	ct_CLOSE = 3
+};
+
+struct iovec;
+
+bool capture_open(const char *filename);
+void capture_connect(int id, const char *from);
+void capture_data(int id, bool fromserver, unsigned int nfds, const struct iovec *, size_t len);
+void capture_close(int id);
+void capture_flush(void);
+bool capture_done(void);
+
+#endif
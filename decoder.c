@@ -0,0 +1,609 @@
+/*  This file is part of "xtrace"
+ *  Copyright (C) 2026 Bernhard R. Link
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <config.h>
+
+#include <assert.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#include <signal.h>
+#endif
+
+#include "xtrace.h"
+#include "decoder.h"
+#include "output.h"
+#include "stats.h"
+
+struct connection *decode_connection_new(int id, const char *from, unsigned long long starttime) {
+	struct connection *c;
+
+	c = calloc(1, sizeof(struct connection));
+	if( c == NULL ) {
+		fputs("Out of memory!\n", stderr);
+		return NULL;
+	}
+	c->id = id;
+	c->client_fd = -1;
+	c->server_fd = -1;
+	c->starttime = starttime;
+	c->from = strdup(from);
+	if( c->from == NULL ) {
+		fputs("Out of memory!\n", stderr);
+		free(c);
+		return NULL;
+	}
+	if( !ringbuffer_init(&c->clientring, INITIAL_BUFFER_SIZE) ||
+	    !ringbuffer_init(&c->serverring, INITIAL_BUFFER_SIZE) ) {
+		decode_connection_free(c);
+		return NULL;
+	}
+	return c;
+}
+
+void decode_connection_free(struct connection *c) {
+	atoms_merge(c);
+	free_extensions(c);
+	free_expectedreplies(c);
+	atoms_free(c);
+	ringbuffer_done(&c->clientring);
+	ringbuffer_done(&c->serverring);
+	stats_connection_done(c);
+	out_done(&c->output);
+	free(c->from);
+	free(c);
+}
+
+void decode_data(struct connection *c, bool fromserver, const unsigned char *data, size_t len) {
+	struct ringbuffer *b = fromserver?&c->serverring:&c->clientring;
+	unsigned int *ignore = fromserver?&c->serverignore:&c->clientignore;
+	const struct streamed *s = fromserver?&c->serverstreamed:&c->clientstreamed;
+	struct iovec iov[2];
+	size_t n, l;
+	int i, count;
+
+	while( len > 0 ) {
+		count = ringbuffer_space(b, iov);
+		for( i = 0, n = 0 ; i < count && n < len ; i++ ) {
+			l = iov[i].iov_len;
+			if( l > len - n )
+				l = len - n;
+			memcpy(iov[i].iov_base, data + n, l);
+			n += l;
+		}
+		if( n == 0 ) {
+			/* the parser still waits for the start of the
+			 * connection, but that cannot grow any more */
+			*ignore = b->count;
+		}
+		ringbuffer_added(b, n);
+		data += n;
+		len -= n;
+		/* what the main loop does when reading and sending */
+		while( b->count > 0 ) {
+			/* (a streamed message is followed as it arrives) */
+			if( *ignore == 0 || s->left > 0 ) {
+				if( fromserver )
+					parse_server(c);
+				else
+					parse_client(c);
+				if( *ignore == 0 )
+					break;
+			}
+			l = *ignore;
+			if( l > b->count )
+				l = b->count;
+			ringbuffer_consume(b, l);
+			shrink_if_idle(b);
+			*ignore -= l;
+		}
+	}
+}
+
+#ifdef HAVE_PTHREAD
+
+/* With --decoupled the main loop sends everything on as soon as it is
+ * read and only hands a copy to the decoder thread, through a
+ * single-producer single-consumer queue for each connection.
+ *
+ * The main loop looks at the headers to know where messages start and
+ * end. If a message does not fit into the queue, it is skipped as a
+ * whole and only its size is told to the decoder, so the decoder
+ * never slows the connection down and stays in sync with the stream.
+ */
+
+#define QUEUE_SIZE (4*1024*1024)
+#define QUEUE_MASK (QUEUE_SIZE-1)
+
+enum record_type { rt_DATA, rt_SKIP };
+
+struct record {
+	uint8_t type;
+	uint8_t fromserver;
+	/* rt_SKIP: the message last sent was cut short */
+	uint8_t cut;
+	uint8_t pad;
+	/* rt_SKIP: number of messages skipped */
+	uint32_t messages;
+	/* rt_DATA: bytes following, rt_SKIP: bytes skipped */
+	uint64_t len;
+	/* rt_DATA with --stats: when it was read */
+	uint64_t time;
+};
+
+/* where the main loop is in the stream of one direction */
+struct framer {
+	/* the header of the next message, until it is complete */
+	unsigned char header[32];
+	unsigned int have, need;
+	/* bytes of the current message still to come */
+	size_t remaining;
+	/* if the current message goes to the decoder */
+	bool accepted;
+	bool started, lost;
+	/* what was skipped and not yet told to the decoder */
+	uint32_t skippedmessages;
+	uint64_t skippedbytes;
+	bool cut;
+};
+
+struct decoderqueue {
+	unsigned char *data;
+	/* written by the main loop only */
+	size_t tail;
+	/* written by the decoder only */
+	size_t head;
+	/* the main loop's state: */
+	size_t wtail, open;
+	struct record openrecord;
+	bool isopen, bigendian;
+	struct framer framers[2];
+	/* set by the main loop once it will not write anymore */
+	bool closed;
+	/* the decoder's state: */
+	struct connection *c;
+	struct decoderqueue *next;
+};
+
+static pthread_t decoder_thread;
+static pthread_mutex_t decoder_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t decoder_wakeup = PTHREAD_COND_INITIALIZER;
+/* connections the decoder thread did not yet pick up */
+static struct decoderqueue *decoder_incoming = NULL;
+static bool decoder_stopping = false;
+static bool decoder_sleeping = false;
+static FILE *decoder_out;
+/* only used by the main loop */
+static unsigned long long skippedmessages = 0, skippedbytes = 0;
+
+static inline size_t queue_free(const struct decoderqueue *q) {
+	return QUEUE_SIZE - (q->wtail - __atomic_load_n(&q->head, __ATOMIC_ACQUIRE));
+}
+
+static void queue_write(struct decoderqueue *q, size_t pos, const void *data, size_t len) {
+	size_t ofs = pos & QUEUE_MASK, first = QUEUE_SIZE - ofs;
+
+	if( len <= first )
+		memcpy(q->data + ofs, data, len);
+	else {
+		memcpy(q->data + ofs, data, first);
+		memcpy(q->data, (const unsigned char *)data + first, len - first);
+	}
+}
+
+static void queue_read(const struct decoderqueue *q, size_t pos, void *data, size_t len) {
+	size_t ofs = pos & QUEUE_MASK, first = QUEUE_SIZE - ofs;
+
+	if( len <= first )
+		memcpy(data, q->data + ofs, len);
+	else {
+		memcpy(data, q->data + ofs, first);
+		memcpy((unsigned char *)data + first, q->data, len - first);
+	}
+}
+
+static void queue_closerecord(struct decoderqueue *q) {
+	if( !q->isopen )
+		return;
+	queue_write(q, q->open, &q->openrecord, sizeof(struct record));
+	q->isopen = false;
+}
+
+/* tell the decoder about messages skipped before the next data */
+static bool queue_flushskip(struct decoderqueue *q, bool fromserver) {
+	struct framer *f = &q->framers[fromserver];
+	struct record r;
+
+	if( f->skippedmessages == 0 && !f->cut )
+		return true;
+	if( queue_free(q) < sizeof(struct record) )
+		return false;
+	queue_closerecord(q);
+	memset(&r, 0, sizeof(r));
+	r.type = rt_SKIP;
+	r.fromserver = fromserver;
+	r.cut = f->cut;
+	r.messages = f->skippedmessages;
+	r.len = f->skippedbytes;
+	queue_write(q, q->wtail, &r, sizeof(r));
+	q->wtail += sizeof(r);
+	f->skippedmessages = 0;
+	f->skippedbytes = 0;
+	f->cut = false;
+	return true;
+}
+
+static bool queue_data(struct decoderqueue *q, bool fromserver, const unsigned char *data, size_t len) {
+	bool append;
+
+	if( !queue_flushskip(q, fromserver) )
+		return false;
+	append = q->isopen && q->openrecord.fromserver == fromserver;
+	if( queue_free(q) < len + (append?0:sizeof(struct record)) )
+		return false;
+	if( !append ) {
+		queue_closerecord(q);
+		memset(&q->openrecord, 0, sizeof(struct record));
+		q->openrecord.type = rt_DATA;
+		q->openrecord.fromserver = fromserver;
+		if( stats_enabled )
+			q->openrecord.time = stats_clock();
+		q->open = q->wtail;
+		q->isopen = true;
+		q->wtail += sizeof(struct record);
+	}
+	queue_write(q, q->wtail, data, len);
+	q->wtail += len;
+	q->openrecord.len += len;
+	return true;
+}
+
+static void queue_skip(struct framer *f, size_t len) {
+	f->skippedmessages++;
+	f->skippedbytes += len;
+	skippedmessages++;
+	skippedbytes += len;
+}
+
+static inline uint32_t header_card16(const struct decoderqueue *q, const unsigned char *h, int ofs) {
+	if( q->bigendian )
+		return h[ofs]*256 + h[ofs+1];
+	else
+		return h[ofs+1]*256 + h[ofs];
+}
+
+static inline uint32_t header_card32(const struct decoderqueue *q, const unsigned char *h, int ofs) {
+	if( q->bigendian )
+		return (header_card16(q, h, ofs) << 16) + header_card16(q, h, ofs+2);
+	else
+		return (header_card16(q, h, ofs+2) << 16) + header_card16(q, h, ofs);
+}
+
+/* the size of the message starting with f->header,
+ * 0 if more of the header is needed first */
+static size_t message_length(struct decoderqueue *q, bool fromserver) {
+	struct framer *f = &q->framers[fromserver];
+	const unsigned char *h = f->header;
+	size_t len;
+
+	if( !fromserver ) {
+		if( !f->started ) {
+			if( h[0] == 'B' )
+				q->bigendian = true;
+			else if( h[0] == 'l' )
+				q->bigendian = false;
+			else {
+				/* the parser gives up, so no need to
+				 * care about message boundaries either */
+				f->lost = true;
+				q->framers[true].lost = true;
+				return f->have;
+			}
+			f->started = true;
+			f->need = 4;
+			return 12 + ((header_card16(q, h, 6) + 3) & ~3)
+				+ ((header_card16(q, h, 8) + 3) & ~3);
+		}
+		len = 4 * (size_t)header_card16(q, h, 2);
+		if( len == 0 ) {
+			if( f->need < 8 ) {
+				/* BIG-REQUESTS */
+				f->need = 8;
+				return 0;
+			}
+			f->need = 4;
+			len = 4 * (size_t)header_card32(q, h, 4);
+			if( len < 8 ) {
+				f->lost = true;
+				return f->have;
+			}
+		}
+		return len;
+	}
+	if( !f->started ) {
+		len = 8 + 4 * (size_t)header_card16(q, h, 6);
+		if( h[0] == 1 ) {
+			f->started = true;
+			f->need = 32;
+		}
+		return len;
+	}
+	/* replies and generic events have a length field */
+	if( h[0] == 1 || (h[0] & 0x7F) == 35 )
+		return 32 + 4 * (size_t)header_card32(q, h, 4);
+	return 32;
+}
+
+static bool message_fits(const struct decoderqueue *q, bool fromserver, size_t len) {
+	const struct framer *other = &q->framers[!fromserver];
+	size_t reserved = 3 * sizeof(struct record);
+
+	if( other->accepted )
+		reserved += other->remaining + sizeof(struct record);
+	return len <= QUEUE_SIZE && queue_free(q) >= len + reserved;
+}
+
+static void queue_frame(struct decoderqueue *q, bool fromserver, const unsigned char *data, size_t len) {
+	struct framer *f = &q->framers[fromserver];
+	size_t n;
+
+	while( len > 0 ) {
+		if( f->lost ) {
+			(void)queue_data(q, fromserver, data, len);
+			return;
+		}
+		if( f->remaining == 0 ) {
+			n = f->need - f->have;
+			if( n > len )
+				n = len;
+			memcpy(f->header + f->have, data, n);
+			f->have += n;
+			data += n;
+			len -= n;
+			if( f->have < f->need )
+				return;
+			n = message_length(q, fromserver);
+			if( n == 0 )
+				continue;
+			f->accepted = message_fits(q, fromserver, n)
+				&& queue_data(q, fromserver, f->header, f->have);
+			if( !f->accepted )
+				queue_skip(f, n);
+			f->remaining = n - f->have;
+			f->have = 0;
+			continue;
+		}
+		n = f->remaining;
+		if( n > len )
+			n = len;
+		if( f->accepted && !queue_data(q, fromserver, data, n) ) {
+			/* the decoder has to drop what it got */
+			f->accepted = false;
+			f->cut = true;
+			queue_skip(f, f->remaining);
+		}
+		f->remaining -= n;
+		data += n;
+		len -= n;
+	}
+}
+
+void decoder_wake(void) {
+	if( __atomic_load_n(&decoder_sleeping, __ATOMIC_SEQ_CST) ) {
+		pthread_mutex_lock(&decoder_mutex);
+		pthread_cond_signal(&decoder_wakeup);
+		pthread_mutex_unlock(&decoder_mutex);
+	}
+}
+
+static inline void queue_publish(struct decoderqueue *q) {
+	queue_closerecord(q);
+	__atomic_store_n(&q->tail, q->wtail, __ATOMIC_SEQ_CST);
+	decoder_wake();
+}
+
+struct decoderqueue *decoder_connect(int id, const char *from, unsigned long long starttime) {
+	struct decoderqueue *q;
+
+	q = calloc(1, sizeof(struct decoderqueue));
+	if( q == NULL ) {
+		fputs("Out of memory!\n", stderr);
+		return NULL;
+	}
+	q->data = malloc(QUEUE_SIZE);
+	if( q->data == NULL ) {
+		fputs("Out of memory!\n", stderr);
+		free(q);
+		return NULL;
+	}
+	q->c = decode_connection_new(id, from, starttime);
+	if( q->c == NULL ) {
+		free(q->data);
+		free(q);
+		return NULL;
+	}
+	q->framers[false].need = 12;
+	q->framers[true].need = 8;
+	pthread_mutex_lock(&decoder_mutex);
+	q->next = decoder_incoming;
+	decoder_incoming = q;
+	pthread_mutex_unlock(&decoder_mutex);
+	return q;
+}
+
+/* len bytes just read into iov */
+void decoder_push(struct decoderqueue *q, bool fromserver, const struct iovec *iov, size_t len) {
+	size_t n;
+
+	for( ; len > 0 ; iov++ ) {
+		n = iov->iov_len;
+		if( n > len )
+			n = len;
+		queue_frame(q, fromserver, iov->iov_base, n);
+		len -= n;
+	}
+	queue_publish(q);
+}
+
+/* the queue belongs to the decoder thread afterwards */
+void decoder_close(struct decoderqueue *q) {
+	(void)queue_flushskip(q, false);
+	(void)queue_flushskip(q, true);
+	queue_closerecord(q);
+	__atomic_store_n(&q->tail, q->wtail, __ATOMIC_SEQ_CST);
+	__atomic_store_n(&q->closed, true, __ATOMIC_SEQ_CST);
+	decoder_wake();
+}
+
+static bool decode_queue(struct decoderqueue *q) {
+	size_t head = q->head;
+	size_t tail = __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE);
+	size_t ofs, first;
+	struct record r;
+
+	if( head == tail )
+		return false;
+	while( head != tail ) {
+		queue_read(q, head, &r, sizeof(r));
+		head += sizeof(r);
+		if( r.type == rt_DATA ) {
+			/* for round trip times */
+			q->c->monotonictime = r.time;
+			ofs = head & QUEUE_MASK;
+			first = QUEUE_SIZE - ofs;
+			if( r.len <= first )
+				decode_data(q->c, r.fromserver, q->data + ofs, r.len);
+			else {
+				decode_data(q->c, r.fromserver, q->data + ofs, first);
+				decode_data(q->c, r.fromserver, q->data, r.len - first);
+			}
+			head += r.len;
+		} else
+			parse_skipped(q->c, r.fromserver, r.cut, r.messages, r.len);
+		__atomic_store_n(&q->head, head, __ATOMIC_RELEASE);
+	}
+	return true;
+}
+
+static bool decoder_idle(const struct decoderqueue *q) {
+	for( ; q != NULL ; q = q->next ) {
+		if( __atomic_load_n(&q->tail, __ATOMIC_SEQ_CST) != q->head
+				|| __atomic_load_n(&q->closed, __ATOMIC_SEQ_CST) )
+			return false;
+	}
+	return true;
+}
+
+/* SIGUSR1 with --stats */
+static void decoder_stats(struct decoderqueue *queues) {
+	struct stats *s;
+
+	stats_requested = false;
+	s = stats_report_begin();
+	for( ; queues != NULL ; queues = queues->next )
+		stats_report_add(s, queues->c);
+	stats_report_print(s);
+}
+
+static void *decoder_main(void *dummy UNUSED) {
+	struct decoderqueue *queues = NULL, *q, **qp;
+	bool stop, busy, closed;
+
+	out = decoder_out;
+	while( true ) {
+		if( stats_requested )
+			decoder_stats(queues);
+		pthread_mutex_lock(&decoder_mutex);
+		while( (q = decoder_incoming) != NULL ) {
+			decoder_incoming = q->next;
+			q->next = queues;
+			queues = q;
+		}
+		stop = decoder_stopping;
+		pthread_mutex_unlock(&decoder_mutex);
+
+		busy = false;
+		qp = &queues;
+		while( (q = *qp) != NULL ) {
+			/* looked at first, so that everything sent
+			 * before closing is decoded below */
+			closed = __atomic_load_n(&q->closed, __ATOMIC_ACQUIRE);
+			if( decode_queue(q) )
+				busy = true;
+			if( closed ) {
+				*qp = q->next;
+				decode_connection_free(q->c);
+				free(q->data);
+				free(q);
+			} else
+				qp = &q->next;
+		}
+		if( busy )
+			continue;
+		if( stop )
+			break;
+
+		pthread_mutex_lock(&decoder_mutex);
+		__atomic_store_n(&decoder_sleeping, true, __ATOMIC_SEQ_CST);
+		if( decoder_incoming == NULL && !decoder_stopping
+				&& !stats_requested && decoder_idle(queues) )
+			pthread_cond_wait(&decoder_wakeup, &decoder_mutex);
+		__atomic_store_n(&decoder_sleeping, false, __ATOMIC_SEQ_CST);
+		pthread_mutex_unlock(&decoder_mutex);
+	}
+	for( q = queues ; q != NULL ; q = q->next )
+		stats_connection_done(q->c);
+	fflush(out);
+	return NULL;
+}
+
+bool decoder_start(void) {
+	sigset_t all, old;
+	int r;
+
+	decoder_out = out;
+	/* signals are for the main loop */
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &old);
+	r = pthread_create(&decoder_thread, NULL, decoder_main, NULL);
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+	if( r != 0 ) {
+		fprintf(stderr, "Error starting decoder thread: %s\n",
+				strerror(r));
+		return false;
+	}
+	return true;
+}
+
+/* decode everything still queued and wait for the decoder to finish */
+void decoder_stop(void) {
+	pthread_mutex_lock(&decoder_mutex);
+	decoder_stopping = true;
+	pthread_cond_signal(&decoder_wakeup);
+	pthread_mutex_unlock(&decoder_mutex);
+	pthread_join(decoder_thread, NULL);
+	if( skippedmessages > 0 )
+		fprintf(stderr, "Decoder could not keep up, skipped %llu messages (%llu bytes)\n",
+				skippedmessages, skippedbytes);
+}
+#endif
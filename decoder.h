@@ -0,0 +1,24 @@
+#ifndef XTRACE_DECODER_H
+#define XTRACE_DECODER_H
+
+/* feed data as seen on the wire into the parser of a connection,
+ * as if it were read and then sent on */
+void decode_data(struct connection *, bool fromserver, const unsigned char *, size_t);
+
+struct connection *decode_connection_new(int id, const char *from, unsigned long long starttime);
+void decode_connection_free(struct connection *);
+
+#ifdef HAVE_PTHREAD
+/* decoding in a separate thread, see decoder.c */
+struct decoderqueue;
+struct iovec;
+
+bool decoder_start(void);
+void decoder_stop(void);
+/* have it look at new data (or stats_requested) */
+void decoder_wake(void);
+struct decoderqueue *decoder_connect(int id, const char *from, unsigned long long starttime);
+void decoder_push(struct decoderqueue *, bool fromserver, const struct iovec *, size_t len);
+void decoder_close(struct decoderqueue *);
+#endif
+#endif
@@ -0,0 +1,145 @@
+/*  This file is part of "xtrace"
+ *  Copyright (C) 2026 Bernhard R. Link
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <config.h>
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#include "filter.h"
+
+/* A filter is a comma separated list of items of the form
+ * [-][class:]name, where class is one of request, reply, event, error
+ * or setup and name an extension name (like RENDER), the name of a
+ * request, event or error (like MotionNotify) or * for everything.
+ * If there are any items without '-', a message is only shown if it
+ * matches one of them, and it is never shown if it matches one with '-'. */
+
+struct filteritem {
+	struct filteritem *next;
+	unsigned int classes;
+	/* NULL for everything */
+	const char *name;
+};
+
+bool filter_active = false;
+static struct filteritem *included, *excluded;
+
+static const struct {
+	const char *name;
+	unsigned int classes;
+} filterclasses[] = {
+	{ "request",	fc_REQUEST },
+	{ "requests",	fc_REQUEST },
+	{ "reply",	fc_REPLY },
+	{ "replies",	fc_REPLY },
+	{ "event",	fc_EVENT },
+	{ "events",	fc_EVENT },
+	{ "error",	fc_ERROR },
+	{ "errors",	fc_ERROR },
+	{ "setup",	fc_SETUP },
+	{ NULL,		0 }
+};
+
+static bool filter_additem(char *item) {
+	struct filteritem *f, **list = &included;
+	unsigned int classes = fc_REQUEST|fc_REPLY|fc_EVENT|fc_ERROR|fc_SETUP;
+	char *colon;
+
+	if( item[0] == '-' ) {
+		list = &excluded;
+		item++;
+	}
+	colon = strchr(item, ':');
+	if( colon != NULL ) {
+		int i;
+
+		*colon = '\0';
+		for( i = 0 ; filterclasses[i].name != NULL ; i++ ) {
+			if( strcmp(filterclasses[i].name, item) == 0 )
+				break;
+		}
+		if( filterclasses[i].name == NULL ) {
+			fprintf(stderr, "Unknown message class '%s' in --filter (expected request, reply, event, error or setup)\n", item);
+			return false;
+		}
+		classes = filterclasses[i].classes;
+		item = colon + 1;
+	}
+	if( item[0] == '\0' ) {
+		fputs("Missing name in --filter (use * for everything)\n",
+				stderr);
+		return false;
+	}
+	f = malloc(sizeof(struct filteritem));
+	if( f == NULL ) {
+		fputs("Out of memory!\n", stderr);
+		return false;
+	}
+	f->classes = classes;
+	if( strcmp(item, "*") == 0 )
+		f->name = NULL;
+	else
+		f->name = item;
+	f->next = *list;
+	*list = f;
+	return true;
+}
+
+bool filter_add(const char *spec) {
+	char *copy, *item, *comma;
+
+	/* the items keep pointing into it */
+	copy = strdup(spec);
+	if( copy == NULL ) {
+		fputs("Out of memory!\n", stderr);
+		return false;
+	}
+	for( item = copy ; item != NULL ; item = comma ) {
+		comma = strchr(item, ',');
+		if( comma != NULL )
+			*(comma++) = '\0';
+		if( item[0] == '\0' )
+			continue;
+		if( !filter_additem(item) )
+			return false;
+	}
+	filter_active = true;
+	return true;
+}
+
+static inline bool filter_matches(const struct filteritem *f, enum filter_class class, const char *extension, const char *name) {
+	for( ; f != NULL ; f = f->next ) {
+		if( (f->classes & class) == 0 )
+			continue;
+		if( f->name == NULL )
+			return true;
+		if( extension != NULL && strcmp(f->name, extension) == 0 )
+			return true;
+		if( name != NULL && strcmp(f->name, name) == 0 )
+			return true;
+	}
+	return false;
+}
+
+bool filter_match(enum filter_class class, const char *extension, const char *name) {
+	if( included != NULL
+			&& !filter_matches(included, class, extension, name) )
+		return false;
+	return !filter_matches(excluded, class, extension, name);
+}
@@ -0,0 +1,27 @@
+#ifndef XTRACE_FILTER_H
+#define XTRACE_FILTER_H
+
+/* Which messages to show at all (--filter), decided before anything
+ * about them is printed. */
+
+enum filter_class {
+	fc_REQUEST = 1,
+	fc_REPLY = 2,
+	fc_EVENT = 4,
+	fc_ERROR = 8,
+	/* the connection setup */
+	fc_SETUP = 16,
+};
+
+/* set once any filter was given */
+extern bool filter_active;
+
+bool filter_add(const char *spec);
+bool filter_match(enum filter_class, const char *extension, const char *name);
+
+/* extension is NULL for the core protocol, name may be NULL if unknown */
+static inline bool filter_shown(enum filter_class class, const char *extension, const char *name) {
+	return !filter_active || filter_match(class, extension, name);
+}
+
+#endif
@@ -0,0 +1,323 @@
+/*  This file is part of "xtrace"
+ *  Copyright (C) 2026 Bernhard R. Link
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/* Run at build time: parses the .proto files like xtrace does at startup
+ * and writes the finalized tables as C source (see use_builtin_tables),
+ * every kind of block (see blocks.c) into one array. */
+
+#include <config.h>
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include "xtrace.h"
+#include "parse.h"
+#include "stringlist.h"
+#include "translate.h"
+#include "blocks.h"
+
+/* what translate.c fills in (parse.c has those in xtrace itself) */
+const struct request *requests;
+size_t num_requests;
+const struct event *events;
+size_t num_events;
+const char * const *errors;
+size_t num_errors;
+const struct extension *extensions;
+size_t num_extensions;
+const struct instruction *unexpected_reply;
+const struct instruction *setup_parameters;
+const char *protocol_names;
+
+bool index_extensions(void) {
+	return true;
+}
+
+/* only their addresses are needed, to write their names */
+bool requestQueryExtension(struct connection *c UNUSED, bool pre UNUSED, bool bigrequest UNUSED, struct expectedreply *reply UNUSED) {
+	abort();
+}
+bool requestInternAtom(struct connection *c UNUSED, bool pre UNUSED, bool bigrequest UNUSED, struct expectedreply *reply UNUSED) {
+	abort();
+}
+bool requestGetAtomName(struct connection *c UNUSED, bool pre UNUSED, bool bigrequest UNUSED, struct expectedreply *reply UNUSED) {
+	abort();
+}
+void replyListFontsWithInfo(struct connection *c UNUSED, bool *ignore UNUSED, bool *dontremove UNUSED, struct expectedreply *d UNUSED) {
+	abort();
+}
+void replyQueryExtension(struct connection *c UNUSED, bool *ignore UNUSED, bool *dontremove UNUSED, struct expectedreply *d UNUSED) {
+	abort();
+}
+void replyInternAtom(struct connection *c UNUSED, bool *ignore UNUSED, bool *dontremove UNUSED, struct expectedreply *d UNUSED) {
+	abort();
+}
+void replyGetAtomName(struct connection *c UNUSED, bool *ignore UNUSED, bool *dontremove UNUSED, struct expectedreply *d UNUSED) {
+	abort();
+}
+
+static bool failed = false;
+
+static void write_string(FILE *f, const char *s, size_t len) {
+	size_t i;
+
+	putc('"', f);
+	for( i = 0 ; i < len ; i++ ) {
+		unsigned char c = s[i];
+
+		if( c == '"' || c == '\\' )
+			fprintf(f, "\\%c", c);
+		else if( c >= ' ' && c <= '~' && c != '?' )
+			putc(c, f);
+		else
+			/* always 3 digits, so a following digit is not eaten */
+			fprintf(f, "\\%03o", c);
+	}
+	putc('"', f);
+}
+
+static void write_pointer(FILE *f, const void *p, enum block_kind kind) {
+	const struct block *b;
+
+	if( p == NULL ) {
+		fputs("NULL", f);
+		return;
+	}
+	b = blocks_find(p);
+	if( kind == bk_STRING ) {
+		if( b == NULL )
+			write_string(f, p, strlen(p));
+		else {
+			write_string(f, b->data, b->len - 1);
+			if( (const char *)p != b->data )
+				fprintf(f, " + %zu",
+						(size_t)((const char *)p - b->data));
+		}
+		return;
+	}
+	assert( b != NULL && b->kind == kind );
+	fprintf(f, "&%s[%zu]", block_kinds[kind].array, b->index +
+			((const char *)p - b->data) / block_kinds[kind].size);
+}
+
+static bool write_function(FILE *f, generic_func *func) {
+	int i;
+
+	if( func == NULL ) {
+		fputs("NULL", f);
+		return true;
+	}
+	i = blocks_function(func);
+	if( i < 0 ) {
+		fputs("gentables: unknown special function!\n", stderr);
+		return false;
+	}
+	fputs(block_functions[i].name, f);
+	return true;
+}
+
+static void write_element(FILE *f, enum block_kind kind, const char *data) {
+	switch( kind ) {
+		case bk_INSTRUCTION: {
+			const struct instruction *in = (const struct instruction *)data;
+			enum block_kind ok = blocks_option_kind(in->op);
+
+			fprintf(f, "{ %u, %u, %u, { %" PRIu32 "U }, { .%s = ",
+					in->op, in->flags, in->ofs, in->arg,
+					(ok == bk_VALUE)?"values":
+					(ok == bk_INSTRUCTION)?"code":
+					"constants");
+			write_pointer(f, in->o.constants, ok);
+			fputs(" } }", f);
+			break;
+		}
+		case bk_CONSTANT: {
+			const struct constant *c = (const struct constant *)data;
+
+			fprintf(f, "{ %" PRIu32 "U, %" PRIu32 "U }",
+					c->value, c->name);
+			break;
+		}
+		case bk_VALUE: {
+			const struct value *v = (const struct value *)data;
+
+			fputs("{ ", f);
+			write_pointer(f, v->constants, bk_CONSTANT);
+			fprintf(f, ", %" PRIu32 "U, %" PRIu32 "U, %u }",
+					v->flag, v->name, v->type);
+			break;
+		}
+		case bk_REQUEST: {
+			const struct request *r = (const struct request *)data;
+
+			fputs("{ ", f);
+			write_pointer(f, r->name, bk_STRING);
+			fputs(", ", f);
+			write_pointer(f, r->parameters, bk_INSTRUCTION);
+			fputs(", ", f);
+			write_pointer(f, r->answers, bk_INSTRUCTION);
+			fputs(", ", f);
+			if( !write_function(f, (generic_func *)r->request_func) )
+				failed = true;
+			fputs(", ", f);
+			if( !write_function(f, (generic_func *)r->reply_func) )
+				failed = true;
+			fprintf(f, ", %d }", r->record_variables);
+			break;
+		}
+		case bk_EVENT: {
+			const struct event *e = (const struct event *)data;
+
+			fputs("{ ", f);
+			write_pointer(f, e->name, bk_STRING);
+			fputs(", ", f);
+			write_pointer(f, e->parameters, bk_INSTRUCTION);
+			fprintf(f, ", %d }", (int)e->type);
+			break;
+		}
+		case bk_EXTENSION: {
+			const struct extension *e = (const struct extension *)data;
+
+			fputs("{ ", f);
+			write_pointer(f, e->name, bk_STRING);
+			fprintf(f, ", %zu, ", e->namelen);
+			write_pointer(f, e->subrequests, bk_REQUEST);
+			fprintf(f, ", %u, ", (unsigned int)e->numsubrequests);
+			write_pointer(f, e->events, bk_EVENT);
+			fprintf(f, ", %u, ", (unsigned int)e->numevents);
+			write_pointer(f, e->errors, bk_ERROR);
+			fprintf(f, ", %u, %u, ", (unsigned int)e->numerrors,
+					(unsigned int)e->numxgevents);
+			write_pointer(f, e->xgevents, bk_EVENT);
+			fputs(" }", f);
+			break;
+		}
+		case bk_ERROR:
+			write_pointer(f, *(const char * const *)data, bk_STRING);
+			break;
+		default:
+			assert( kind != kind );
+	}
+}
+
+static void write_tables(FILE *f, const char *name) {
+	enum block_kind k;
+	size_t i, j, counts[bk_COUNT];
+
+	fprintf(f, "/* generated by gentables from %s, do not edit */\n"
+			"#include <config.h>\n\n"
+			"#include <stdbool.h>\n"
+			"#include <stddef.h>\n"
+			"#include <stdint.h>\n"
+			"#include <stdio.h>\n\n"
+			"#include \"xtrace.h\"\n"
+			"#include \"parse.h\"\n"
+			"#include \"translate.h\"\n\n", name);
+	memset(counts, 0, sizeof(counts));
+	for( i = 0 ; i < numblocks ; i++ ) {
+		k = blocks[i].kind;
+		if( k == bk_NONE || k == bk_STRING )
+			continue;
+		blocks[i].index = counts[k];
+		counts[k] += blocks[i].len / block_kinds[k].size;
+	}
+	/* declare all first, as they point to each other */
+	for( k = bk_INSTRUCTION ; k < bk_COUNT ; k++ ) {
+		if( counts[k] > 0 )
+			fprintf(f, "static const %s %s[%zu];\n",
+					block_kinds[k].type, block_kinds[k].array,
+					counts[k]);
+	}
+	for( k = bk_INSTRUCTION ; k < bk_COUNT ; k++ ) {
+		if( counts[k] == 0 )
+			continue;
+		fprintf(f, "\nstatic const %s %s[%zu] = {\n",
+				block_kinds[k].type, block_kinds[k].array, counts[k]);
+		for( i = 0 ; i < numblocks ; i++ ) {
+			const struct block *b = &blocks[i];
+
+			if( b->kind != k )
+				continue;
+			for( j = 0 ; j < b->len / block_kinds[k].size ; j++ ) {
+				putc('\t', f);
+				write_element(f, k, b->data
+						+ j * block_kinds[k].size);
+				fputs(",\n", f);
+			}
+		}
+		fputs("};\n", f);
+	}
+	fputs("\nbool use_builtin_tables(void) {\n\trequests = ", f);
+	write_pointer(f, requests, bk_REQUEST);
+	fprintf(f, ";\n\tnum_requests = %zu;\n\tevents = ", num_requests);
+	write_pointer(f, events, bk_EVENT);
+	fprintf(f, ";\n\tnum_events = %zu;\n\terrors = ", num_events);
+	write_pointer(f, errors, bk_ERROR);
+	fprintf(f, ";\n\tnum_errors = %zu;\n\textensions = ", num_errors);
+	write_pointer(f, extensions, bk_EXTENSION);
+	fprintf(f, ";\n\tnum_extensions = %zu;\n\tunexpected_reply = ",
+			num_extensions);
+	write_pointer(f, unexpected_reply, bk_INSTRUCTION);
+	fputs(";\n\tsetup_parameters = ", f);
+	write_pointer(f, setup_parameters, bk_INSTRUCTION);
+	fputs(";\n\tprotocol_names = ", f);
+	write_pointer(f, protocol_names, bk_STRING);
+	fputs(";\n\treturn index_extensions();\n}\n", f);
+}
+
+int main(int argc, char *argv[]) {
+	struct parser *parser;
+	int c;
+
+	blocks_tracking = true;
+	stringlist_init();
+	parser = parser_init();
+	if( parser == NULL )
+		return EXIT_FAILURE;
+	while( (c = getopt(argc, argv, "I:")) != -1 ) {
+		if( c != 'I' ) {
+			fputs("Syntax: gentables [-I dir]... file.proto\n",
+					stderr);
+			return EXIT_FAILURE;
+		}
+		add_searchpath(parser, optarg);
+	}
+	if( optind + 1 != argc ) {
+		fputs("Syntax: gentables [-I dir]... file.proto\n", stderr);
+		return EXIT_FAILURE;
+	}
+	translate(parser, argv[optind]);
+	finalize_everything(parser);
+	if( !parser_free(parser) )
+		return EXIT_FAILURE;
+
+	if( !blocks_walk() )
+		return EXIT_FAILURE;
+	write_tables(stdout, argv[optind]);
+	blocks_done();
+	stringlist_done();
+	if( failed || ferror(stdout) || fclose(stdout) != 0 ) {
+		fputs("gentables: error writing the tables!\n", stderr);
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,184 @@
+/*  This file is part of "xtrace"
+ *  Copyright (C) 2026 Bernhard R. Link
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+
+#include <config.h>
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#ifdef HAVE_X86_SIMD
+#include <immintrin.h>
+#endif
+
+#include "hexlist.h"
+
+/* all kernels write the digits of the elements into a buffer (most
+ * significant byte first) and put_elements makes the list out of
+ * them, each element followed by a comma */
+
+typedef char *hexlist_kernel(char *, const unsigned char *, size_t, unsigned int, bool);
+
+static inline char *put_elements(char *out, const char *digits, size_t count, unsigned int size) {
+	unsigned int w = 2*size;
+
+	for( ; count > 0 ; count-- ) {
+		out[0] = '0';
+		out[1] = 'x';
+		memcpy(out + 2, digits, w);
+		out[2 + w] = ',';
+		out += 3 + w;
+		digits += w;
+	}
+	return out;
+}
+
+static const char hexpairs[513] =
+	"000102030405060708090a0b0c0d0e0f"
+	"101112131415161718191a1b1c1d1e1f"
+	"202122232425262728292a2b2c2d2e2f"
+	"303132333435363738393a3b3c3d3e3f"
+	"404142434445464748494a4b4c4d4e4f"
+	"505152535455565758595a5b5c5d5e5f"
+	"606162636465666768696a6b6c6d6e6f"
+	"707172737475767778797a7b7c7d7e7f"
+	"808182838485868788898a8b8c8d8e8f"
+	"909192939495969798999a9b9c9d9e9f"
+	"a0a1a2a3a4a5a6a7a8a9aaabacadaeaf"
+	"b0b1b2b3b4b5b6b7b8b9babbbcbdbebf"
+	"c0c1c2c3c4c5c6c7c8c9cacbcccdcecf"
+	"d0d1d2d3d4d5d6d7d8d9dadbdcdddedf"
+	"e0e1e2e3e4e5e6e7e8e9eaebecedeeef"
+	"f0f1f2f3f4f5f6f7f8f9fafbfcfdfeff";
+
+static char *hexlist_scalar(char *out, const unsigned char *data, size_t count, unsigned int size, bool bigendian) {
+	char digits[8];
+	unsigned int i;
+
+	for( ; count > 0 ; count--, data += size ) {
+		for( i = 0 ; i < size ; i++ ) {
+			unsigned char b = data[bigendian ? i : size - 1 - i];
+
+			memcpy(digits + 2*i, hexpairs + 2*b, 2);
+		}
+		out = put_elements(out, digits, 1, size);
+	}
+	return out;
+}
+
+#ifdef HAVE_X86_SIMD
+/* 0..15 to '0'..'9','a'..'f' */
+__attribute__((target("sse2")))
+static inline __m128i ascii_sse2(__m128i v) {
+	__m128i letters = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8(9)),
+			_mm_set1_epi8('a' - '0' - 10));
+
+	return _mm_add_epi8(_mm_add_epi8(v, _mm_set1_epi8('0')), letters);
+}
+
+__attribute__((target("sse2")))
+static char *hexlist_sse2(char *out, const unsigned char *data, size_t count, unsigned int size, bool bigendian) {
+	size_t per = 16 / size;
+	const __m128i nibble = _mm_set1_epi8(0x0F);
+	char digits[32];
+
+	for( ; count >= per ; count -= per, data += 16 ) {
+		__m128i x = _mm_loadu_si128((const __m128i *)data);
+		__m128i hi, lo;
+
+		if( !bigendian && size > 1 ) {
+			x = _mm_or_si128(_mm_slli_epi16(x, 8),
+					_mm_srli_epi16(x, 8));
+			if( size == 4 ) {
+				x = _mm_shufflelo_epi16(x, _MM_SHUFFLE(2,3,0,1));
+				x = _mm_shufflehi_epi16(x, _MM_SHUFFLE(2,3,0,1));
+			}
+		}
+		hi = _mm_and_si128(_mm_srli_epi16(x, 4), nibble);
+		lo = _mm_and_si128(x, nibble);
+		_mm_storeu_si128((__m128i *)digits,
+				ascii_sse2(_mm_unpacklo_epi8(hi, lo)));
+		_mm_storeu_si128((__m128i *)(digits + 16),
+				ascii_sse2(_mm_unpackhi_epi8(hi, lo)));
+		out = put_elements(out, digits, per, size);
+	}
+	return hexlist_scalar(out, data, count, size, bigendian);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i ascii_avx2(__m256i v) {
+	__m256i letters = _mm256_and_si256(
+			_mm256_cmpgt_epi8(v, _mm256_set1_epi8(9)),
+			_mm256_set1_epi8('a' - '0' - 10));
+
+	return _mm256_add_epi8(_mm256_add_epi8(v, _mm256_set1_epi8('0')),
+			letters);
+}
+
+__attribute__((target("avx2")))
+static char *hexlist_avx2(char *out, const unsigned char *data, size_t count, unsigned int size, bool bigendian) {
+	size_t per = 32 / size;
+	const __m256i nibble = _mm256_set1_epi8(0x0F);
+	/* (elements never cross the 128 bit lanes) */
+	const __m256i swap16 = _mm256_setr_epi8(
+			1,0,3,2,5,4,7,6,9,8,11,10,13,12,15,14,
+			1,0,3,2,5,4,7,6,9,8,11,10,13,12,15,14);
+	const __m256i swap32 = _mm256_setr_epi8(
+			3,2,1,0,7,6,5,4,11,10,9,8,15,14,13,12,
+			3,2,1,0,7,6,5,4,11,10,9,8,15,14,13,12);
+	char digits[64];
+
+	for( ; count >= per ; count -= per, data += 32 ) {
+		__m256i x = _mm256_loadu_si256((const __m256i *)data);
+		__m256i hi, lo, first, second;
+
+		if( !bigendian && size > 1 )
+			x = _mm256_shuffle_epi8(x, (size == 4) ? swap32 : swap16);
+		hi = _mm256_and_si256(_mm256_srli_epi16(x, 4), nibble);
+		lo = _mm256_and_si256(x, nibble);
+		/* those interleave within each lane, so put the lanes
+		 * back in order */
+		first = ascii_avx2(_mm256_unpacklo_epi8(hi, lo));
+		second = ascii_avx2(_mm256_unpackhi_epi8(hi, lo));
+		_mm256_storeu_si256((__m256i *)digits,
+				_mm256_permute2x128_si256(first, second, 0x20));
+		_mm256_storeu_si256((__m256i *)(digits + 32),
+				_mm256_permute2x128_si256(first, second, 0x31));
+		out = put_elements(out, digits, per, size);
+	}
+	return hexlist_sse2(out, data, count, size, bigendian);
+}
+#endif
+
+static hexlist_kernel *kernel = hexlist_scalar;
+
+void hexlist_init(void) {
+#ifdef HAVE_X86_SIMD
+	__builtin_cpu_init();
+	if( __builtin_cpu_supports("avx2") )
+		kernel = hexlist_avx2;
+	else if( __builtin_cpu_supports("sse2") )
+		kernel = hexlist_sse2;
+#endif
+}
+
+size_t hexlist(char *out, const unsigned char *data, size_t count, unsigned int size, bool bigendian) {
+	if( count == 0 )
+		return 0;
+	/* without the last comma */
+	return kernel(out, data, count, size, bigendian) - out - 1;
+}
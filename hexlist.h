@@ -0,0 +1,13 @@
+#ifndef XTRACE_HEXLIST_H
+#define XTRACE_HEXLIST_H
+
+/* Long lists of CARD8/16/32 without constants are written in bulk:
+ * every element as "0x" and 2*size hex digits, separated by commas.
+ * out needs room for count*(3+2*size) bytes, returns how many were
+ * written. The kernel (SSE2, AVX2 or plain C) is chosen by
+ * hexlist_init depending on the cpu. */
+
+size_t hexlist(char *out, const unsigned char *data, size_t count, unsigned int size, bool bigendian);
+void hexlist_init(void);
+
+#endif
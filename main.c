@@ -16,12 +16,14 @@
 #include <config.h>
 
 #include <errno.h>
+#include <limits.h>
 #include <assert.h>
 #include <stdint.h>
 #include <sys/types.h>
 #include <sys/time.h>
 #include <stdbool.h>
 #include <signal.h>
+#include <stdarg.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
@@ -29,17 +31,34 @@
 #include <sys/select.h>
 #include <sys/wait.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <getopt.h>
 
+#include <sys/uio.h>
 #if HAVE_SENDMSG
 #include <sys/socket.h>
 #endif
+#if HAVE_EPOLL
+#include <sys/epoll.h>
+#endif
 
 #include "xtrace.h"
 #include "stringlist.h"
+#include "decoder.h"
+#include "capture.h"
+#include "replay.h"
+#include "output.h"
+#include "filter.h"
+#include "stats.h"
 #include "translate.h"
+#include "tablecache.h"
+#include "hexlist.h"
 
+#ifdef HAVE_PTHREAD
+__thread FILE *out;
+#else
 FILE *out;
+#endif
 
 bool readwritedebug = false;
 bool copyauth = true;
@@ -51,7 +70,16 @@ bool print_timestamps = false;
 bool print_reltimestamps = false;
 bool print_uptimestamps = false;
 static bool buffered = false;
+static bool decoupled = false;
+static const char *capturefile = NULL;
+static const char *replayfile = NULL;
+static unsigned int jobs = 1;
+static bool asyncoutput = false;
+static enum output_policy outputpolicy = op_BLOCK;
 size_t maxshownlistlen = SIZE_MAX;
+/* buffers start with INITIAL_BUFFER_SIZE and grow up to that */
+size_t maxbuffersize = 16*1024*1024;
+bool checksum_streamed = false;
 
 const char *out_displayname = NULL;
 char *out_protocol,*out_hostname;
@@ -64,6 +92,16 @@ static pid_t child_pid = 0;
 
 struct connection *connections = NULL ;
 
+static void set_nonblocking(int fd) {
+	int flags = fcntl(fd, F_GETFL);
+
+	if( flags == -1 || fcntl(fd, F_SETFL, flags|O_NONBLOCK) == -1 ) {
+		int e = errno;
+		fprintf(stderr, "Error %d setting O_NONBLOCK: %s\n",
+				e, strerror(e));
+	}
+}
+
 static void acceptConnection(int listener) {
 	struct timeval tv;
 	struct connection *c;
@@ -100,17 +138,41 @@ static void acceptConnection(int listener) {
 		fprintf(stderr,"Error connecting to server %s\n",out_displayname);
 		return;
 	}
+	if( !ringbuffer_init(&c->clientring, INITIAL_BUFFER_SIZE) ||
+	    !ringbuffer_init(&c->serverring, INITIAL_BUFFER_SIZE) ) {
+		ringbuffer_done(&c->clientring);
+		close(c->client_fd);
+		close(c->server_fd);
+		free(c->from);
+		free(c);
+		return;
+	}
+	/* the main loop never wants to block in read or write */
+	set_nonblocking(c->client_fd);
+	set_nonblocking(c->server_fd);
 	c->id = id++;
+#ifdef HAVE_PTHREAD
+	if( decoupled ) {
+		c->decoder = decoder_connect(c->id, c->from, c->starttime);
+		if( c->decoder == NULL ) {
+			ringbuffer_done(&c->clientring);
+			ringbuffer_done(&c->serverring);
+			close(c->client_fd);
+			close(c->server_fd);
+			free(c->from);
+			free(c);
+			return;
+		}
+	}
+#endif
+	if( capturefile != NULL )
+		capture_connect(c->id, c->from);
 	connections = c;
 }
 
-static ssize_t doread(int fd, void *buf, size_t n, struct fdqueue *fdq)
+static ssize_t doread(int fd, struct iovec *iov, int iovcnt, struct fdqueue *fdq)
 {
 #if HAVE_SENDMSG
-	struct iovec iov = {
-		.iov_base = buf,
-		.iov_len = n,
-	};
 	union {
 		struct cmsghdr cmsghdr;
 		char buf[CMSG_SPACE(FDQUEUE_MAX_FD * sizeof(int))];
@@ -118,8 +180,8 @@ static ssize_t doread(int fd, void *buf, size_t n, struct fdqueue *fdq)
 	struct msghdr msg = {
 		.msg_name = NULL,
 		.msg_namelen = 0,
-		.msg_iov = &iov,
-		.msg_iovlen = 1,
+		.msg_iov = iov,
+		.msg_iovlen = iovcnt,
 		.msg_control = cmsgbuf.buf,
 		.msg_controllen = CMSG_SPACE(sizeof(int) * (FDQUEUE_MAX_FD - fdq->nfd)),
 	};
@@ -145,11 +207,11 @@ static ssize_t doread(int fd, void *buf, size_t n, struct fdqueue *fdq)
 	}
 	return ret;
 #else
-	return read(fd, buf, n);
+	return readv(fd, iov, iovcnt);
 #endif
 }
 
-static ssize_t dowrite(int fd, const void *buf, size_t n, struct fdqueue *fdq)
+static ssize_t dowrite(int fd, struct iovec *iov, int iovcnt, struct fdqueue *fdq)
 {
 #if HAVE_SENDMSG
 	if (fdq->nfd) {
@@ -157,15 +219,11 @@ static ssize_t dowrite(int fd, const void *buf, size_t n, struct fdqueue *fdq)
 			struct cmsghdr cmsghdr;
 			char buf[CMSG_SPACE(FDQUEUE_MAX_FD * sizeof(int))];
 		} cmsgbuf;
-		struct iovec iov = {
-			.iov_base = buf,
-			.iov_len = n,
-		};
 		struct msghdr msg = {
 			.msg_name = NULL,
 			.msg_namelen = 0,
-			.msg_iov = &iov,
-			.msg_iovlen = 1,
+			.msg_iov = iov,
+			.msg_iovlen = iovcnt,
 			.msg_control = cmsgbuf.buf,
 			.msg_controllen = CMSG_LEN(fdq->nfd * sizeof (int)),
 		};
@@ -187,17 +245,382 @@ static ssize_t dowrite(int fd, const void *buf, size_t n, struct fdqueue *fdq)
 	} else
 #endif
 	{
-		return write(fd, buf, n);
+		return writev(fd, iov, iovcnt);
 	}
 }
 
-static int mainqueue(int listener) {
-	int n, r = 0;
-	fd_set readfds,writefds,exceptfds;
-	struct connection *c;
-	unsigned int allowsent = 1;
+/* what the sockets of a connection are ready for (as told by select
+ * or epoll) or what the connection is waiting for */
+#define CLIENT_READ	0x01
+#define CLIENT_WRITE	0x02
+#define CLIENT_EXCEPT	0x04
+#define SERVER_READ	0x10
+#define SERVER_WRITE	0x20
+#define SERVER_EXCEPT	0x40
+
+static unsigned int allowsent = 1;
+
+static unsigned int connection_wants(const struct connection *c) {
+	unsigned int wants = 0;
+
+	if( c->client_fd != -1 ) {
+		if( !ringbuffer_full(&c->clientring) && FDQUEUE_MAX_FD > c->clientfdq.nfd )
+			wants |= CLIENT_READ;
+		wants |= CLIENT_EXCEPT;
+		if( (c->serverignore > 0 && c->serverring.count > 0) || c->serverfdq.nfd > 0 )
+			wants |= CLIENT_WRITE;
+	}
+	if( c->server_fd != -1 ) {
+		if( !ringbuffer_full(&c->serverring) && FDQUEUE_MAX_FD > c->serverfdq.nfd )
+			wants |= SERVER_READ;
+		wants |= SERVER_EXCEPT;
+		if( ((c->clientignore > 0 && c->clientring.count > 0) || c->clientfdq.nfd > 0)
+				&& allowsent > 0)
+			wants |= SERVER_WRITE;
+	}
+	return wants;
+}
+
+/* data left over from a side that already closed, that is to be
+ * discarded without waiting for any socket */
+static inline bool connection_has_leftovers(const struct connection *c) {
+	return (c->client_fd == -1 && c->serverring.count > 0 && c->serverignore > 0)
+		|| (c->server_fd == -1 && c->clientring.count > 0 && c->clientignore > 0);
+}
+
+/* forward an EOF once everything from that side is sent,
+ * returns true if both sides are closed */
+static bool connection_finished(struct connection *c) {
+	if( c->client_fd != -1 && c->server_fd == -1 && c->serverring.count == 0 && c->serverfdq.nfd == 0 ) {
+		close(c->client_fd);
+		c->client_fd = -1;
+		if( readwritedebug ) {
+			out_printf(&c->output, "%03d:>:sent EOF\n", c->id);
+			out_flush(&c->output);
+		}
+	}
+	if( c->client_fd == -1 && c->server_fd != -1 && c->clientring.count == 0 && c->clientfdq.nfd == 0 ) {
+		close(c->server_fd);
+		c->server_fd = -1;
+		if( readwritedebug ) {
+			out_printf(&c->output, "%03d:<:sent EOF\n", c->id);
+			out_flush(&c->output);
+		}
+	}
+	return c->client_fd == -1 && c->server_fd == -1;
+}
+
+static void free_connection(struct connection *c) {
+	int i;
+
+	for ( i = 0; i < c->clientfdq.nfd; i++ )
+		close(c->clientfdq.fd[i]);
+	for ( i = 0; i < c->serverfdq.nfd; i++ )
+		close(c->serverfdq.fd[i]);
+	free_extensions(c);
+	free_expectedreplies(c);
+	atoms_free(c);
+	ringbuffer_done(&c->clientring);
+	ringbuffer_done(&c->serverring);
+	stats_connection_done(c);
+	out_done(&c->output);
+#ifdef HAVE_PTHREAD
+	if( c->decoder != NULL )
+		decoder_close(c->decoder);
+#endif
+	if( capturefile != NULL )
+		capture_close(c->id);
+	free(c->from);
+	free(c);
+}
+
+/* whether something read is not yet decoded (with --interactive
+ * requests are only decoded once the last one was sent on),
+ * the rest of a streamed message needs a look as it arrives */
+static inline bool client_undecoded(const struct connection *c) {
+	return (c->clientring.count > c->clientignore
+		&& (c->clientignore == 0 || !interactive))
+		|| c->clientstreamed.left > 0;
+}
+
+static inline bool server_undecoded(const struct connection *c) {
+	return c->serverring.count > c->serverignore
+		|| c->serverstreamed.left > 0;
+}
+
+static inline bool would_block(int e) {
+	return e == EAGAIN || e == EWOULDBLOCK || e == EINTR;
+}
+
+/* do everything the sockets are ready for, afterwards *ready only
+ * contains what might still not block */
+static void handle_connection(struct connection *c, unsigned int *ready) {
+	unsigned int todo = *ready & connection_wants(c);
+
+	if( c->client_fd != -1 ) {
+		if( (todo & CLIENT_EXCEPT) != 0 ) {
+			close(c->client_fd);
+			c->client_fd = -1;
+			fprintf(stdout,"%03d: exception in communication with client\n",c->id);
+			return;
+		}
+		if( (todo & CLIENT_WRITE) != 0 ) {
+			size_t towrite = c->serverring.count;
+			struct iovec iov[2];
+			ssize_t written;
+
+			if( c->serverignore < towrite )
+				towrite = c->serverignore;
+			written = dowrite(c->client_fd, iov,
+					ringbuffer_data(&c->serverring, iov, towrite),
+					&c->serverfdq);
+			if( written >= 0 ) {
+				if( readwritedebug )
+					fprintf(stdout,"%03d:>:wrote %u bytes\n",c->id,(unsigned int)written);
+				if( (size_t)written < towrite )
+					*ready &= ~CLIENT_WRITE;
+				ringbuffer_consume(&c->serverring, written);
+				shrink_if_idle(&c->serverring);
+				c->serverignore -= written;
+				if( c->serverring.count == 0 ) {
+					if( c->server_fd == -1 ) {
+						close(c->client_fd);
+						c->client_fd = -1;
+						if( readwritedebug )
+							fprintf(stdout,"%03d:>:send EOF\n",c->id);
+						return;
+					}
+				} else if( c->serverignore == 0 ) {
+					parse_server(c);
+				}
+			} else if( would_block(errno) ) {
+				*ready &= ~CLIENT_WRITE;
+			} else {
+				int e = errno;
+				close(c->client_fd);
+				c->client_fd = -1;
+				if( readwritedebug )
+					fprintf(stdout,"%03d: error writing to client: %d=%s\n",c->id,e,strerror(e));
+				return;
+			}
+		}
+		if( (todo & CLIENT_READ) != 0 ) {
+			size_t toread = c->clientring.size - c->clientring.count;
+			unsigned int nfd = c->clientfdq.nfd;
+			struct iovec iov[2];
+			ssize_t wasread = doread(c->client_fd, iov,
+					ringbuffer_space(&c->clientring, iov),
+					&c->clientfdq);
+			assert( toread > 0 );
+			if( wasread > 0 ) {
+				if( readwritedebug )
+					fprintf(stdout,"%03d:<:received %u bytes\n",c->id,(unsigned int)wasread);
+				if( (size_t)wasread < toread )
+					*ready &= ~CLIENT_READ;
+				ringbuffer_added(&c->clientring, wasread);
+				if( capturefile != NULL )
+					capture_data(c->id, false,
+						c->clientfdq.nfd - nfd,
+						iov, wasread);
+#ifdef HAVE_PTHREAD
+				if( c->decoder != NULL )
+					decoder_push(c->decoder, false, iov, wasread);
+#endif
+				/* send on everything at once */
+				if( capturefile != NULL || decoupled )
+					c->clientignore += wasread;
+			} else if( wasread < 0 && would_block(errno) ) {
+				*ready &= ~CLIENT_READ;
+			} else {
+				if( readwritedebug )
+					fprintf(stdout,"%03d:<:got EOF\n",c->id);
+				close(c->client_fd);
+				c->client_fd = -1;
+				return;
+			}
+			if( client_undecoded(c) )
+				parse_client(c);
+		}
+	} else if( c->serverring.count > 0 && c->serverignore > 0 ) {
+		unsigned int min;
+		/* discard additional events */
+		min = c->serverring.count;
+		if( min > c->serverignore )
+			min = c->serverignore;
+		fprintf(stdout,"%03d:s->?: discarded last answer of %u bytes\n",c->id,min);
+		ringbuffer_consume(&c->serverring, min);
+		c->serverignore -= min;
+		if( c->serverignore == 0 && c->serverring.count > 0 ) {
+			parse_server(c);
+		}
+	}
+	if( c->server_fd != -1 ) {
+		if( (todo & SERVER_EXCEPT) != 0 ) {
+			close(c->server_fd);
+			c->server_fd = -1;
+			fprintf(stdout,"%03d: exception in communication with server\n",c->id);
+			return;
+		}
+		if( (todo & SERVER_WRITE) != 0 ) {
+			size_t towrite = c->clientring.count;
+			struct iovec iov[2];
+			ssize_t written;
+
+			if( c->clientignore < towrite )
+				towrite = c->clientignore;
+			written = dowrite(c->server_fd, iov,
+					ringbuffer_data(&c->clientring, iov, towrite),
+					&c->clientfdq);
+			if( interactive && allowsent > 0 )
+				allowsent--;
+			if( written >= 0 ) {
+				if( readwritedebug )
+					fprintf(stdout,"%03d:<:wrote %u bytes\n",c->id,(unsigned int)written);
+				if( (size_t)written < towrite )
+					*ready &= ~SERVER_WRITE;
+				ringbuffer_consume(&c->clientring, written);
+				shrink_if_idle(&c->clientring);
+				c->clientignore -= written;
+				if( c->clientring.count != 0 &&
+				    c->clientignore == 0 ) {
+					parse_client(c);
+				}
+			} else if( would_block(errno) ) {
+				*ready &= ~SERVER_WRITE;
+			} else {
+				int e = errno;
+				close(c->server_fd);
+				c->server_fd = -1;
+				if( readwritedebug )
+					fprintf(stdout,"%03d: error writing to server: %d=%s\n",c->id,e,strerror(e));
+				return;
+			}
+		}
+		if( (todo & SERVER_READ) != 0 ) {
+			size_t toread = c->serverring.size - c->serverring.count;
+			unsigned int nfd = c->serverfdq.nfd;
+			struct iovec iov[2];
+			ssize_t wasread = doread(c->server_fd, iov,
+					ringbuffer_space(&c->serverring, iov),
+					&c->serverfdq);
+			assert( toread > 0 );
+			if( wasread > 0 ) {
+				if( readwritedebug )
+					fprintf(stdout,"%03d:>:received %u bytes\n",c->id,(unsigned int)wasread);
+				if( (size_t)wasread < toread )
+					*ready &= ~SERVER_READ;
+				ringbuffer_added(&c->serverring, wasread);
+				if( capturefile != NULL )
+					capture_data(c->id, true,
+						c->serverfdq.nfd - nfd,
+						iov, wasread);
+#ifdef HAVE_PTHREAD
+				if( c->decoder != NULL )
+					decoder_push(c->decoder, true, iov, wasread);
+#endif
+				/* send on everything at once */
+				if( capturefile != NULL || decoupled )
+					c->serverignore += wasread;
+			} else if( wasread < 0 && would_block(errno) ) {
+				*ready &= ~SERVER_READ;
+			} else {
+				if( readwritedebug )
+					fprintf(stdout,"%03d:>:got EOF\n",c->id);
+				close(c->server_fd);
+				c->server_fd = -1;
+			}
+			if( server_undecoded(c) )
+				parse_server(c);
+		}
+	} else if( c->clientring.count > 0 && c->clientignore > 0 ) {
+		unsigned int min;
+		/* discard additional events */
+		min = c->clientring.count;
+		if( min > c->clientignore )
+			min = c->clientignore;
+		fprintf(stdout,"%03d:<: discarding last request of %u bytes\n",c->id,min);
+		ringbuffer_consume(&c->clientring, min);
+		c->clientignore -= min;
+		if( c->clientignore == 0 && c->clientring.count > 0 ) {
+			parse_client(c);
+		}
+	}
+}
+
+/* remove c from the list of connections, returns true if xtrace
+ * should terminate now */
+static bool remove_connection(struct connection *c) {
+	struct connection **p;
+
+	for( p = &connections ; *p != c ; p = &(*p)->next )
+		assert( *p != NULL );
+	*p = c->next;
+	free_connection(c);
+	return connections == NULL && stopwhennone && child_pid == 0;
+}
+
+/* the command started has terminated, returns true if xtrace
+ * should terminate now */
+static bool reap_child(int *exitcode) {
 	int status;
 
+	caught_child_signal = false;
+	if( waitpid(child_pid,&status,WNOHANG) != child_pid )
+		return false;
+	child_pid = 0;
+	if( connections != NULL || waitforclient )
+		return false;
+	/* TODO: instead wait a bit before terminating? */
+	if( WIFEXITED(status) )
+		*exitcode = WEXITSTATUS(status);
+	else
+		*exitcode = WTERMSIG(status) + 128;
+	return true;
+}
+
+/* SIGUSR1 with --stats */
+static void report_stats(void) {
+	struct stats *s;
+	struct connection *c;
+
+#ifdef HAVE_PTHREAD
+	if( decoupled ) {
+		/* the decoder thread has the numbers */
+		decoder_wake();
+		return;
+	}
+#endif
+	stats_requested = false;
+	s = stats_report_begin();
+	for( c = connections ; c != NULL ; c = c->next )
+		stats_report_add(s, c);
+	stats_report_print(s);
+}
+
+/* returns true if more requests may be sent now */
+static bool read_confirmation(void) {
+	char buffer[201];
+	ssize_t isread;
+	int number;
+
+	isread = read(0,buffer,200);
+	if( isread == 0 )
+		exit(EXIT_SUCCESS);
+	if( isread < 0 )
+		return false;
+	buffer[isread]='\0';
+	number = atoi(buffer);
+	if( number <= 0 )
+		number = 1;
+	allowsent += number;
+	return true;
+}
+
+static int mainqueue_select(int listener) {
+	int n, r = 0, exitcode;
+	fd_set readfds,writefds,exceptfds;
+	struct connection *c, *h;
+
 	while( 1 ) {
 		n =  listener+1;
 		FD_ZERO(&readfds);
@@ -205,79 +628,47 @@ static int mainqueue(int listener) {
 		FD_ZERO(&exceptfds);
 		FD_SET(listener,&readfds);
 
-		c = connections;
-		while( c != NULL ) {
-			if( c->client_fd != -1 && c->server_fd == -1 && c->servercount == 0 && c->serverfdq.nfd == 0 ) {
-				close(c->client_fd);
-				c->client_fd = -1;
-				if( readwritedebug )
-					fprintf(out,"%03d:>:sent EOF\n",c->id);
+		for( c = connections ; c != NULL ; c = h ) {
+			unsigned int wants;
+
+			h = c->next;
+			if( connection_finished(c) ) {
+				if( remove_connection(c) )
+					return EXIT_SUCCESS;
+				continue;
 			}
+			wants = connection_wants(c);
 			if( c->client_fd != -1 ) {
-				if( sizeof(c->clientbuffer) > c->clientcount && FDQUEUE_MAX_FD > c->clientfdq.nfd )
+				if( (wants & CLIENT_READ) != 0 )
 					FD_SET(c->client_fd,&readfds);
+				if( (wants & CLIENT_WRITE) != 0 )
+					FD_SET(c->client_fd,&writefds);
 				FD_SET(c->client_fd,&exceptfds);
 				if( c->client_fd >= n )
 					n = c->client_fd+1;
-				if( c->serverignore > 0 && c->servercount > 0 || c->serverfdq.nfd > 0 )
-					FD_SET(c->client_fd,&writefds);
-			} else if( c->server_fd != -1 && c->clientcount == 0 && c->clientfdq.nfd == 0 ) {
-				close(c->server_fd);
-				c->server_fd = -1;
-				if( readwritedebug )
-					fprintf(out,"%03d:<:sent EOF\n",c->id);
 			}
 			if( c->server_fd != -1 ) {
-				if( sizeof(c->serverbuffer) > c->servercount && FDQUEUE_MAX_FD > c->serverfdq.nfd )
+				if( (wants & SERVER_READ) != 0 )
 					FD_SET(c->server_fd,&readfds);
+				if( (wants & SERVER_WRITE) != 0 )
+					FD_SET(c->server_fd,&writefds);
 				FD_SET(c->server_fd,&exceptfds);
 				if( c->server_fd >= n )
 					n = c->server_fd+1;
-				if( (c->clientignore > 0 && c->clientcount > 0 || c->clientfdq.nfd > 0)
-						&& allowsent > 0)
-					FD_SET(c->server_fd,&writefds);
-
-			}
-			if( c->client_fd == -1 && c->server_fd == -1 ) {
-				if( c == connections ) {
-					int i;
-					for ( i = 0; i < c->clientfdq.nfd; i++ )
-						close(c->clientfdq.fd[i]);
-					for ( i = 0; i < c->serverfdq.nfd; i++ )
-						close(c->serverfdq.fd[i]);
-					free_usedextensions(c->usedextensions);
-					free_unknownextensions(c->unknownextensions);
-					free_unknownextensions(c->waiting);
-					free(c->from);
-					connections = c->next;
-					free(c);
-					c = connections;
-					if( connections == NULL &&
-				            stopwhennone && child_pid == 0 )
-						return EXIT_SUCCESS;
-					continue;
-				}
 			}
-			c = c->next;
 		}
 		if( interactive ) {
 			FD_SET(0,&readfds);
 		}
 
 		if( child_pid != 0 && (r == -1 || caught_child_signal) ) {
-			caught_child_signal = false;
-			if( waitpid(child_pid,&status,WNOHANG) == child_pid ) {
-				child_pid = 0;
-				if( connections == NULL && !waitforclient ) {
-					/* TODO: instead wait a bit before
-					 * terminating? */
-					if( WIFEXITED(status) )
-						return WEXITSTATUS(status);
-					else
-						return WTERMSIG(status) + 128;
-				}
-			}
+			if( reap_child(&exitcode) )
+				return exitcode;
 		}
+		if( stats_requested )
+			report_stats();
+		if( capturefile != NULL )
+			capture_flush();
 		r = select(n,&readfds,&writefds,&exceptfds,NULL);
 		if( r == -1 ) {
 			int e = errno;
@@ -288,165 +679,28 @@ static int mainqueue(int listener) {
 			}
 			continue;
 		}
+		if( interactive && FD_ISSET(0,&readfds) )
+			(void)read_confirmation();
 		for( c = connections ; c != NULL ; c = c->next ) {
-			if( interactive && FD_ISSET(0,&readfds) ) {
-				char buffer[201];
-				ssize_t isread;
-				isread = read(0,buffer,200);
-				if( isread == 0 )
-					exit(EXIT_SUCCESS);
-				if( isread > 0 ) {
-					buffer[isread]='\0';
-					int number = atoi(buffer);
-					if( number <= 0 )
-						number = 1;
-					allowsent += number;
-				}
-			}
+			unsigned int ready = 0;
+
 			if( c->client_fd != -1 ) {
-				if( FD_ISSET(c->client_fd,&exceptfds) ) {
-					close(c->client_fd);
-					c->client_fd = -1;
-					fprintf(stdout,"%03d: exception in communication with client\n",c->id);
-					continue;
-				}
-				if( FD_ISSET(c->client_fd,&writefds) ) {
-					size_t towrite = c->servercount;
-					ssize_t written;
-
-					if( c->serverignore < towrite )
-						towrite = c->serverignore;
-					written = dowrite(c->client_fd,c->serverbuffer,towrite,&c->serverfdq);
-					if( written >= 0 ) {
-						if( readwritedebug )
-							fprintf(stdout,"%03d:>:wrote %u bytes\n",c->id,(unsigned int)written);
-						if( (size_t)written < c->servercount )
-							memmove(c->serverbuffer,c->serverbuffer+written,c->servercount-written);
-						c->servercount -= written;
-						c->serverignore -= written;
-						if( c->servercount == 0 ) {
-							if( c->server_fd == -1 ) {
-								close(c->client_fd);
-								c->client_fd = -1;
-								if( readwritedebug )
-									fprintf(stdout,"%03d:>:send EOF\n",c->id);
-								continue;
-							}
-						} else if( c->serverignore == 0 ) {
-							parse_server(c);
-						}
-					} else {
-						int e = errno;
-						close(c->client_fd);
-						c->client_fd = -1;
-						if( readwritedebug )
-							fprintf(stdout,"%03d: error writing to client: %d=%s\n",c->id,e,strerror(e));
-						continue;
-					}
-				}
-				if( FD_ISSET(c->client_fd,&readfds) ) {
-					size_t toread = sizeof(c->clientbuffer)-c->clientcount;
-					ssize_t wasread = doread(c->client_fd,c->clientbuffer+c->clientcount,toread,&c->clientfdq);
-					assert( toread > 0 );
-					if( wasread > 0 ) {
-						if( readwritedebug )
-							fprintf(stdout,"%03d:<:received %u bytes\n",c->id,(unsigned int)wasread);
-						c->clientcount += wasread;
-					} else {
-						if( readwritedebug )
-							fprintf(stdout,"%03d:<:got EOF\n",c->id);
-						close(c->client_fd);
-						c->client_fd = -1;
-						continue;
-					}
-					if( c->clientignore == 0 && c->clientcount > 0) {
-						parse_client(c);
-					}
-				}
-			} else if( c->servercount > 0 && c->serverignore > 0 ) {
-				unsigned int min;
-				/* discard additional events */
-				min = c->servercount;
-				if( min > c->serverignore )
-					min = c->serverignore;
-				fprintf(stdout,"%03d:s->?: discarded last answer of %u bytes\n",c->id,min);
-				if( min < c->servercount )
-					memmove(c->serverbuffer,c->serverbuffer+min,c->servercount-min);
-				c->servercount -= min;
-				c->serverignore -= min;
-				if( c->serverignore == 0 && c->servercount > 0 ) {
-					parse_server(c);
-				}
+				if( FD_ISSET(c->client_fd,&readfds) )
+					ready |= CLIENT_READ;
+				if( FD_ISSET(c->client_fd,&writefds) )
+					ready |= CLIENT_WRITE;
+				if( FD_ISSET(c->client_fd,&exceptfds) )
+					ready |= CLIENT_EXCEPT;
 			}
 			if( c->server_fd != -1 ) {
-				if( FD_ISSET(c->server_fd,&exceptfds) ) {
-					close(c->server_fd);
-					c->server_fd = -1;
-					fprintf(stdout,"%03d: exception in communication with server\n",c->id);
-					continue;
-				}
-				if( FD_ISSET(c->server_fd,&writefds) ) {
-					size_t towrite = c->clientcount;
-					ssize_t written;
-
-					if( c->clientignore < towrite )
-						towrite = c->clientignore;
-					written = dowrite(c->server_fd,c->clientbuffer,towrite,&c->clientfdq);
-					if( interactive && allowsent > 0 )
-						allowsent--;
-					if( written >= 0 ) {
-						if( readwritedebug )
-							fprintf(stdout,"%03d:<:wrote %u bytes\n",c->id,(unsigned int)written);
-						if( (size_t)written < c->clientcount )
-							memmove(c->clientbuffer,c->clientbuffer+written,c->clientcount-written);
-						c->clientcount -= written;
-						c->clientignore -= written;
-						if( c->clientcount != 0 &&
-						    c->clientignore == 0 ) {
-							parse_client(c);
-						}
-					} else {
-						int e = errno;
-						close(c->server_fd);
-						c->server_fd = -1;
-						if( readwritedebug )
-							fprintf(stdout,"%03d: error writing to server: %d=%s\n",c->id,e,strerror(e));
-						continue;
-					}
-				}
-				if( FD_ISSET(c->server_fd,&readfds) ) {
-					size_t toread = sizeof(c->serverbuffer)-c->servercount;
-					ssize_t wasread = doread(c->server_fd,c->serverbuffer+c->servercount,toread,&c->serverfdq);
-					assert( toread > 0 );
-					if( wasread > 0 ) {
-						if( readwritedebug )
-							fprintf(stdout,"%03d:>:received %u bytes\n",c->id,(unsigned int)wasread);
-						c->servercount += wasread;
-					} else {
-						if( readwritedebug )
-							fprintf(stdout,"%03d:>:got EOF\n",c->id);
-						close(c->server_fd);
-						c->server_fd = -1;
-					}
-					if( c->serverignore == 0 && c->servercount > 0 ) {
-						parse_server(c);
-					}
-				}
-			} else if( c->clientcount > 0 && c->clientignore > 0 ) {
-				unsigned int min;
-				/* discard additional events */
-				min = c->clientcount;
-				if( min > c->clientignore )
-					min = c->clientignore;
-				fprintf(stdout,"%03d:<: discarding last request of %u bytes\n",c->id,min);
-				if( min < c->clientcount )
-					memmove(c->clientbuffer,c->clientbuffer+min,c->clientcount-min);
-				c->clientcount -= min;
-				c->clientignore -= min;
-				if( c->clientignore == 0 && c->clientcount > 0 ) {
-					parse_client(c);
-				}
+				if( FD_ISSET(c->server_fd,&readfds) )
+					ready |= SERVER_READ;
+				if( FD_ISSET(c->server_fd,&writefds) )
+					ready |= SERVER_WRITE;
+				if( FD_ISSET(c->server_fd,&exceptfds) )
+					ready |= SERVER_EXCEPT;
 			}
+			handle_connection(c, &ready);
 		}
 		if( FD_ISSET(listener,&readfds) ) {
 			acceptConnection(listener);
@@ -456,6 +710,162 @@ static int mainqueue(int listener) {
 	return EXIT_SUCCESS;
 }
 
+#if HAVE_EPOLL
+/* Edge triggered: every socket is registered once for everything,
+ * what it was reported ready for is remembered in c->ready until a
+ * read or write comes back short. Only connections where something
+ * changed are looked at, so a wakeup costs nothing for idle ones. */
+
+#define EPOLL_SERVER_SIDE 1
+#define EPOLL_EVENTS (EPOLLIN|EPOLLOUT|EPOLLPRI|EPOLLRDHUP|EPOLLET)
+
+static int epollfd = -1;
+static struct connection *active_connections = NULL;
+/* only the address of those is used to tell them apart */
+static int epoll_listener_tag, epoll_stdin_tag;
+
+static void mark_active(struct connection *c) {
+	if( c->active )
+		return;
+	c->active = true;
+	c->nextactive = active_connections;
+	active_connections = c;
+}
+
+static bool epoll_add(int fd, uint64_t tag, uint32_t events) {
+	struct epoll_event ev;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = events;
+	ev.data.u64 = tag;
+	if( epoll_ctl(epollfd, EPOLL_CTL_ADD, fd, &ev) != 0 ) {
+		int e = errno;
+		fprintf(stderr, "Error %d adding fd to epoll: %s\n",
+				e, strerror(e));
+		return false;
+	}
+	return true;
+}
+
+static void epoll_add_connection(struct connection *c) {
+	if( !epoll_add(c->client_fd, (uintptr_t)c, EPOLL_EVENTS)
+	    || !epoll_add(c->server_fd, (uintptr_t)c|EPOLL_SERVER_SIDE,
+		    EPOLL_EVENTS) ) {
+		/* it will be never woken up otherwise */
+		close(c->client_fd);
+		c->client_fd = -1;
+		close(c->server_fd);
+		c->server_fd = -1;
+	}
+	mark_active(c);
+}
+
+static unsigned int epoll_to_ready(uint32_t events, bool server) {
+	unsigned int ready = 0;
+
+	if( (events & (EPOLLIN|EPOLLRDHUP|EPOLLHUP|EPOLLERR)) != 0 )
+		ready |= CLIENT_READ;
+	if( (events & (EPOLLOUT|EPOLLHUP|EPOLLERR)) != 0 )
+		ready |= CLIENT_WRITE;
+	if( (events & EPOLLPRI) != 0 )
+		ready |= CLIENT_EXCEPT;
+	return server ? ready << 4 : ready;
+}
+
+static int mainqueue_epoll(int listener) {
+	struct epoll_event events[64];
+	struct connection *c, *todo;
+	int i, r = 0, exitcode;
+	bool newclient;
+
+	if( !epoll_add(listener, (uintptr_t)&epoll_listener_tag, EPOLLIN) )
+		return EXIT_FAILURE;
+	if( interactive &&
+	    !epoll_add(0, (uintptr_t)&epoll_stdin_tag, EPOLLIN) )
+		return EXIT_FAILURE;
+
+	while( 1 ) {
+		if( child_pid != 0 && (r == -1 || caught_child_signal) ) {
+			if( reap_child(&exitcode) )
+				return exitcode;
+		}
+		if( stats_requested )
+			report_stats();
+		if( capturefile != NULL && active_connections == NULL )
+			capture_flush();
+		/* only wait if there is nothing left to do */
+		r = epoll_wait(epollfd, events, 64,
+				(active_connections != NULL)?0:-1);
+		if( r == -1 ) {
+			int e = errno;
+
+			if( e != 0 && e != EINTR ) {
+				fprintf(stderr,"Error %d in epoll_wait: %s\n",
+						e, strerror(e));
+			}
+			continue;
+		}
+		newclient = false;
+		for( i = 0 ; i < r ; i++ ) {
+			uintptr_t tag = events[i].data.u64;
+
+			if( tag == (uintptr_t)&epoll_listener_tag ) {
+				newclient = true;
+			} else if( tag == (uintptr_t)&epoll_stdin_tag ) {
+				if( !read_confirmation() )
+					continue;
+				/* requests might have been held back */
+				for( c = connections ; c != NULL ; c = c->next )
+					mark_active(c);
+			} else {
+				bool server = (tag & EPOLL_SERVER_SIDE) != 0;
+
+				c = (struct connection *)(tag & ~(uintptr_t)EPOLL_SERVER_SIDE);
+				c->ready |= epoll_to_ready(events[i].events, server);
+				mark_active(c);
+			}
+		}
+		todo = active_connections;
+		active_connections = NULL;
+		while( todo != NULL ) {
+			c = todo;
+			todo = c->nextactive;
+			c->active = false;
+			if( !connection_finished(c) )
+				handle_connection(c, &c->ready);
+			if( connection_finished(c) ) {
+				if( remove_connection(c) )
+					return EXIT_SUCCESS;
+			} else if( (c->ready & connection_wants(c)) != 0
+					|| connection_has_leftovers(c) ) {
+				mark_active(c);
+			}
+		}
+		if( newclient ) {
+			c = connections;
+			acceptConnection(listener);
+			if( connections != c )
+				epoll_add_connection(connections);
+		}
+	}
+	return EXIT_SUCCESS;
+}
+#endif
+
+static int mainqueue(int listener) {
+#if HAVE_EPOLL
+	epollfd = epoll_create1(EPOLL_CLOEXEC);
+	if( epollfd >= 0 ) {
+		int r = mainqueue_epoll(listener);
+		close(epollfd);
+		epollfd = -1;
+		return r;
+	}
+	/* might be an old kernel, so try the old way */
+#endif
+	return mainqueue_select(listener);
+}
+
 static void startClient(char *argv[]) {
 	child_pid = fork();
 	if( child_pid == -1 ) {
@@ -486,7 +896,7 @@ char *strndup(const char *str,size_t n) {
 }
 #endif
 
-enum {LO_DEFAULT=0, LO_TIMESTAMPS, LO_RELTIMESTAMPS, LO_UPTIMESTAMPS, LO_VERSION, LO_HELP, LO_PRINTCOUNTS, LO_PRINTOFFSETS};
+enum {LO_DEFAULT=0, LO_TIMESTAMPS, LO_RELTIMESTAMPS, LO_UPTIMESTAMPS, LO_VERSION, LO_HELP, LO_PRINTCOUNTS, LO_PRINTOFFSETS, LO_MAXBUFFERSIZE, LO_CHECKSUMSTREAMED, LO_DECOUPLED, LO_CAPTURE, LO_REPLAY, LO_JOBS, LO_ASYNCOUTPUT, LO_FILTER, LO_STATS, LO_TABLECACHE, LO_NOTABLECACHE};
 static int long_only_option = 0;
 static const struct option longoptions[] = {
 	{"display",	required_argument,	NULL,	'd'},
@@ -511,6 +921,17 @@ static const struct option longoptions[] = {
 	{"monotonic-timestamps",no_argument, &long_only_option,	LO_UPTIMESTAMPS},
 	{"print-counts",	no_argument, &long_only_option,	LO_PRINTCOUNTS},
 	{"print-offsets",	no_argument, &long_only_option,	LO_PRINTOFFSETS},
+	{"max-buffer-size",	required_argument, &long_only_option,	LO_MAXBUFFERSIZE},
+	{"checksum-streamed",	no_argument, &long_only_option,	LO_CHECKSUMSTREAMED},
+	{"decoupled",		no_argument, &long_only_option,	LO_DECOUPLED},
+	{"capture",		required_argument, &long_only_option,	LO_CAPTURE},
+	{"replay",		required_argument, &long_only_option,	LO_REPLAY},
+	{"jobs",		required_argument, &long_only_option,	LO_JOBS},
+	{"async-output",	required_argument, &long_only_option,	LO_ASYNCOUTPUT},
+	{"filter",		required_argument, &long_only_option,	LO_FILTER},
+	{"stats",		no_argument, &long_only_option,	LO_STATS},
+	{"table-cache",		required_argument, &long_only_option,	LO_TABLECACHE},
+	{"no-table-cache",	no_argument, &long_only_option,	LO_NOTABLECACHE},
 	{NULL,		0,			NULL,	0}
 };
 
@@ -519,6 +940,11 @@ static void catchsig(int signum UNUSED)
   caught_child_signal = true;
 }
 
+static void catchstatssig(int signum UNUSED)
+{
+  stats_requested = true;
+}
+
 extern bool print_counts;
 extern bool print_offsets;
 
@@ -528,8 +954,14 @@ int main(int argc, char *argv[]) {
 	int c;
 	const char *out_authfile=NULL, *in_authfile = NULL;
 	struct parser *parser;
+	bool searchpath_given = false;
+	bool usetablecache = true;
+	const char *tablecachedir = NULL;
+	unsigned long long number;
+	char *numberend;
 
 	stringlist_init();
+	hexlist_init();
 	parser = parser_init();
 	if( parser == NULL )
 		return EXIT_FAILURE;
@@ -539,6 +971,7 @@ int main(int argc, char *argv[]) {
 		switch( c ) {
 		 case 'I':
 			 add_searchpath(parser, optarg);
+			 searchpath_given = true;
 			 break;
 		 case 'd':
 			 out_displayname = optarg;
@@ -616,7 +1049,22 @@ int main(int argc, char *argv[]) {
 "--readwritedebug, -w		Print amounts of data read/sent\n"
 "--maxlistlength, -m <maximum number of entries in each list shown>\n"
 "--outfile, -o <filename>	Output to file instead of stdout\n"
-"--buffered, -b			Do not output every line but only when buffer is full\n",
+"--buffered, -b			Do not output every line but only when buffer is full\n"
+"--max-buffer-size <bytes>	Largest message decoded completely (default 16MiB)\n"
+"--checksum-streamed		Print a checksum of messages bigger than that\n"
+"--decoupled			Send data on at once and decode it in the background\n"
+"--capture <filename>		Do not decode but save everything into that file\n"
+"--replay <filename>		Decode a file written by --capture\n"
+"--jobs <number>			Decode that many connections in parallel with --replay\n"
+"--async-output <block|drop|summary>\n"
+"				Write output in a separate thread, if it cannot\n"
+"				keep up wait, drop or shorten lines\n"
+"--filter [-][request:|reply:|event:|error:]<name>,...\n"
+"				Only show (or with - do not show) these messages\n"
+"--stats			Count messages by type, print a summary at exit\n"
+"				(or on SIGUSR1)\n"
+"--table-cache <directory>	Where to keep the parsed .proto files\n"
+"--no-table-cache		Always parse the .proto files\n",
 argv[0]);
 					 exit(EXIT_SUCCESS);
 				 case LO_VERSION:
@@ -646,6 +1094,80 @@ argv[0]);
 				case LO_PRINTOFFSETS:
 					 print_offsets = true;
 					 break;
+				case LO_MAXBUFFERSIZE:
+					 /* (message lengths are kept in unsigned int) */
+					 number = strtoull(optarg, &numberend, 0);
+					 if( numberend == optarg || *numberend != '\0'
+					     || strchr(optarg, '-') != NULL
+					     || number < INITIAL_BUFFER_SIZE
+					     || number > UINT_MAX ) {
+						 fprintf(stderr, "--max-buffer-size must be a number from %u to %u\n", (unsigned int)INITIAL_BUFFER_SIZE, UINT_MAX);
+						 exit(EXIT_FAILURE);
+					 }
+					 maxbuffersize = number;
+					 break;
+				case LO_CHECKSUMSTREAMED:
+					 checksum_streamed = true;
+					 break;
+				case LO_DECOUPLED:
+#ifndef HAVE_PTHREAD
+					 fprintf(stderr, "--decoupled not supported as there was no thread support at compile time\n");
+					 exit(EXIT_FAILURE);
+#else
+					 decoupled = true;
+#endif
+					 break;
+				case LO_CAPTURE:
+					 capturefile = optarg;
+					 break;
+				case LO_REPLAY:
+					 replayfile = optarg;
+					 break;
+				case LO_JOBS:
+					 jobs = strtol(optarg,NULL,0);
+					 if( jobs < 1 || jobs > 1024 ) {
+						 fprintf(stderr, "--jobs must be between 1 and 1024\n");
+						 exit(EXIT_FAILURE);
+					 }
+#ifndef HAVE_PTHREAD
+					 if( jobs > 1 ) {
+						 fprintf(stderr, "--jobs not supported as there was no thread support at compile time\n");
+						 exit(EXIT_FAILURE);
+					 }
+#endif
+					 break;
+				case LO_ASYNCOUTPUT:
+#ifndef HAVE_PTHREAD
+					 fprintf(stderr, "--async-output not supported as there was no thread support at compile time\n");
+					 exit(EXIT_FAILURE);
+#else
+					 if( strcmp(optarg, "block") == 0 )
+						 outputpolicy = op_BLOCK;
+					 else if( strcmp(optarg, "drop") == 0 )
+						 outputpolicy = op_DROP;
+					 else if( strcmp(optarg, "summary") == 0 )
+						 outputpolicy = op_SUMMARY;
+					 else {
+						 fprintf(stderr, "--async-output must be 'block', 'drop' or 'summary'\n");
+						 exit(EXIT_FAILURE);
+					 }
+					 asyncoutput = true;
+#endif
+					 break;
+				case LO_FILTER:
+					 if( !filter_add(optarg) )
+						 exit(EXIT_FAILURE);
+					 break;
+				case LO_STATS:
+					 stats_enabled = true;
+					 break;
+				case LO_TABLECACHE:
+					 tablecachedir = optarg;
+					 usetablecache = true;
+					 break;
+				case LO_NOTABLECACHE:
+					 usetablecache = false;
+					 break;
 			 }
 			 break;
 		 case ':':
@@ -655,11 +1177,66 @@ argv[0]);
 		}
 
 	}
-	add_searchpath(parser, PKGDATADIR);
-	translate(parser, "all.proto");
-	finalize_everything(parser);
-	if( !parser_free(parser) ) {
-		return EXIT_FAILURE;
+	if( decoupled && (interactive || denyallextensions) ) {
+		fprintf(stderr, "--decoupled cannot be combined with --interactive or --denyextensions\n");
+		exit(EXIT_FAILURE);
+	}
+	if( capturefile != NULL && (decoupled || interactive || denyallextensions) ) {
+		fprintf(stderr, "--capture cannot be combined with --decoupled, --interactive or --denyextensions\n");
+		exit(EXIT_FAILURE);
+	}
+	if( asyncoutput && (decoupled || replayfile != NULL) ) {
+		fprintf(stderr, "--async-output cannot be combined with --decoupled or --replay\n");
+		exit(EXIT_FAILURE);
+	}
+	if( jobs > 1 && replayfile == NULL ) {
+		fprintf(stderr, "--jobs is only supported with --replay\n");
+		exit(EXIT_FAILURE);
+	}
+	/* only the summary unless asked for more */
+	if( stats_enabled && !filter_active && !filter_add("-*") )
+		exit(EXIT_FAILURE);
+	if( stats_enabled )
+		signal(SIGUSR1, catchstatssig);
+#ifdef HAVE_BUILTIN_TABLES
+	/* only read the .proto files if asked to look somewhere else */
+	if( !searchpath_given ) {
+		(void)parser_free(parser);
+		if( !use_builtin_tables() )
+			return EXIT_FAILURE;
+	} else
+#else
+	(void)searchpath_given;
+#endif
+	{
+		add_searchpath(parser, PKGDATADIR);
+		if( usetablecache && tablecache_load(parser, tablecachedir) )
+			(void)parser_free(parser);
+		else {
+			translate(parser, "all.proto");
+			finalize_everything(parser);
+			if( !parser_free(parser) ) {
+				return EXIT_FAILURE;
+			}
+			if( usetablecache )
+				tablecache_store();
+		}
+	}
+	if( replayfile != NULL ) {
+		if( capturefile != NULL || decoupled || interactive ) {
+			fprintf(stderr, "--replay cannot be combined with --capture, --decoupled or --interactive\n");
+			exit(EXIT_FAILURE);
+		}
+		r = replay_capture(replayfile, jobs);
+		if( stats_enabled )
+			stats_report_print(stats_report_begin());
+		if( out != stdout && fclose(out) != 0 ) {
+			fprintf(stderr, "Error writing to output file!\n");
+			r = EXIT_FAILURE;
+		} else if( out == stdout && fflush(stdout) != 0 )
+			r = EXIT_FAILURE;
+		stringlist_done();
+		return r;
 	}
 
 	signal(SIGPIPE,SIG_IGN);
@@ -695,16 +1272,47 @@ argv[0]);
 			return -1;
 	}
 	setvbuf(out, NULL, buffered?_IOFBF:_IOLBF, BUFSIZ);
+	/* complete lines can be written directly */
+	output_direct = !buffered;
 	listener = listenForClients(in_displayname,in_family,in_display);
 	if( listener < 0 ) {
 		exit(EXIT_FAILURE);
 	}
+#ifdef HAVE_PTHREAD
+	if( decoupled && !decoder_start() )
+		exit(EXIT_FAILURE);
+#endif
+	if( capturefile != NULL && !capture_open(capturefile) )
+		exit(EXIT_FAILURE);
+#ifdef HAVE_PTHREAD
+	if( asyncoutput && !output_start(outputpolicy) )
+		exit(EXIT_FAILURE);
+#endif
 	if( optind < argc && strcmp(argv[optind],"--") != 0 ) {
 		signal(SIGCHLD, catchsig);
 		startClient(argv + optind);
 	}
 	r = mainqueue(listener);
+#ifdef HAVE_PTHREAD
+	if( decoupled )
+		decoder_stop();
+#endif
+	if( !capture_done() && r == EXIT_SUCCESS )
+		r = EXIT_FAILURE;
+	if( stats_enabled ) {
+		struct connection *rest;
+
+		for( rest = connections ; rest != NULL ; rest = rest->next )
+			stats_connection_done(rest);
+		stats_report_print(stats_report_begin());
+	}
+#ifdef HAVE_PTHREAD
+	if( asyncoutput )
+		output_stop();
+#endif
 	close(listener);
+	if( output_failed )
+		r = EXIT_FAILURE;
 	if( out != stdout ) {
 		if( fclose(out) != 0 ) {
 			fprintf(stderr, "Error writing to output file!\n");
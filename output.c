@@ -0,0 +1,400 @@
+/*  This file is part of "xtrace"
+ *  Copyright (C) 2026 Bernhard R. Link
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <config.h>
+
+#include <errno.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/types.h>
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#include <signal.h>
+#endif
+
+#include "xtrace.h"
+#include "output.h"
+
+/* buffers bigger than that are given back after being flushed */
+#define OUTBUF_KEEP (64*1024)
+
+bool output_direct = false;
+/* also set by the writer thread, so only accessed atomically */
+bool output_failed = false;
+
+#ifdef HAVE_PTHREAD
+
+/* With --async-output complete lines are copied into a queue and
+ * written by a thread of their own, so that a slow output (a pipe
+ * into a pager, a slow disk) does not stop the main loop. There is
+ * only one producer (the main loop, --decoupled is not supported) and
+ * one consumer, so the queue itself needs no lock. The mutex is only
+ * used to sleep when there is nothing to do (or no room with op_BLOCK).
+ */
+
+#define OUTQUEUE_SIZE (4*1024*1024)
+#define OUTQUEUE_MASK (OUTQUEUE_SIZE-1)
+/* with op_SUMMARY lines are shortened to that ... */
+#define SUMMARY_LENGTH 120
+/* ... once the queue is that full */
+#define SUMMARY_THRESHOLD (OUTQUEUE_SIZE/4*3)
+
+static unsigned char *outqueue = NULL;
+/* written by the main loop only */
+static size_t outqueue_tail;
+/* written by the writer thread only */
+static size_t outqueue_head;
+static enum output_policy outqueue_policy;
+static int writer_fd;
+static pthread_t writer_thread;
+static pthread_mutex_t writer_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t writer_wakeup = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t writer_progress = PTHREAD_COND_INITIALIZER;
+static bool writer_stopping = false;
+static bool writer_sleeping = false;
+static bool producer_waiting = false;
+/* only used by the main loop */
+static unsigned long long dropped_lines = 0, dropped_bytes = 0;
+static unsigned long long shortened_lines = 0;
+/* dropped since the last line that was queued */
+static unsigned long long dropped_unreported = 0;
+
+static inline size_t outqueue_used(void) {
+	return outqueue_tail - __atomic_load_n(&outqueue_head, __ATOMIC_ACQUIRE);
+}
+
+static void outqueue_write(const char *p, size_t len) {
+	size_t ofs = outqueue_tail & OUTQUEUE_MASK, first = OUTQUEUE_SIZE - ofs;
+
+	if( len <= first )
+		memcpy(outqueue + ofs, p, len);
+	else {
+		memcpy(outqueue + ofs, p, first);
+		memcpy(outqueue, p + first, len - first);
+	}
+	outqueue_tail += len;
+}
+
+static void outqueue_publish(void) {
+	if( __atomic_load_n(&writer_sleeping, __ATOMIC_SEQ_CST) ) {
+		pthread_mutex_lock(&writer_mutex);
+		pthread_cond_signal(&writer_wakeup);
+		pthread_mutex_unlock(&writer_mutex);
+	}
+}
+
+/* wait till the writer made some room */
+static size_t outqueue_wait(void) {
+	size_t room;
+
+	while( (room = OUTQUEUE_SIZE - outqueue_used()) == 0 ) {
+		pthread_mutex_lock(&writer_mutex);
+		__atomic_store_n(&producer_waiting, true, __ATOMIC_SEQ_CST);
+		if( OUTQUEUE_SIZE == outqueue_used() )
+			pthread_cond_wait(&writer_progress, &writer_mutex);
+		__atomic_store_n(&producer_waiting, false, __ATOMIC_SEQ_CST);
+		pthread_mutex_unlock(&writer_mutex);
+	}
+	return room;
+}
+
+static void outqueue_put(const char *p, size_t len) {
+	size_t used = outqueue_used(), room = OUTQUEUE_SIZE - used;
+	char note[80];
+	size_t notelen = 0;
+
+	if( outqueue_policy == op_BLOCK ) {
+		while( len > 0 ) {
+			size_t n = outqueue_wait();
+
+			if( n > len )
+				n = len;
+			outqueue_write(p, n);
+			__atomic_store_n(&outqueue_tail, outqueue_tail, __ATOMIC_SEQ_CST);
+			outqueue_publish();
+			p += n;
+			len -= n;
+		}
+		return;
+	}
+	if( dropped_unreported > 0 )
+		notelen = snprintf(note, sizeof(note),
+				"(%llu lines dropped)\n", dropped_unreported);
+	if( outqueue_policy == op_SUMMARY && len > SUMMARY_LENGTH
+			&& (used + len > SUMMARY_THRESHOLD || notelen + len > room)
+			&& notelen + SUMMARY_LENGTH + 5 <= room ) {
+		outqueue_write(note, notelen);
+		outqueue_write(p, SUMMARY_LENGTH);
+		outqueue_write(" ...\n", 5);
+		shortened_lines++;
+	} else if( notelen + len <= room ) {
+		outqueue_write(note, notelen);
+		outqueue_write(p, len);
+	} else {
+		dropped_lines++;
+		dropped_bytes += len;
+		dropped_unreported++;
+		return;
+	}
+	dropped_unreported = 0;
+	__atomic_store_n(&outqueue_tail, outqueue_tail, __ATOMIC_SEQ_CST);
+	outqueue_publish();
+}
+
+static void *writer_main(void *dummy UNUSED) {
+	size_t head = outqueue_head, tail, ofs, n;
+	ssize_t written;
+
+	while( true ) {
+		tail = __atomic_load_n(&outqueue_tail, __ATOMIC_ACQUIRE);
+		if( head != tail ) {
+			ofs = head & OUTQUEUE_MASK;
+			n = tail - head;
+			if( n > OUTQUEUE_SIZE - ofs )
+				n = OUTQUEUE_SIZE - ofs;
+			if( __atomic_load_n(&output_failed, __ATOMIC_ACQUIRE) )
+				written = n;
+			else
+				written = write(writer_fd, outqueue + ofs, n);
+			if( written < 0 ) {
+				int e = errno;
+
+				if( e == EINTR || e == EAGAIN )
+					continue;
+				fprintf(stderr, "Error %d writing output: %s\n",
+						e, strerror(e));
+				__atomic_store_n(&output_failed, true, __ATOMIC_SEQ_CST);
+				continue;
+			}
+			head += written;
+			__atomic_store_n(&outqueue_head, head, __ATOMIC_SEQ_CST);
+			if( __atomic_load_n(&producer_waiting, __ATOMIC_SEQ_CST) ) {
+				pthread_mutex_lock(&writer_mutex);
+				pthread_cond_signal(&writer_progress);
+				pthread_mutex_unlock(&writer_mutex);
+			}
+			continue;
+		}
+		pthread_mutex_lock(&writer_mutex);
+		if( writer_stopping ) {
+			pthread_mutex_unlock(&writer_mutex);
+			break;
+		}
+		__atomic_store_n(&writer_sleeping, true, __ATOMIC_SEQ_CST);
+		if( __atomic_load_n(&outqueue_tail, __ATOMIC_SEQ_CST) == head )
+			pthread_cond_wait(&writer_wakeup, &writer_mutex);
+		__atomic_store_n(&writer_sleeping, false, __ATOMIC_SEQ_CST);
+		pthread_mutex_unlock(&writer_mutex);
+	}
+	return NULL;
+}
+
+bool output_start(enum output_policy policy) {
+	sigset_t all, old;
+	int r;
+
+	fflush(out);
+	writer_fd = fileno(out);
+	if( writer_fd < 0 ) {
+		fputs("--async-output needs a real output file!\n", stderr);
+		return false;
+	}
+	outqueue = malloc(OUTQUEUE_SIZE);
+	if( outqueue == NULL ) {
+		fputs("Out of memory!\n", stderr);
+		return false;
+	}
+	outqueue_policy = policy;
+	/* signals are for the main loop */
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &old);
+	r = pthread_create(&writer_thread, NULL, writer_main, NULL);
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+	if( r != 0 ) {
+		fprintf(stderr, "Error starting output thread: %s\n",
+				strerror(r));
+		free(outqueue);
+		outqueue = NULL;
+		return false;
+	}
+	return true;
+}
+
+/* write everything still queued and wait for the writer to finish */
+void output_stop(void) {
+	if( outqueue == NULL )
+		return;
+	if( dropped_unreported > 0 ) {
+		char note[80];
+		int notelen = snprintf(note, sizeof(note),
+				"(%llu lines dropped)\n", dropped_unreported);
+
+		outqueue_policy = op_BLOCK;
+		outqueue_put(note, notelen);
+	}
+	pthread_mutex_lock(&writer_mutex);
+	writer_stopping = true;
+	pthread_cond_signal(&writer_wakeup);
+	pthread_mutex_unlock(&writer_mutex);
+	pthread_join(writer_thread, NULL);
+	free(outqueue);
+	outqueue = NULL;
+	if( dropped_lines > 0 )
+		fprintf(stderr, "Output could not keep up, dropped %llu lines (%llu bytes)\n",
+				dropped_lines, dropped_bytes);
+	if( shortened_lines > 0 )
+		fprintf(stderr, "Output could not keep up, shortened %llu lines\n",
+				shortened_lines);
+}
+#endif
+
+void out_grow(struct outbuf *o, size_t len) {
+	size_t size = (o->size == 0)?1024:o->size;
+	char *n;
+
+	while( size - o->used < len ) {
+		if( size > SIZE_MAX / 2 ) {
+			fputs("Out of memory!\n", stderr);
+			abort();
+		}
+		size *= 2;
+	}
+	n = realloc(o->data, size);
+	if( n == NULL ) {
+		fputs("Out of memory!\n", stderr);
+		abort();
+	}
+	o->data = n;
+	o->size = size;
+}
+
+/* With --async-output this is queued for the writer thread. Otherwise
+ * with line buffered output each line is written with a single write,
+ * else (or if out is no real file) it is given to stdio. */
+void out_flush(struct outbuf *o) {
+	const char *p = o->data;
+	size_t len = o->used;
+	int fd = output_direct?fileno(out):-1;
+
+	if( len == 0 )
+		return;
+	o->used = 0;
+#ifdef HAVE_PTHREAD
+	if( outqueue != NULL )
+		outqueue_put(p, len);
+	else
+#endif
+	if( fd < 0 ) {
+		fwrite(p, 1, len, out);
+	} else {
+		/* whatever was written with stdio comes first */
+		fflush(out);
+		while( len > 0 && !__atomic_load_n(&output_failed, __ATOMIC_ACQUIRE) ) {
+			ssize_t written = write(fd, p, len);
+
+			if( written < 0 ) {
+				int e = errno;
+
+				if( e == EINTR || e == EAGAIN )
+					continue;
+				fprintf(stderr, "Error %d writing output: %s\n",
+						e, strerror(e));
+				__atomic_store_n(&output_failed, true, __ATOMIC_SEQ_CST);
+				break;
+			}
+			p += written;
+			len -= written;
+		}
+	}
+	if( o->size > OUTBUF_KEEP ) {
+		free(o->data);
+		o->data = NULL;
+		o->size = 0;
+	}
+}
+
+void out_done(struct outbuf *o) {
+	out_flush(o);
+	free(o->data);
+	o->data = NULL;
+	o->size = 0;
+}
+
+void out_vprintf(struct outbuf *o, const char *format, va_list ap) {
+	va_list aq;
+	int len;
+
+	out_reserve(o, 128);
+	va_copy(aq, ap);
+	len = vsnprintf(o->data + o->used, o->size - o->used, format, aq);
+	va_end(aq);
+	if( len < 0 )
+		return;
+	if( (size_t)len >= o->size - o->used ) {
+		out_reserve(o, len + 1);
+		vsnprintf(o->data + o->used, o->size - o->used, format, ap);
+	}
+	o->used += len;
+}
+
+void out_printf(struct outbuf *o, const char *format, ...) {
+	va_list ap;
+
+	va_start(ap, format);
+	out_vprintf(o, format, ap);
+	va_end(ap);
+}
+
+/* like %.*f, only for floating point values that are really needed */
+void out_double(struct outbuf *o, unsigned int decimals, double d) {
+	out_printf(o, "%.*f", (int)decimals, d);
+}
+
+/* a 16.16 fixed point number with that many decimals
+ * (at most 9), rounded like %.*f would */
+void out_fixed(struct outbuf *o, int32_t v, unsigned int decimals) {
+	static const uint64_t powers[10] = { 1, 10, 100, 1000, 10000,
+		100000, 1000000, 10000000, 100000000, 1000000000 };
+	uint64_t a, frac, scaled, rem, whole;
+
+	if( v < 0 ) {
+		out_char(o, '-');
+		a = -(int64_t)v;
+	} else
+		a = v;
+	whole = a >> 16;
+	frac = a & 0xFFFF;
+	scaled = frac * powers[decimals];
+	rem = scaled & 0xFFFF;
+	scaled >>= 16;
+	/* the exact value is in there, so round half to even */
+	if( rem > 0x8000 || (rem == 0x8000 && (scaled & 1) != 0) )
+		scaled++;
+	if( scaled >= powers[decimals] ) {
+		scaled -= powers[decimals];
+		whole++;
+	}
+	out_uint(o, whole);
+	if( decimals > 0 ) {
+		out_char(o, '.');
+		out_uint_pad(o, scaled, decimals, '0');
+	}
+}
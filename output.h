@@ -0,0 +1,108 @@
+#ifndef XTRACE_OUTPUT_H
+#define XTRACE_OUTPUT_H
+
+/* Lines are put together in a struct outbuf (one per connection,
+ * see xtrace.h) without going through stdio for every field and
+ * written to out only once they are complete (see out_flush). */
+
+/* whether out_flush writes directly to the file descriptor of out */
+extern bool output_direct;
+/* set if writing directly failed */
+extern bool output_failed;
+
+enum output_policy {
+	/* wait till there is room again */
+	op_BLOCK,
+	/* drop lines not fitting (and count them) */
+	op_DROP,
+	/* shorten lines once the queue is mostly full, drop if needed */
+	op_SUMMARY
+};
+
+#ifdef HAVE_PTHREAD
+bool output_start(enum output_policy);
+void output_stop(void);
+#endif
+
+void out_grow(struct outbuf *, size_t);
+void out_flush(struct outbuf *);
+void out_done(struct outbuf *);
+void out_printf(struct outbuf *, const char *format, ...) FORMAT(printf,2,3);
+void out_vprintf(struct outbuf *, const char *format, va_list);
+void out_double(struct outbuf *, unsigned int decimals, double);
+void out_fixed(struct outbuf *, int32_t, unsigned int decimals);
+
+static inline char *out_reserve(struct outbuf *o, size_t len) {
+	if( o->size - o->used < len )
+		out_grow(o, len);
+	return o->data + o->used;
+}
+
+static inline void out_char(struct outbuf *o, char c) {
+	*out_reserve(o, 1) = c;
+	o->used++;
+}
+
+static inline void out_mem(struct outbuf *o, const char *s, size_t len) {
+	memcpy(out_reserve(o, len), s, len);
+	o->used += len;
+}
+
+static inline void out_string(struct outbuf *o, const char *s) {
+	out_mem(o, s, strlen(s));
+}
+
+/* decimal, padded to at least width characters with pad */
+static inline void out_uint_pad(struct outbuf *o, unsigned long long v, unsigned int width, char pad) {
+	char digits[20], *p = digits + sizeof(digits);
+	unsigned int n;
+
+	do {
+		*--p = '0' + v % 10;
+		v /= 10;
+	} while( v != 0 );
+	n = digits + sizeof(digits) - p;
+	while( n < width ) {
+		out_char(o, pad);
+		width--;
+	}
+	out_mem(o, p, n);
+}
+
+static inline void out_uint(struct outbuf *o, unsigned long long v) {
+	out_uint_pad(o, v, 0, ' ');
+}
+
+static inline void out_int(struct outbuf *o, long long v) {
+	if( v < 0 ) {
+		out_char(o, '-');
+		out_uint(o, -(unsigned long long)v);
+	} else
+		out_uint(o, v);
+}
+
+/* lower case hexadecimal with at least digits digits, like %0*llx */
+static inline void out_xdigits(struct outbuf *o, unsigned long long v, unsigned int digits) {
+	static const char hex[16] = "0123456789abcdef";
+	char *p;
+	unsigned int n = 1;
+
+	while( n < 16 && (v >> (4*n)) != 0 )
+		n++;
+	if( n < digits )
+		n = digits;
+	p = out_reserve(o, n);
+	o->used += n;
+	while( n > 0 ) {
+		p[--n] = hex[v & 0xF];
+		v >>= 4;
+	}
+}
+
+/* the same with 0x in front */
+static inline void out_hex(struct outbuf *o, unsigned long long v, unsigned int digits) {
+	out_mem(o, "0x", 2);
+	out_xdigits(o, v, digits);
+}
+
+#endif
@@ -19,6 +19,7 @@
 #include <stdint.h>
 #include <sys/types.h>
 #include <sys/time.h>
+#include <sys/uio.h>
 #include <limits.h>
 #include <stdbool.h>
 #include <stdint.h>
@@ -34,6 +35,10 @@
 
 #include "xtrace.h"
 #include "parse.h"
+#include "output.h"
+#include "filter.h"
+#include "stats.h"
+#include "hexlist.h"
 
 enum package_direction { TO_SERVER, TO_CLIENT };
 
@@ -46,21 +51,38 @@ static inline unsigned int padded(unsigned int s) {
 	return (s+3)&(~3);
 }
 
-static void startline(struct connection *c, enum package_direction d, const char *format, ...) {
-	va_list ap;
+/* the time of what is shown now, when replaying that is when it
+ * was read and not the current time */
+static inline bool wallclock(const struct connection *c, struct timeval *tv) {
+	if( c->walltime == 0 )
+		return gettimeofday(tv, NULL) == 0;
+	tv->tv_sec = c->walltime / 1000000000;
+	tv->tv_usec = (c->walltime % 1000000000) / 1000;
+	return true;
+}
+
+/* seconds.milliseconds and a space */
+static inline void print_time(struct outbuf *o, unsigned long long seconds, unsigned int milliseconds) {
+	out_uint(o, seconds);
+	out_char(o, '.');
+	out_uint_pad(o, milliseconds, 3, '0');
+	out_char(o, ' ');
+}
+
+/* everything in front of what a line is about */
+static void print_prefix(struct connection *c, enum package_direction d) {
+	struct outbuf *o = &c->output;
 	struct timeval tv;
 
 	if( (print_timestamps || print_reltimestamps)
-			&& gettimeofday(&tv, NULL) == 0 ) {
+			&& wallclock(c, &tv) ) {
 		if( print_timestamps )
-			fprintf(out, "%lu.%03u ", (unsigned long)tv.tv_sec,
-					(unsigned int)(tv.tv_usec/1000));
+			print_time(o, tv.tv_sec, tv.tv_usec/1000);
 		if( print_reltimestamps ) {
 			unsigned long long tt = ((unsigned long long)1000)*tv.tv_sec +
 						(tv.tv_usec/1000);
-			fprintf(out, "%lu.%03u ",
-				(unsigned long)((tt - c->starttime)/1000),
-				(unsigned int)((tt - c->starttime)%1000));
+			print_time(o, (tt - c->starttime)/1000,
+					(tt - c->starttime)%1000);
 		}
 	}
 #ifdef HAVE_MONOTONIC_CLOCK
@@ -68,11 +90,14 @@ static void startline(struct connection *c, enum package_direction d, const char
 		static bool already_warned = false;
 		struct timespec ts;
 		int i;
-		i = clock_gettime(CLOCK_MONOTONIC, &ts);
+		if( c->monotonictime != 0 ) {
+			ts.tv_sec = c->monotonictime / 1000000000;
+			ts.tv_nsec = c->monotonictime % 1000000000;
+			i = 0;
+		} else
+			i = clock_gettime(CLOCK_MONOTONIC, &ts);
 		if( i == 0 ) {
-			fprintf(out, "%lu.%03u ",
-					(unsigned long)ts.tv_sec,
-					(unsigned int)(ts.tv_nsec/1000000L));
+			print_time(o, ts.tv_sec, ts.tv_nsec/1000000L);
 		} else if (!already_warned) {
 			int e = errno;
 			fprintf(stderr, "Error %d from clock_gettime(CLOCK_MONOTIC,): %s\n",
@@ -81,27 +106,89 @@ static void startline(struct connection *c, enum package_direction d, const char
 		}
 	}
 #endif
+	out_uint_pad(o, c->id, 3, '0');
+	out_char(o, ':');
+	out_char(o, (d == TO_SERVER)?'<':'>');
+	out_char(o, ':');
+}
+
+/* the whole line is written once it is complete */
+static inline void endline(struct connection *c) {
+	out_char(&c->output, '\n');
+	out_flush(&c->output);
+}
+
+/* for the less common lines, the usual ones are put together
+ * by hand after print_prefix */
+static void startline(struct connection *c, enum package_direction d, const char *format, ...) {
+	struct outbuf *o = &c->output;
+	va_list ap;
+
+	print_prefix(c, d);
 	va_start(ap, format);
-	fprintf(out, "%03d:%c:", c->id, (d == TO_SERVER)?'<':'>');
-	vfprintf(out, format, ap);
+	out_vprintf(o, format, ap);
 	va_end(ap);
+	if( o->used > 0 && o->data[o->used - 1] == '\n' )
+		out_flush(o);
+}
+
+static inline void print_offset(struct outbuf *o, size_t ofs) {
+	out_char(o, '[');
+	out_uint(o, ofs);
+	out_char(o, ']');
+}
+
+static inline void print_name(struct outbuf *o, const char *name) {
+	out_string(o, name);
+	out_char(o, '=');
 }
 
 #define U256 ((unsigned int)256)
 #define UL256 ((unsigned long)256)
+/* unaligned loads, only byte swapped if the byte order differs,
+ * (with bigendian a constant in the decoders in printparams.h) */
+#if defined(__GNUC__) && defined(__BYTE_ORDER__)
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define SWAPPED(bigendian) (!(bigendian))
+#else
+#define SWAPPED(bigendian) (bigendian)
+#endif
+
+static inline uint16_t CARD16(bool bigendian, const unsigned char *buffer, size_t ofs) {
+	uint16_t v;
+
+	memcpy(&v, buffer + ofs, sizeof(v));
+	return SWAPPED(bigendian)?__builtin_bswap16(v):v;
+}
+
+static inline uint32_t CARD32(bool bigendian, const unsigned char *buffer, size_t ofs) {
+	uint32_t v;
+
+	memcpy(&v, buffer + ofs, sizeof(v));
+	return SWAPPED(bigendian)?__builtin_bswap32(v):v;
+}
+
+static inline uint64_t CARD64(bool bigendian, const unsigned char *buffer, size_t ofs) {
+	uint64_t v;
+
+	memcpy(&v, buffer + ofs, sizeof(v));
+	return SWAPPED(bigendian)?__builtin_bswap64(v):v;
+}
+#else
 #define CARD16(bigendian,buffer,ofs) ((bigendian)?(buffer[ofs]*U256+buffer[ofs+1]):(buffer[ofs+1]*U256+buffer[ofs]))
 #define CARD32(bigendian,buffer,ofs) ((bigendian)?(((buffer[ofs]*U256+buffer[ofs+1])*UL256+buffer[ofs+2])*UL256+buffer[ofs+3]):(buffer[ofs]+UL256*(buffer[ofs+1]+UL256*(buffer[ofs+2]+U256*buffer[ofs+3]))))
 
-static inline uint64_t CARD64(bool bigendian, const unsigned char *buffer,
-                              int ofs)
-{
-    uint64_t ret = 0;
-    for (int i = 0; i < 8; i++) {
-      int shift = (bigendian ? (7 - i) : i) * 8;
-      ret |= (uint64_t)buffer[ofs + i] << shift;
-    }
-    return ret;
+static inline uint64_t CARD64(bool bigendian, const unsigned char *buffer, size_t ofs) {
+	uint64_t ret = 0;
+	int i;
+
+	for( i = 0 ; i < 8 ; i++ ) {
+		int shift = (bigendian ? (7 - i) : i) * 8;
+		ret |= (uint64_t)buffer[ofs + i] << shift;
+	}
+	return ret;
 }
+#endif
 
 #define clientCARD64(ofs) CARD64(c->bigendian,c->clientbuffer,ofs)
 #define clientCARD32(ofs) CARD32(c->bigendian,c->clientbuffer,ofs)
@@ -111,9 +198,11 @@ static inline uint64_t CARD64(bool bigendian, const unsigned char *buffer,
 #define serverCARD32(ofs) CARD32(c->bigendian,c->serverbuffer,ofs)
 #define serverCARD16(ofs) CARD16(c->bigendian,c->serverbuffer,ofs)
 #define serverCARD8(ofs) c->serverbuffer[ofs]
-#define getCARD64(ofs) CARD64(c->bigendian,buffer,ofs)
-#define getCARD32(ofs) CARD32(c->bigendian,buffer,ofs)
-#define getCARD16(ofs) CARD16(c->bigendian,buffer,ofs)
+/* the decoders in printparams.h have their own */
+#define BYTEORDER c->bigendian
+#define getCARD64(ofs) CARD64(BYTEORDER,buffer,ofs)
+#define getCARD32(ofs) CARD32(BYTEORDER,buffer,ofs)
+#define getCARD16(ofs) CARD16(BYTEORDER,buffer,ofs)
 #define getCARD8(ofs) buffer[ofs]
 
 #define getBE32(ofs) (((buffer[ofs]*UL256+buffer[ofs+1])*UL256+buffer[ofs+2])*UL256+buffer[ofs+3])
@@ -126,7 +215,7 @@ struct usedextension {
 	unsigned char first_error;
 };
 
-void free_usedextensions(struct usedextension *e) {
+static void free_usedextensions(struct usedextension *e) {
 	while( e != NULL ) {
 		struct usedextension *h = e->next;
 		free(e);
@@ -143,7 +232,7 @@ struct unknownextension {
 	unsigned char first_error;
 };
 
-void free_unknownextensions(struct unknownextension *e) {
+static void free_unknownextensions(struct unknownextension *e) {
 	while( e != NULL ) {
 		struct unknownextension *h = e->next;
 		free(e);
@@ -151,6 +240,53 @@ void free_unknownextensions(struct unknownextension *e) {
 	}
 }
 
+/* The extensions a connection uses by major opcode and by every event
+ * and error code they have (the last registered wins), so that looking
+ * them up does not depend on how many there are.
+ * Allocated once the first extension is known. */
+struct extensiontables {
+	const struct usedextension *opcodes[256];
+	const struct usedextension *events[256];
+	const struct usedextension *errors[256];
+	const char *unknownopcodes[256];
+};
+
+static struct extensiontables *get_extensiontables(struct connection *c) {
+	if( c->extensiontables == NULL ) {
+		c->extensiontables = calloc(1, sizeof(struct extensiontables));
+		if( c->extensiontables == NULL )
+			abort();
+	}
+	return c->extensiontables;
+}
+
+static void register_used_extension(struct connection *c, const struct usedextension *u) {
+	struct extensiontables *t = get_extensiontables(c);
+	unsigned int i;
+
+	t->opcodes[u->major_opcode] = u;
+	/* an event code of 0 means none */
+	if( u->first_event != 0 ) {
+		for( i = 0 ; i < u->extension->numevents
+		            && u->first_event + i < 256 ; i++ )
+			t->events[u->first_event + i] = u;
+	}
+	for( i = 0 ; i < u->extension->numerrors
+	            && u->first_error + i < 256 ; i++ )
+		t->errors[u->first_error + i] = u;
+}
+
+void free_extensions(struct connection *c) {
+	free_usedextensions(c->usedextensions);
+	free_unknownextensions(c->unknownextensions);
+	free_unknownextensions(c->waiting);
+	free(c->extensiontables);
+	c->usedextensions = NULL;
+	c->unknownextensions = NULL;
+	c->waiting = NULL;
+	c->extensiontables = NULL;
+}
+
 static struct unknownextension *register_unknown_extension(struct connection *c, const unsigned char *name, size_t namelen) {
 	const struct unknownextension *e;
 	struct unknownextension *n;
@@ -182,9 +318,19 @@ static struct unknownextension *register_unknown_extension(struct connection *c,
 }
 
 struct expectedreply {
+	/* in the order the requests were sent */
+	struct expectedreply *older, *newer;
+	/* the next in the same slot of the ring (newer first),
+	 * or the next unused one */
 	struct expectedreply *next;
 	uint64_t seq;
 	const struct request *from;
+	/* whether the reply is to be printed (see --filter) */
+	bool show;
+	/* what the request was and when it was sent (for --stats) */
+	uint8_t major, minor;
+	const char *extension;
+	uint64_t sent;
 	enum datatype { dt_NONE = 0,
 		dt_UNKNOWN_EXTENSION, /* uextension used */
 		dt_EXTENSION, /* extension used */
@@ -198,357 +344,205 @@ struct expectedreply {
 		struct unknownextension *uextension;
 		uint32_t card32;
 	} data;
-	unsigned long values[];
+	unsigned long values[MAX_RECORD_VARIABLES];
 };
 
-const struct extension *find_extension(const uint8_t *name,size_t len);
-
-static void print_bitfield(const char *name,const struct constant *constants, unsigned long l){
-	const struct constant *c;
-	const char *zeroname = "0";
-	bool first = true;
-
-	/* bitmasks should have some */
-	assert(constants != NULL);
-	fprintf(out,"%s=",name);
-
-	for( c = constants; c->name != NULL ; c++ ) {
-		if( c->value == 0 )
-			zeroname = c->name;
-		else if( (l & c->value) != 0 ) {
-			if( !first )
-				putc(',',out);
-			first = false;
-			fputs(c->name,out);
-		}
-	}
-	if( first )
-		fputs(zeroname,out);
+/* The replies a connection waits for are found in a ring indexed by the
+ * low bits of their sequence number (growing up to the 16 bits replies
+ * have), and kept in a list in the order of the requests to find out if
+ * any reply is missing. Entries are taken from blocks that are only
+ * given back when the connection is closed. */
+#define REPLY_RING_INITIAL 64
+#define REPLY_RING_MAX 65536
+#define REPLY_BLOCK 32
+
+struct replyblock {
+	struct replyblock *next;
+	struct expectedreply entries[REPLY_BLOCK];
 };
 
-static const char *findConstant(const struct constant *constants, unsigned long l){
-	const struct constant *c;
-
-	if( constants == NULL )
-		return NULL;
-
-	for( c = constants; c->name != NULL ; c++ ) {
-		if( c->value == l )
-			return c->name;
-	}
-	return NULL;
+struct expectedreplies {
+	struct expectedreply **ring;
+	size_t ringsize, count;
+	struct expectedreply *oldest, *newest;
+	struct expectedreply *unused;
+	struct replyblock *blocks;
 };
 
-#define OFS_LATER ((size_t)-1)
-#define ROUND_32 ((size_t)-1)
-#define ROUND { ROUND_32, "", ft_LASTMARKER, NULL}
-
-
-static size_t printSTRING8(const uint8_t *buffer,size_t buflen,const struct parameter *p,size_t len,size_t ofs){
-	size_t nr = 0;
-
-	if( buflen < ofs )
-		return ofs;
-	if( buflen - ofs <= len )
-		len = buflen - ofs;
+static void replyring_grow(struct expectedreplies *rs) {
+	struct expectedreply *r, **slot;
 
-	if( print_offsets )
-		fprintf(out,"[%d]",(int)ofs);
-	fprintf(out,"%s='",p->name);
-	while( len > 0 ) {
-		if( nr == maxshownlistlen ) {
-			fputs("'...",out);
-		} else if( nr < maxshownlistlen ) {
-			unsigned char c = getCARD8(ofs);
-			if( c == '\n' ) {
-				putc('\\',out);putc('n',out);
-			} else if( c == '\t' ) {
-				putc('\\',out);putc('t',out);
-			} else if( (c >= ' ' && c <= '~' ) )
-				putc(c,out);
-			else
-				fprintf(out,"\\%03hho", c);
-		}
-		ofs++;len--;nr++;
+	free(rs->ring);
+	rs->ringsize = (rs->ringsize == 0)?REPLY_RING_INITIAL:2*rs->ringsize;
+	rs->ring = calloc(rs->ringsize, sizeof(struct expectedreply *));
+	if( rs->ring == NULL )
+		abort();
+	/* oldest first, so the newest end up in front */
+	for( r = rs->oldest ; r != NULL ; r = r->newer ) {
+		slot = &rs->ring[r->seq & (rs->ringsize - 1)];
+		r->next = *slot;
+		*slot = r;
 	}
-	if( nr <= maxshownlistlen )
-		putc('\'',out);
-	return ofs;
 }
 
-static size_t printLISTofCARD8(const uint8_t *buffer, size_t buflen, const char *name, const struct constant *constants, size_t len, size_t ofs){
-	bool notfirst = false;
-	size_t nr = 0;
-
-	if( buflen < ofs )
-		return ofs;
-	if( buflen - ofs <= len )
-		len = buflen - ofs;
-
-	if( print_offsets )
-		fprintf(out,"[%d]",(int)ofs);
-	fprintf(out, "%s=", name);
-	while( len > 0 ) {
-		const char *value;
-		unsigned char u8;
+static struct expectedreply *expect_reply(struct connection *c, uint64_t seq) {
+	struct expectedreplies *rs = c->expectedreplies;
+	struct expectedreply *r, **slot;
+	unsigned int i;
 
-		if( nr == maxshownlistlen ) {
-			fputs(",...",out);
-		} else if( nr < maxshownlistlen ) {
-			if( notfirst )
-				putc(',',out);
-			notfirst = true;
-			u8 = getCARD8(ofs);
-			value = findConstant(constants, u8);
-			if( value )
-				fprintf(out,"%s(0x%hhx)",value,u8);
-			else
-				fprintf(out,"0x%02hhx",u8);
-		}
-		len--;ofs++;nr++;
+	if( rs == NULL ) {
+		rs = calloc(1, sizeof(struct expectedreplies));
+		if( rs == NULL )
+			abort();
+		c->expectedreplies = rs;
 	}
-	putc(';',out);
-	return ofs;
-}
+	if( rs->unused == NULL ) {
+		struct replyblock *b = malloc(sizeof(struct replyblock));
 
-static size_t printLISTofCARD16(struct connection *c,const uint8_t *buffer,size_t buflen,const struct parameter *p,size_t len, size_t ofs){
-	bool notfirst = false;
-	size_t nr = 0;
-
-	if( buflen < ofs )
-		return ofs;
-	if( (buflen - ofs)/2 <= len )
-		len = (buflen - ofs)/2;
-
-	if( print_offsets )
-		fprintf(out,"[%d]",(int)ofs);
-	fprintf(out,"%s=",p->name);
-	while( len > 0 ) {
-		const char *value;
-		uint16_t u16;
-
-		if( nr == maxshownlistlen ) {
-			fputs(",...",out);
-		} else if( nr < maxshownlistlen ) {
-			if( notfirst )
-				putc(',',out);
-			notfirst = true;
-			u16 = getCARD16(ofs);
-			value = findConstant(p->o.constants, u16);
-			if( value )
-				fprintf(out,"%s(0x%hx)",value,(unsigned short int)u16);
-			else
-				fprintf(out,"0x%04hx",(unsigned short int)u16);
+		if( b == NULL )
+			abort();
+		b->next = rs->blocks;
+		rs->blocks = b;
+		for( i = 0 ; i < REPLY_BLOCK ; i++ ) {
+			b->entries[i].next = rs->unused;
+			rs->unused = &b->entries[i];
 		}
-		len--;ofs+=2;nr++;
 	}
-	putc(';',out);
-	return ofs;
+	if( rs->count >= rs->ringsize && rs->ringsize < REPLY_RING_MAX )
+		replyring_grow(rs);
+	r = rs->unused;
+	rs->unused = r->next;
+	r->seq = seq;
+	r->older = rs->newest;
+	r->newer = NULL;
+	if( rs->newest != NULL )
+		rs->newest->newer = r;
+	else
+		rs->oldest = r;
+	rs->newest = r;
+	slot = &rs->ring[seq & (rs->ringsize - 1)];
+	r->next = *slot;
+	*slot = r;
+	rs->count++;
+	return r;
 }
 
-static size_t printLISTofCARD32(struct connection *c,const uint8_t *buffer,size_t buflen,const struct parameter *p,size_t len, size_t ofs){
-	bool notfirst = false;
-	size_t nr = 0;
-
-	if( buflen < ofs )
-		return ofs;
-	if( (buflen - ofs)/4 <= len )
-		len = (buflen - ofs)/4;
+/* the newest one waiting for a reply with that (16 bit) sequence number */
+static struct expectedreply *find_expected_reply(struct connection *c, unsigned int seq) {
+	const struct expectedreplies *rs = c->expectedreplies;
+	struct expectedreply *r;
 
-	if( print_offsets )
-		fprintf(out,"[%d]",(int)ofs);
-	fprintf(out,"%s=",p->name);
-	while( len > 0 ) {
-		const char *value;
-		uint32_t u32;
-
-		if( nr == maxshownlistlen ) {
-			fputs(",...",out);
-		} else if( nr < maxshownlistlen ) {
-			if( notfirst )
-				putc(',',out);
-			notfirst = true;
-			u32 = getCARD32(ofs);
-			value = findConstant(p->o.constants, u32);
-			if( value )
-				fprintf(out,"%s(0x%x)",value,(unsigned int)u32);
-			else
-				fprintf(out,"0x%08x",(unsigned int)u32);
-		}
-		len--;ofs+=4;nr++;
+	if( rs == NULL || rs->count == 0 )
+		return NULL;
+	for( r = rs->ring[seq & (rs->ringsize - 1)] ; r != NULL ; r = r->next ) {
+		if( (r->seq & 0xFFFF) == seq )
+			return r;
 	}
-	putc(';',out);
-	return ofs;
+	return NULL;
 }
 
-static size_t printLISTofCARD64(struct connection *c,const uint8_t *buffer,size_t buflen,const struct parameter *p,size_t len, size_t ofs){
-	bool notfirst = false;
-	size_t nr = 0;
-
-	if( buflen < ofs )
-		return ofs;
-	if( (buflen - ofs)/8 <= len )
-		len = (buflen - ofs)/8;
-
-	if( print_offsets )
-		fprintf(out,"[%d]",(int)ofs);
-	fprintf(out,"%s=",p->name);
-	while( len > 0 ) {
-		uint64_t u64;
-
-		if( nr == maxshownlistlen ) {
-			fputs(",...",out);
-		} else if( nr < maxshownlistlen ) {
-			if( notfirst )
-				putc(',',out);
-			notfirst = true;
-			u64 = getCARD64(ofs);
-			fprintf(out,"0x%016"PRIx64, u64);
-		}
-		len--;ofs+=8;nr++;
-	}
-	putc(';',out);
-	return ofs;
+static void forget_expected_reply(struct connection *c, struct expectedreply *r) {
+	struct expectedreplies *rs = c->expectedreplies;
+	struct expectedreply **p;
+
+	for( p = &rs->ring[r->seq & (rs->ringsize - 1)] ; *p != r ;
+			p = &(*p)->next )
+		assert( *p != NULL );
+	*p = r->next;
+	if( r->data_type == dt_ATOM && r->data.atom != NULL )
+		dropAtom(c, r->data.atom);
+	if( r->older != NULL )
+		r->older->newer = r->newer;
+	else
+		rs->oldest = r->newer;
+	if( r->newer != NULL )
+		r->newer->older = r->older;
+	else
+		rs->newest = r->older;
+	r->next = rs->unused;
+	rs->unused = r;
+	rs->count--;
 }
 
-static size_t printLISTofFIXED(struct connection *c,const uint8_t *buffer,size_t buflen,const struct parameter *p,size_t len, size_t ofs){
-	bool notfirst = false;
-	size_t nr = 0;
-
-	if( buflen < ofs )
-		return ofs;
-	if( (buflen - ofs)/4 <= len )
-		len = (buflen - ofs)/4;
+void free_expectedreplies(struct connection *c) {
+	struct expectedreplies *rs = c->expectedreplies;
 
-	if( print_offsets )
-		fprintf(out,"[%d]",(int)ofs);
-	fprintf(out,"%s=",p->name);
-	while( len > 0 ) {
-		int32_t i32;
-		double d;
+	if( rs == NULL )
+		return;
+	while( rs->blocks != NULL ) {
+		struct replyblock *b = rs->blocks;
 
-		if( nr == maxshownlistlen ) {
-			fputs(",...",out);
-		} else if( nr < maxshownlistlen ) {
-			if( notfirst )
-				putc(',',out);
-			notfirst = true;
-			i32 = getCARD32(ofs);
-			d = i32 / 65536.0;
-			fprintf(out,"%.6f", d);
-		}
-		len--;ofs+=4;nr++;
+		rs->blocks = b->next;
+		free(b);
 	}
-	putc(';',out);
-	return ofs;
+	free(rs->ring);
+	free(rs);
+	c->expectedreplies = NULL;
 }
 
-static size_t printLISTofFIXED3232(struct connection *c, const uint8_t *buffer, size_t buflen, const struct parameter *p, size_t len, size_t ofs){
-	bool notfirst = false;
-	size_t nr = 0;
+const struct extension *find_extension(const uint8_t *name,size_t len);
 
-	if( buflen < ofs )
-		return ofs;
-	if( (buflen - ofs)/8 <= len )
-		len = (buflen - ofs)/8;
+static void print_bitfield(struct outbuf *o, const char *name,const struct constant *constants, unsigned long l){
+	const struct constant *c;
+	const char *zeroname = "0";
+	bool first = true;
 
-	if( print_offsets )
-		fprintf(out,"[%d]", (int)ofs);
-	fprintf(out, "%s=", p->name);
-	while( len > 0 ) {
-		int32_t i32;
-		uint32_t u32;
-		double d;
+	/* bitmasks should have some */
+	assert(constants != NULL);
+	print_name(o, name);
 
-		if( nr == maxshownlistlen ) {
-			fputs(",...", out);
-		} else if( nr < maxshownlistlen ) {
-			if( notfirst )
-				putc(',', out);
-			notfirst = true;
-			i32 = getCARD32(ofs);
-			u32 = getCARD32(ofs + 4);
-			d = i32 + (u32 / ((double)65536.0 * (double)65536.0)) ;
-			fprintf(out, "%.11f", d);
+	for( c = constants; c->name != 0 ; c++ ) {
+		if( c->value == 0 )
+			zeroname = protocol_name(c->name);
+		else if( (l & c->value) != 0 ) {
+			if( !first )
+				out_char(o, ',');
+			first = false;
+			out_string(o, protocol_name(c->name));
 		}
-		len--; ofs += 8; nr++;
 	}
-	putc(';', out);
-	return ofs;
-}
-
-
-static size_t printLISTofFLOAT32(struct connection *c, const uint8_t *buffer, size_t buflen, const struct parameter *p, size_t len, size_t ofs){
-	bool notfirst = false;
-	size_t nr = 0;
+	if( first )
+		out_string(o, zeroname);
+};
 
-	if( buflen < ofs )
-		return ofs;
-	if( (buflen - ofs)/4 <= len )
-		len = (buflen - ofs)/4;
+static const char *findConstant(const struct constant *constants, unsigned long l){
+	const struct constant *header, *table;
+	size_t size, lo, hi;
 
-	if( print_offsets )
-		fprintf(out,"[%d]",(int)ofs);
-	fprintf(out,"%s=",p->name);
-	while( len > 0 ) {
-		uint32_t u32;
-		float f;
+	if( constants == NULL || l > 0xFFFFFFFFUL )
+		return NULL;
 
-		if( nr == maxshownlistlen ) {
-			fputs(",...",out);
-		} else if( nr < maxshownlistlen ) {
-			if( notfirst )
-				putc(',',out);
-			notfirst = true;
-			u32 = getCARD32(ofs);
-			memcpy(&f, &u32, 4);
-			fprintf(out, "%f", f);
-		}
-		len--;ofs+=4;nr++;
+	/* see struct constant in parse.h */
+	header = constants - 1;
+	size = header->name >> 1;
+	table = header - size;
+	if( (header->name & 1) != 0 ) {
+		/* (values below the minimum wrap around) */
+		l -= header->value;
+		if( l >= size || table[l].name == 0 )
+			return NULL;
+		return protocol_name(table[l].name);
 	}
-	putc(';',out);
-	return ofs;
-}
+	/* the first of equal values, its name was given first */
+	lo = 0; hi = size;
+	while( lo < hi ) {
+		size_t mid = lo + (hi - lo)/2;
 
-static size_t printLISTofATOM(struct connection *c,const uint8_t *buffer,size_t buflen,const struct parameter *p,size_t len, size_t ofs){
-	bool notfirst = false;
-	size_t nr = 0;
-
-	if( buflen < ofs )
-		return ofs;
-	if( (buflen - ofs)/4 <= len )
-		len = (buflen - ofs)/4;
+		if( table[mid].value < l )
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	if( lo == size || table[lo].value != l )
+		return NULL;
+	return protocol_name(table[lo].name);
+};
 
-	if( print_offsets )
-		fprintf(out,"[%d]",(int)ofs);
-	fprintf(out,"%s=",p->name);
-	while( len > 0 ) {
-		const char *value;
-		uint32_t u32;
+#define ROUND_32 ((size_t)-1)
+#define ROUND { ROUND_32, "", ft_LASTMARKER, NULL}
 
-		if( nr == maxshownlistlen ) {
-			fputs(",...",out);
-		} else if( nr < maxshownlistlen ) {
-			if( notfirst )
-				putc(',',out);
-			notfirst = true;
-			u32 = getCARD32(ofs);
-			value = findConstant(p->o.constants, u32);
-			if( value )
-				fprintf(out,"%s(0x%x)",value,(unsigned int)u32);
-			else if( (value = getAtom(c,u32)) == NULL )
-				fprintf(out,"0x%x",(unsigned int)u32);
-			else
-				fprintf(out,"0x%x(\"%s\")",(unsigned int)u32,value);
-		}
-		len--;ofs+=4;nr++;
-	}
-	putc(';',out);
-	return ofs;
-}
 
-static size_t printLISTofINT8(const uint8_t *buffer,size_t buflen,const struct parameter *p,size_t len, size_t ofs){
-	bool notfirst = false;
+static size_t printSTRING8(struct outbuf *o, const uint8_t *buffer,size_t buflen,const struct instruction *p,size_t len,size_t ofs){
 	size_t nr = 0;
 
 	if( buflen < ofs )
@@ -557,102 +551,61 @@ static size_t printLISTofINT8(const uint8_t *buffer,size_t buflen,const struct p
 		len = buflen - ofs;
 
 	if( print_offsets )
-		fprintf(out,"[%d]",(int)ofs);
-	fprintf(out,"%s=",p->name);
+		print_offset(o, ofs);
+	out_string(o, protocol_name(p->name));
+	out_string(o, "='");
 	while( len > 0 ) {
-		const char *value;
-		signed char i8;
+		unsigned char c;
 
 		if( nr == maxshownlistlen ) {
-			fputs(",...",out);
-		} else if( nr < maxshownlistlen ) {
-			if( notfirst )
-				putc(',',out);
-			notfirst = true;
-			i8 = getCARD8(ofs);
-			value = findConstant(p->o.constants, i8);
-			if( value )
-				fprintf(out,"%s(%d)",value,(int)i8);
-			else
-				fprintf(out,"%d",(int)i8);
+			out_string(o, "'...");
+			/* the rest only needs to be skipped */
+			return ofs + len;
 		}
-		len--;ofs++;nr++;
-	}
-	putc(';',out);
-	return ofs;
-}
-
-static size_t printLISTofINT16(struct connection *c,const uint8_t *buffer,size_t buflen,const struct parameter *p,size_t len, size_t ofs){
-	bool notfirst = false;
-	size_t nr = 0;
-
-	if( buflen < ofs )
-		return ofs;
-	if( (buflen - ofs)/2 <= len )
-		len = (buflen - ofs)/2;
-
-	if( print_offsets )
-		fprintf(out,"[%d]",(int)ofs);
-	fprintf(out,"%s=",p->name);
-	while( len > 0 ) {
-		const char *value;
-		int16_t i16;
-
-		if( nr == maxshownlistlen ) {
-			fputs(",...",out);
-		} else if( nr < maxshownlistlen ) {
-			if( notfirst )
-				putc(',',out);
-			notfirst = true;
-			i16 = getCARD16(ofs);
-			value = findConstant(p->o.constants, i16);
-			if( value )
-				fprintf(out,"%s(%d)",value,(int)i16);
-			else
-				fprintf(out,"%d",(int)i16);
+		c = getCARD8(ofs);
+		if( c == '\n' ) {
+			out_mem(o, "\\n", 2);
+		} else if( c == '\t' ) {
+			out_mem(o, "\\t", 2);
+		} else if( (c >= ' ' && c <= '~' ) )
+			out_char(o, c);
+		else {
+			char *e = out_reserve(o, 4);
+
+			e[0] = '\\';
+			e[1] = '0' + (c >> 6);
+			e[2] = '0' + ((c >> 3) & 7);
+			e[3] = '0' + (c & 7);
+			o->used += 4;
 		}
-		len--;ofs+=2;nr++;
+		ofs++;len--;nr++;
 	}
-	putc(';',out);
+	out_char(o, '\'');
 	return ofs;
 }
 
-static size_t printLISTofINT32(struct connection *c,const uint8_t *buffer,size_t buflen,const struct parameter *p,size_t len, size_t ofs){
-	bool notfirst = false;
-	size_t nr = 0;
-
-	if( buflen < ofs )
-		return ofs;
-	if( (buflen - ofs)/4 <= len )
-		len = (buflen - ofs)/4;
+/* the rest of a list of len elements of size bytes without constants,
+ * formatted in bulk (see hexlist.h) */
+static size_t printHexList(struct outbuf *o, const uint8_t *buffer, size_t len, size_t ofs, unsigned int size, bool bigendian) {
+	size_t shown = (len < maxshownlistlen)?len:maxshownlistlen;
+	size_t todo = shown;
 
-	if( print_offsets )
-		fprintf(out,"[%d]",(int)ofs);
-	fprintf(out,"%s=",p->name);
-	while( len > 0 ) {
-		const char *value;
-		int32_t i32;
+	while( todo > 0 ) {
+		size_t n = (todo < 1024)?todo:1024;
 
-		if( nr == maxshownlistlen ) {
-			fputs(",...",out);
-		} else if( nr < maxshownlistlen ) {
-			if( notfirst )
-				putc(',',out);
-			notfirst = true;
-			i32 = getCARD32(ofs);
-			value = findConstant(p->o.constants, i32);
-			if( value )
-				fprintf(out,"%s(%d)",value,(int)i32);
-			else
-				fprintf(out,"%d",(int)i32);
-		}
-		len--;ofs+=4;nr++;
+		if( todo < shown )
+			out_char(o, ',');
+		o->used += hexlist(out_reserve(o, n*(3 + 2*size)),
+				buffer + ofs, n, size, bigendian);
+		ofs += n*size; todo -= n;
 	}
-	putc(';',out);
-	return ofs;
+	if( len > shown )
+		out_string(o, ",...");
+	out_char(o, ';');
+	return ofs + (len - shown)*size;
 }
 
-static size_t printLISTofUINT8(const uint8_t *buffer,size_t buflen,const struct parameter *p,size_t len, size_t ofs){
+static size_t printLISTofCARD8(struct outbuf *o, const uint8_t *buffer, size_t buflen, const char *name, const struct constant *constants, size_t len, size_t ofs){
 	bool notfirst = false;
 	size_t nr = 0;
 
@@ -662,326 +615,137 @@ static size_t printLISTofUINT8(const uint8_t *buffer,size_t buflen,const struct
 		len = buflen - ofs;
 
 	if( print_offsets )
-		fprintf(out,"[%d]",(int)ofs);
-	fprintf(out,"%s=",p->name);
+		print_offset(o, ofs);
+	print_name(o, name);
+	if( constants == NULL )
+		return printHexList(o, buffer, len, ofs, 1, false);
 	while( len > 0 ) {
 		const char *value;
 		unsigned char u8;
 
 		if( nr == maxshownlistlen ) {
-			fputs(",...",out);
-		} else if( nr < maxshownlistlen ) {
-			if( notfirst )
-				putc(',',out);
-			notfirst = true;
-			u8 = getCARD8(ofs);
-			value = findConstant(p->o.constants, u8);
-			if( value )
-				fprintf(out,"%s(%u)",value,(unsigned int)u8);
-			else
-				fprintf(out,"%u",(unsigned int)u8);
+			out_string(o, ",...");
+			/* the rest only needs to be skipped */
+			ofs += len;
+			break;
 		}
+		if( notfirst )
+			out_char(o, ',');
+		notfirst = true;
+		u8 = getCARD8(ofs);
+		value = findConstant(constants, u8);
+		if( value ) {
+			out_string(o, value);
+			out_char(o, '(');
+			out_hex(o, u8, 1);
+			out_char(o, ')');
+		} else
+			out_hex(o, u8, 2);
 		len--;ofs++;nr++;
 	}
-	putc(';',out);
+	out_char(o, ';');
 	return ofs;
 }
 
-static size_t printLISTofUINT16(struct connection *c,const uint8_t *buffer,size_t buflen,const struct parameter *p,size_t len, size_t ofs){
+static size_t printLISTofINT8(struct outbuf *o, const uint8_t *buffer,size_t buflen,const struct instruction *p,size_t len, size_t ofs){
 	bool notfirst = false;
 	size_t nr = 0;
 
 	if( buflen < ofs )
 		return ofs;
-	if( (buflen - ofs)/2 <= len )
-		len = (buflen - ofs)/2;
+	if( buflen - ofs <= len )
+		len = buflen - ofs;
 
 	if( print_offsets )
-		fprintf(out,"[%d]",(int)ofs);
-	fprintf(out,"%s=",p->name);
+		print_offset(o, ofs);
+	print_name(o, protocol_name(p->name));
 	while( len > 0 ) {
 		const char *value;
-		uint16_t u16;
+		signed char i8;
 
 		if( nr == maxshownlistlen ) {
-			fputs(",...",out);
-		} else if( nr < maxshownlistlen ) {
-			if( notfirst )
-				putc(',',out);
-			notfirst = true;
-			u16 = getCARD16(ofs);
-			value = findConstant(p->o.constants, u16);
-			if( value )
-				fprintf(out,"%s(%u)",value,(unsigned int)u16);
-			else
-				fprintf(out,"%u",(unsigned int)u16);
+			out_string(o, ",...");
+			/* the rest only needs to be skipped */
+			ofs += len;
+			break;
 		}
-		len--;ofs+=2;nr++;
+		if( notfirst )
+			out_char(o, ',');
+		notfirst = true;
+		i8 = getCARD8(ofs);
+		value = findConstant(p->o.constants, i8);
+		if( value ) {
+			out_string(o, value);
+			out_char(o, '(');
+			out_int(o, i8);
+			out_char(o, ')');
+		} else
+			out_int(o, i8);
+		len--;ofs++;nr++;
 	}
-	putc(';',out);
+	out_char(o, ';');
 	return ofs;
 }
 
-static size_t printLISTofUINT32(struct connection *c,const uint8_t *buffer,size_t buflen,const struct parameter *p,size_t len, size_t ofs){
+static size_t printLISTofUINT8(struct outbuf *o, const uint8_t *buffer,size_t buflen,const struct instruction *p,size_t len, size_t ofs){
 	bool notfirst = false;
 	size_t nr = 0;
 
 	if( buflen < ofs )
 		return ofs;
-	if( (buflen - ofs)/4 <= len )
-		len = (buflen - ofs)/4;
+	if( buflen - ofs <= len )
+		len = buflen - ofs;
 
 	if( print_offsets )
-		fprintf(out,"[%d]",(int)ofs);
-	fprintf(out,"%s=",p->name);
+		print_offset(o, ofs);
+	print_name(o, protocol_name(p->name));
 	while( len > 0 ) {
 		const char *value;
-		uint32_t u32;
+		unsigned char u8;
 
 		if( nr == maxshownlistlen ) {
-			fputs(",...",out);
-		} else if( nr < maxshownlistlen ) {
-			if( notfirst )
-				putc(',',out);
-			notfirst = true;
-			u32 = getCARD32(ofs);
-			value = findConstant(p->o.constants, u32);
-			if( value )
-				fprintf(out,"%s(%u)",value,(unsigned int)u32);
-			else
-				fprintf(out,"%u",(unsigned int)u32);
-		}
-		len--;ofs+=4;nr++;
-	}
-	putc(';',out);
-	return ofs;
-}
-
-static size_t printLISTofVALUE(struct connection *c,const uint8_t *buffer,size_t buflen,const struct parameter *param,unsigned long valuemask, size_t ofs){
-
-	const struct value *v = param->o.values;
-	const char *atom;
-	bool notfirst = false;
-
-	assert( v != NULL );
-
-	if( ofs > buflen )
-		return ofs;
-	if( print_offsets )
-		fprintf(out,"[%d]",(int)ofs);
-	fprintf(out,"%s={",param->name);
-	while( buflen > ofs && buflen-ofs >= 4 ) {
-		uint32_t u32; uint16_t u16; uint8_t u8;
-		int32_t i32; int16_t i16; int8_t i8;
-		const char *constant;
-
-		if( v->name == NULL ) /* EOV */
+			out_string(o, ",...");
+			/* the rest only needs to be skipped */
+			ofs += len;
 			break;
-		if( (valuemask & v->flag) == 0 ) {
-			v++;
-			continue;
 		}
 		if( notfirst )
-			putc(' ',out);
-		notfirst = true;
-		/* this is funny, but that is the protocol... */
-		u32 = getCARD32(ofs); i32 = u32;
-		u16 = u32 & 65535; i16 = u16;
-		u8 = u32 & 255; i8 = u8;
-		if( v->type == ft_INT32_32 ) {
-			long long ll;
-
-			/* XSync suddenly has 64 bit values allowed in
-			 * VALUES... */
-			if( buflen-ofs < 8 ) {
-				c++;
-				continue;
-			}
-			u32 = getCARD32(ofs + 4);
-			ll = (((long long)i32)<< 32LL) + (long long)u32;
-			fprintf(out, "%s=%lld", v->name, ll);
-			ofs += 8;v++;
-			continue;
-		}
-		if( v->type >= ft_BITMASK8 ) {
-			assert(v->type <= ft_BITMASK32 );
-			print_bitfield(v->name,v->constants,u32);
-			ofs += 4;v++;
-			continue;
-		}
-		assert( v->type < ft_STORE8 || v->type == ft_ATOM );
-		switch( (v->type==ft_ATOM)?2:(v->type % 3) ) {
-		 case 0:
-			constant = findConstant(v->constants,u8);
-			break;
-		 case 1:
-			constant = findConstant(v->constants,u16);
-			break;
-		 default:
-			constant = findConstant(v->constants,u32);
-			break;
-		}
-		fputs(v->name,out);putc('=',out);
-		if( constant != NULL ) {
-			fputs(constant,out);
-			putc('(',out);
-		}
-		switch( v->type ) {
-		 case ft_INT8:
-			 fprintf(out,"%d",(int)i8);
-			 break;
-		 case ft_INT16:
-			 fprintf(out,"%d",(int)i16);
-			 break;
-		 case ft_INT32:
-			 fprintf(out,"%d",(int)i32);
-			 break;
-		 case ft_UINT8:
-			 fprintf(out,"%u",(unsigned int)u8);
-			 break;
-		 case ft_UINT16:
-			 fprintf(out,"%u",(unsigned int)u16);
-			 break;
-		 case ft_UINT32:
-			 fprintf(out,"%u",(unsigned int)u32);
-			 break;
-		 case ft_ENUM8:
-			 if( constant == NULL )
-				 fputs("unknown:",out);
-		 case ft_CARD8:
-			 fprintf(out,"0x%02x",(unsigned int)u8);
-			 break;
-		 case ft_ENUM16:
-			 if( constant == NULL )
-				 fputs("unknown:",out);
-		 case ft_CARD16:
-			 fprintf(out,"0x%04x",(unsigned int)u16);
-			 break;
-		 case ft_ATOM:
-			 fprintf(out,"0x%x",(unsigned int)u32);
-			 atom = getAtom(c, u32);
-			 if( atom != NULL )
-				 fprintf(out,"(\"%s\")", atom);
-			 break;
-		 case ft_ENUM32:
-			 if( constant == NULL )
-				 fputs("unknown:",out);
-		 case ft_CARD32:
-			 fprintf(out,"0x%08x",(unsigned int)u32);
-			 break;
-		 default:
-			 assert(0);
-		}
-		if( constant != NULL ) {
-			putc(')',out);
-		}
-		ofs += 4; v++;
-	}
-	putc('}',out);
-	/* TODO: print error if flags left or v!=EOV? */
-	return ofs;
-}
-
-struct stack {
-	unsigned long *base;
-	int num;
-	int ofs;
-};
-
-static unsigned long getFromStack(struct stack *stack, size_t depth) {
-	assert(stack != NULL && stack->ofs > (int)depth );
-	return stack->base[stack->ofs - 1 - depth];
-}
-
-static void push(struct stack *stack, unsigned long value) {
-	stack->base[stack->ofs] = value;
-	stack->ofs++;
-	assert(stack->ofs<stack->num);
-}
-static void pop(struct stack *stack UNUSED, struct stack *oldstack UNUSED) {
-}
-
-static size_t print_parameters(struct connection *c, const unsigned char *buffer, unsigned int len, const struct parameter *parameters, bool bigrequest, struct stack *oldstack, bool returnstack);
-
-static size_t printLISTofStruct(struct connection *c,const uint8_t *buffer,size_t buflen,const struct parameter *p,size_t count, size_t ofs, struct stack *stack){
-	bool notfirst = false;
-	const struct parameter *substruct = p->o.parameters;
-	size_t len;
-	size_t nr = 0;
-
-	/* and the first item includes the length of an item */
-	assert( substruct != NULL && substruct->name == NULL && substruct->offse > 0);
-	len = substruct->offse;
-	substruct++;
-
-	if( print_offsets )
-		fprintf(out,"[%d]",(int)ofs);
-	fprintf(out,"%s=",p->name);
-	while( buflen > ofs && buflen-ofs >= len && count > 0) {
-
-		if( nr == maxshownlistlen ) {
-			fputs(",...",out);
-			if( len == 0 )
-				ofs = SIZE_MAX;
-			break;
-		} else if( nr < maxshownlistlen ) {
-			if( notfirst )
-				putc(',',out);
-			notfirst = true;
-			putc('{',out);
-
-			print_parameters(c, buffer+ofs, len, substruct, false,
-					stack, false);
-
-			putc('}',out);
-		}
-		ofs += len; count--; nr++;
-	}
-	putc(';',out);
-	return ofs;
-}
-static size_t printLISTofVarStruct(struct connection *c,const uint8_t *buffer,size_t buflen,const struct parameter *p,size_t count, size_t ofs, struct stack *stack){
-	bool notfirst = false;
-//	size_t ofs = (p->offset<0)?lastofs:p->offset;
-	const struct parameter *substruct = p->o.parameters;
-	size_t len;
-	size_t nr = 0;
-
-	/* in this case this is only the minimum value */
-	assert( substruct != NULL && substruct->name == NULL && substruct->offse > 0);
-	len = substruct->offse;
-	substruct++;
-
-	if( print_offsets )
-		fprintf(out,"[%d]",(int)ofs);
-	fprintf(out,"%s=",p->name);
-	while( buflen > ofs && buflen-ofs >= len && count > 0) {
-		size_t lentoadd;
-
-		if( nr >= maxshownlistlen ) {
-			fputs(",...;",out);
-			/* there is nothing here to calculate the rest,
-			 * so just return the unreachable */
-			return SIZE_MAX;
-		}
-		if( notfirst ) {
-			putc(',',out);
-			if( print_offsets )
-				fprintf(out,"[%d]",(int)ofs);
-		}
+			out_char(o, ',');
 		notfirst = true;
-		putc('{',out);
-
-		lentoadd = print_parameters(c, buffer+ofs, buflen-ofs,
-				substruct, false, stack, false);
-
-		putc('}',out);
-		ofs += lentoadd; count--; nr++;
+		u8 = getCARD8(ofs);
+		value = findConstant(p->o.constants, u8);
+		if( value ) {
+			out_string(o, value);
+			out_char(o, '(');
+			out_uint(o, u8);
+			out_char(o, ')');
+		} else
+			out_uint(o, u8);
+		len--;ofs++;nr++;
 	}
-	putc(';',out);
+	out_char(o, ';');
 	return ofs;
 }
 
+struct stack {
+	unsigned long *base;
+	int num;
+	int ofs;
+};
+
+static unsigned long getFromStack(struct stack *stack, size_t depth) {
+	assert(stack != NULL && stack->ofs > (int)depth );
+	return stack->base[stack->ofs - 1 - depth];
+}
+
+static void push(struct stack *stack, unsigned long value) {
+	stack->base[stack->ofs] = value;
+	stack->ofs++;
+	assert(stack->ofs<stack->num);
+}
+static void pop(struct stack *stack UNUSED, struct stack *oldstack UNUSED) {
+}
+
 /* buffer must have at least 32 valid bytes */
 static const struct event *find_event(struct connection *c, const unsigned char *buffe, const char **extension_name);
 static void print_event_data(struct connection *c, const unsigned char *buffer, size_t len, const struct event *event, const char *extension);
@@ -1005,511 +769,142 @@ static inline void print_event(struct connection *c, const unsigned char *buffer
 	print_event_data(c, buffer, l, event, name);
 }
 
-static size_t print_parameters(struct connection *c, const unsigned char *buffer, unsigned int len, const struct parameter *parameters, bool bigrequest, struct stack *oldstack, bool returnstack) {
-	const struct parameter *p;
-	unsigned long stored = INT_MAX;
-	unsigned char format = 0;
-	bool printspace = false;
-	size_t lastofs = 0;
-	struct stack newstack = *oldstack;
-	bool sizeset = false;
-
-	for( p = parameters; p->name != NULL; p++ ) {
-		size_t s;
-		int8_t i8; int16_t i16; int32_t i32;
-		uint32_t uu;
-#ifdef STUPIDCC
-		uint8_t u8=0; uint16_t u16=0; uint32_t u32=0;
-		unsigned long l=0;
-#else
-		uint8_t u8; uint16_t u16; uint32_t u32;
-		unsigned long l;
-#endif
-		size_t ofs;
-		const char *value;
-		const char *atom;
-		double d;
-		float f;
-		long long ll;
-
-		if( p->offse == OFS_LATER )
-			ofs = lastofs;
-		else if( bigrequest && p->offse >= 4 )
-			/* jump over 32 bit extended length */
-			ofs = p->offse+4;
-		else
-			ofs = p->offse;
+/* a field of the types up to ENUM32, STORE or PUSH */
+static void print_number(struct outbuf *o, const struct instruction *in, size_t ofs, unsigned long l) {
+	const char *value;
 
-		if( p->type == ft_IF8 ) {
-			unsigned char v;
+	value = findConstant(in->o.constants, l);
+	if( print_offsets )
+		print_offset(o, ofs);
+	print_name(o, protocol_name(in->name));
+	if( value != NULL ) {
+		out_string(o, value);
+		out_char(o, '(');
+	}
+	switch( (enum opcode)in->op ) {
+	 case op_INT8:
+		 out_int(o, (int8_t)l);
+		 break;
+	 case op_INT16:
+		 out_int(o, (int16_t)l);
+		 break;
+	 case op_INT32:
+		 out_int(o, (int32_t)l);
+		 break;
+	 case op_ENUM8:
+		 if( value == NULL )
+			 out_string(o, "unknown:");
+		 /* fall through */
+	 case op_CARD8:
+		 out_hex(o, l, 2);
+		 break;
+	 case op_ENUM16:
+		 if( value == NULL )
+			 out_string(o, "unknown:");
+		 /* fall through */
+	 case op_CARD16:
+		 out_hex(o, l, 4);
+		 break;
+	 case op_ENUM32:
+		 if( value == NULL )
+			 out_string(o, "unknown:");
+		 /* fall through */
+	 case op_CARD32:
+		 out_hex(o, l, 8);
+		 break;
+	 default:
+		 /* UINT, STORE and PUSH */
+		 out_uint(o, l);
+		 break;
+	}
+	if( value != NULL ) {
+		out_char(o, ')');
+	}
+}
 
-			if( p->offse == OFS_LATER )
-				v = stored & 0xFF;
-			else if( ofs <len )
-				v = getCARD8(ofs);
-			else
-				continue;
-			/* some more overloading: */
-			if( v == (unsigned char)(p->name[0]) )
-				p = (p->o.parameters)-1;
-			continue;
-		} else if( p->type == ft_IF16 ) {
-			unsigned int v;
+static void print_atom(struct connection *c, const struct instruction *in, size_t ofs, uint32_t u32) {
+	struct outbuf *o = &c->output;
+	const char *value, *atom;
 
-			if( p->offse == OFS_LATER )
-				v = stored & 0xFFFF;
-			else if( ofs+1 <len )
-				v = getCARD16(ofs);
-			else
-				continue;
-			if( v == (unsigned char)(p->name[1])
-			  + (unsigned int)0x100*(unsigned char)(p->name[0]) )
-				p = (p->o.parameters)-1;
-			continue;
-		} else if( p->type == ft_IF32 ) {
-			unsigned long v;
+	if( print_offsets )
+		print_offset(o, ofs);
+	print_name(o, protocol_name(in->name));
+	value = findConstant(in->o.constants, u32);
+	atom = getAtom(c, u32);
+	if( value != NULL ) {
+		out_string(o, value);
+		out_char(o, '(');
+		out_hex(o, u32, 1);
+		out_char(o, ')');
+	} else if( atom == NULL ) {
+		out_hex(o, u32, 1);
+		out_string(o, "(unrecognized atom)");
+	} else {
+		out_hex(o, u32, 1);
+		out_string(o, "(\"");
+		out_string(o, atom);
+		out_string(o, "\")");
+	}
+}
 
-			if( p->offse == OFS_LATER )
-				v = stored;
-			else if( ofs+3 <len )
-				v = getCARD32(ofs);
-			else
-				continue;
-			if( v == (unsigned char)(p->name[3])
-			  + (((unsigned long)((unsigned char)(p->name[2])))<<8)
-			  + (((unsigned long)((unsigned char)(p->name[1])))<<16)
-			  + (((unsigned long)((unsigned char)(p->name[0])))<<24) )
-				p = (p->o.parameters)-1;
-			continue;
-		} else if( p->type == ft_IFATOM ) {
-			const char *atomname;
-			if( p->offse == OFS_LATER )
-				atomname = getAtom(c, stored);
-			else if( ofs+4 >= len )
-				continue;
-			else
-				atomname = getAtom(c, getCARD32(ofs));
-			if( atomname == NULL )
-				continue;
-			if( strcmp(atomname, p->name) == 0 )
-				p = (p->o.parameters)-1;
-			continue;
-		}
+/* where a list of count elements ends, if only those completely in
+ * the buffer are looked at (like the printLISTof... do) */
+static inline size_t list_end(size_t buflen, size_t ofs, unsigned long count, size_t size) {
+	if( buflen < ofs )
+		return ofs;
+	if( (buflen - ofs)/size <= count )
+		count = (buflen - ofs)/size;
+	return ofs + count*size;
+}
 
-		if( printspace )
-			putc(' ', out);
-		printspace = true;
-
-		switch( p->type ) {
-		 case ft_LASTMARKER:
-			 if( p->offse == ROUND_32 )
-				 lastofs = (lastofs+3)& ~3;
-			 else
-				 lastofs = ofs;
-			 printspace = false;
-			 continue;
-		 case ft_SET_SIZE:
-			printspace = false;
-			sizeset = true;
-			if( p->offse == (size_t)-1 )
-				s = stored;
-			else if( (p->offse & 0x80000000U) != 0 )
-				s = getFromStack(&newstack,
-						p->offse - 0x80000000U);
-			else
-				s =  p->offse;
-			if( p->name != NULL && p->name[0] != '\0' )
-				s *= (unsigned char)(p->name[0]);
-			if( len > s )
-				len = s;
-			continue;
-		 case ft_FORMAT8:
-			 if( ofs < len )
-				 format = getCARD8(ofs);
-			printspace = false;
-			 continue;
-		 case ft_STRING8:
-			lastofs = printSTRING8(buffer,len,p,stored,ofs);
-			continue;
-		 case ft_LISTofCARD8:
-			lastofs = printLISTofCARD8(buffer, len,
-					p->name, p->o.constants,
-					stored, ofs);
-			continue;
-		 case ft_LISTofCARD16:
-			lastofs = printLISTofCARD16(c,buffer,len,p,stored,ofs);
-			continue;
-		 case ft_LISTofCARD32:
-			lastofs = printLISTofCARD32(c,buffer,len,p,stored,ofs);
-			continue;
-		 case ft_LISTofCARD64:
-			lastofs = printLISTofCARD64(c,buffer,len,p,stored,ofs);
-			continue;
-		 case ft_LISTofATOM:
-			lastofs = printLISTofATOM(c,buffer,len,p,stored,ofs);
-			continue;
-		 case ft_LISTofUINT8:
-			lastofs = printLISTofUINT8(buffer,len,p,stored,ofs);
-			continue;
-		 case ft_LISTofUINT16:
-			lastofs = printLISTofUINT16(c,buffer,len,p,stored,ofs);
-			continue;
-		 case ft_LISTofUINT32:
-			lastofs = printLISTofUINT32(c,buffer,len,p,stored,ofs);
-			continue;
-		 case ft_LISTofINT8:
-			lastofs = printLISTofINT8(buffer,len,p,stored,ofs);
-			continue;
-		 case ft_LISTofINT16:
-			lastofs = printLISTofINT16(c,buffer,len,p,stored,ofs);
-			continue;
-		 case ft_LISTofINT32:
-			lastofs = printLISTofINT32(c,buffer,len,p,stored,ofs);
-			continue;
-		 case ft_LISTofFormat:
-			switch( format ) {
-			 case 8:
-				lastofs = printLISTofCARD8(buffer, len,
-						p->name, p->o.constants,
-						stored, ofs);
-				break;
-			 case 16:
-				lastofs = printLISTofCARD16(c,buffer,len,p,stored,ofs);
-				break;
-			 case 32:
-				lastofs = printLISTofCARD32(c,buffer,len,p,stored,ofs);
-				break;
-			 default:
-				lastofs = ofs;
-				break;
-			}
-			continue;
-		 case ft_Struct:
-			printLISTofStruct(c,buffer,len,p,1,ofs,&newstack);
-			continue;
-		 case ft_LISTofStruct:
-			lastofs = printLISTofStruct(c,buffer,len,p,stored,ofs,&newstack);
-			continue;
-		 case ft_LISTofVarStruct:
-			lastofs = printLISTofVarStruct(c,buffer,len,p,stored,ofs,&newstack);
-			continue;
-		 case ft_LISTofVALUE:
-			lastofs = printLISTofVALUE(c,buffer,len,p,stored,ofs);
-			continue;
-		 case ft_FIXED:
-			if( ofs + 4 > len )
-				continue;
-			if( print_offsets )
-				fprintf(out,"[%d]",(int)ofs);
-			fputs(p->name,out);putc('=',out);
-			i32 = getCARD32(ofs);
-			d = i32 / 65536.0;
-			fprintf(out,"%.6f", d);
-			continue;
-		 case ft_LISTofFIXED:
-			lastofs = printLISTofFIXED(c,buffer,len,p,stored,ofs);
-			continue;
-		 case ft_FIXED3232:
-			if( ofs + 8 > len )
-				continue;
-			if( print_offsets )
-				fprintf(out, "[%d]", (int)ofs);
-			fputs(p->name, out); putc('=', out);
-			i32 = getCARD32(ofs);
-			u32 = getCARD32(ofs + 4);
-			d = i32 + (u32 / ((double)65536.0 * (double)65536.0));
-			fprintf(out, "%.11f", d);
-			continue;
-		 case ft_LISTofFIXED3232:
-			lastofs = printLISTofFIXED3232(c, buffer, len, p,
-					stored, ofs);
-			continue;
-		 case ft_FLOAT32:
-			if( ofs + 4 > len )
-				continue;
-			if( print_offsets )
-				fprintf(out,"[%d]",(int)ofs);
-			fputs(p->name,out);putc('=',out);
-			/* how exactly is this float transfered? */
-			u32 = getCARD32(ofs);
-			memcpy(&f, &u32, 4);
-			fprintf(out,"%f", f);
-			continue;
-		 case ft_LISTofFLOAT32:
-			lastofs = printLISTofFLOAT32(c,buffer,len,p,stored,ofs);
-			continue;
-		 case ft_FRACTION16_16:
-			if( ofs + 4 > len )
-				continue;
-			if( print_offsets )
-				fprintf(out,"[%d]",(int)ofs);
-			fputs(p->name,out);putc('=',out);
-			i16 = getCARD16(ofs);
-			u16 = getCARD16(ofs + 2);
-			fprintf(out,"%hd/%hu", i16, u16);
-			continue;
-		 case ft_FRACTION32_32:
-			if( ofs + 8 > len )
-				continue;
-			if( print_offsets )
-				fprintf(out,"[%d]",(int)ofs);
-			fputs(p->name,out);putc('=',out);
-			i32 = getCARD32(ofs);
-			u32 = getCARD32(ofs + 4);
-			fprintf(out,"%d/%u", i32, u32);
-			continue;
-		 case ft_UFRACTION32_32:
-			if( ofs + 8 > len )
-				continue;
-			if( print_offsets )
-				fprintf(out,"[%d]",(int)ofs);
-			fputs(p->name,out);putc('=',out);
-			uu = getCARD32(ofs);
-			u32 = getCARD32(ofs + 4);
-			fprintf(out,"%u/%u", uu, u32);
-			continue;
-		 case ft_INT32_32:
-			if( ofs + 8 > len )
-				continue;
-			if( print_offsets )
-				fprintf(out,"[%d]",(int)ofs);
-			fputs(p->name,out);putc('=',out);
-			i32 = getCARD32(ofs);
-			u32 = getCARD32(ofs + 4);
-			ll = (((long long)i32)<< 32LL) + (long long)u32;
-			fprintf(out, "%lld",  ll);
-			continue;
-		 case ft_EVENT:
-			if( len >= ofs + 32 )
-				print_event(c, buffer + ofs, len - ofs);
-			// TODO: do something with the size here?
-			continue;
-		 case ft_ATOM:
-			if( ofs + 4 > len )
-				continue;
-			if( print_offsets )
-				fprintf(out,"[%d]",(int)ofs);
-			fputs(p->name,out);putc('=',out);
-			u32 = getCARD32(ofs);
-			value = findConstant(p->o.constants, u32);
-			atom = getAtom(c, u32);
-			if( value != NULL )
-				fprintf(out,"%s(0x%x)",value, (unsigned int)u32);
-			else if( atom == NULL )
-				fprintf(out,"0x%x(unrecognized atom)",(unsigned int)u32);
-			else
-				fprintf(out,"0x%x(\"%s\")",(unsigned int)u32, atom);
-			continue;
-		 case ft_BE32:
-			if( ofs + 4 > len )
-				continue;
-			fputs(p->name,out);putc('=',out);
-			fprintf(out,"0x%08x",(unsigned int)getBE32(ofs));
-			continue;
-		 case ft_GET:
-			stored = getFromStack(&newstack,p->offse);
-			printspace = false;
-			continue;
-		 case ft_DECREMENT_STORED:
-			if( stored < p->offse )
-				stored = 0;
-			else
-				stored -= p->offse;
-			printspace = false;
-			continue;
-		 case ft_DIVIDE_STORED:
-			if (stored % p->offse)
-				fprintf(stderr, "count (%lu) not divisible by %zu\n", stored, p->offse);
-			stored /= p->offse;
-			printspace = false;
-			continue;
-		 case ft_SET:
-			stored = p->offse;
-			printspace = false;
-			continue;
-		 case ft_CARD64: {
-			uint64_t u64 = getCARD64(ofs);
-			if( print_offsets )
-				fprintf(out,"[%d]",(int)ofs);
-			fputs(p->name, out);
-			putc('=', out);
-			fprintf(out, "0x%016" PRIx64, u64);
-			continue;
-                 }
-		 default:
-			break;
-		}
-		assert( p->type <= ft_BITMASK32);
-
-		switch( p->type % 3) {
-		 case 0:
-			 if( (ofs+1) > len )
-				 /* this field is missing */
-				 continue;
-			 u8 = getCARD8(ofs);
-			 l = u8;
-			 break;
-		 case 1:
-			 if( (ofs+2) > len )
-				 /* this field is missing */
-				 continue;
-			 u16 = getCARD16(ofs);
-			 l = u16;
-			 break;
-		 case 2:
-			 if( (ofs+4) > len )
-				 /* this field is missing */
-				 continue;
-			 u32 = getCARD32(ofs);
-			 l = u32;
-			 break;
-		}
-		if( p->type >= ft_BITMASK8 ) {
-			assert(p->type <= ft_BITMASK32 );
-			print_bitfield(p->name, p->o.constants, l);
-			continue;
-		}
-		if( p->type >= ft_PUSH8 ) {
-			assert(p->type <= ft_PUSH32 );
-			push(&newstack,l);
-			if( !print_counts) {
-				printspace = false;
-				continue;
-			}
-		} else if( p->type >= ft_STORE8 ) {
-			assert(p->type <= ft_STORE32);
-			stored = l;
-			if( !print_counts) {
-				printspace = false;
-				continue;
+/* the same as printLISTofVALUE, without printing anything */
+static size_t values_end(const struct value *v, size_t buflen, unsigned long valuemask, size_t ofs) {
+	while( buflen > ofs && buflen-ofs >= 4 && v->name != 0 ) {
+		if( (valuemask & v->flag) != 0 ) {
+			if( v->type == ft_INT32_32 ) {
+				if( buflen-ofs < 8 )
+					break;
+				ofs += 4;
 			}
+			ofs += 4;
 		}
-		value = findConstant(p->o.constants, l);
-		if( print_offsets )
-			fprintf(out,"[%d]",(int)ofs);
-		fputs(p->name,out);putc('=',out);
-		if( value != NULL ) {
-			fputs(value,out);
-			putc('(',out);
-		}
-		switch( p->type ) {
-		 case ft_INT8:
-			 i8 = u8;
-			 fprintf(out,"%d",(int)i8);
-			 break;
-		 case ft_INT16:
-			 i16 = u16;
-			 fprintf(out,"%d",(int)i16);
-			 break;
-		 case ft_INT32:
-			 i32 = u32;
-			 fprintf(out,"%d",(int)i32);
-			 break;
-		 case ft_PUSH8:
-		 case ft_STORE8:
-		 case ft_UINT8:
-			 fprintf(out,"%u",(unsigned int)u8);
-			 break;
-		 case ft_PUSH16:
-		 case ft_STORE16:
-		 case ft_UINT16:
-			 fprintf(out,"%u",(unsigned int)u16);
-			 break;
-		 case ft_PUSH32:
-		 case ft_STORE32:
-		 case ft_UINT32:
-			 fprintf(out,"%u",(unsigned int)u32);
-			 break;
-		 case ft_ENUM8:
-			 if( value == NULL )
-				 fputs("unknown:",out);
-		 case ft_CARD8:
-			 fprintf(out,"0x%02x",(unsigned int)u8);
-			 break;
-		 case ft_ENUM16:
-			 if( value == NULL )
-				 fputs("unknown:",out);
-		 case ft_CARD16:
-			 fprintf(out,"0x%04x",(unsigned int)u16);
-			 break;
-		 case ft_ENUM32:
-			 if( value == NULL )
-				 fputs("unknown:",out);
-		 case ft_CARD32:
-			 fprintf(out,"0x%08x",(unsigned int)u32);
-			 break;
-		 case ft_BITMASK8:
-		 case ft_BITMASK16:
-		 case ft_BITMASK32:
-		 case ft_STRING8:
-		 case ft_FORMAT8:
-		 case ft_LISTofCARD8:
-		 case ft_LISTofCARD16:
-		 case ft_LISTofCARD32:
-		 case ft_LISTofCARD64:
-		 case ft_LISTofATOM:
-		 case ft_LISTofUINT8:
-		 case ft_LISTofUINT16:
-		 case ft_LISTofUINT32:
-		 case ft_LISTofINT8:
-		 case ft_LISTofINT16:
-		 case ft_LISTofINT32:
-		 case ft_LISTofFormat:
-		 case ft_LISTofVALUE:
-		 case ft_Struct:
-		 case ft_LISTofStruct:
-		 case ft_LISTofVarStruct:
-		 case ft_IF8:
-		 case ft_IF16:
-		 case ft_IF32:
-		 case ft_IFATOM:
-		 case ft_BE32:
-		 case ft_ATOM:
-		 case ft_LASTMARKER:
-		 case ft_SET_SIZE:
-		 case ft_GET:
-		 case ft_DECREMENT_STORED:
-		 case ft_DIVIDE_STORED:
-		 case ft_SET:
-		 case ft_EVENT:
-		 case ft_FRACTION16_16:
-		 case ft_FRACTION32_32:
-		 case ft_UFRACTION32_32:
-		 case ft_INT32_32:
-		 case ft_FIXED:
-		 case ft_LISTofFIXED:
-		 case ft_FIXED3232:
-		 case ft_LISTofFIXED3232:
-		 case ft_FLOAT32:
-		 case ft_LISTofFLOAT32:
-		 case ft_CARD64:
-			 assert(0);
-		}
-		if( value != NULL ) {
-			putc(')',out);
-		}
+		v++;
 	}
-	if( returnstack )
-		*oldstack = newstack;
-	else
-		pop(&newstack,oldstack);
-	if( sizeset ) {
-		if( lastofs < len ) {
-			if( printspace )
-				putc(' ', out);
-			lastofs = printLISTofCARD8(buffer, len,
-					"unexpected-data", NULL,
-					len - lastofs, lastofs);
-			assert( lastofs == len );
-		} else if( lastofs > len ) {
-			fprintf(out, "[strange: size-len=%d]",
-					(int)(lastofs-len));
-		}
-		return len;
-	} else
-		return lastofs;
+	return ofs;
+}
+
+#undef BYTEORDER
+#define BYTEORDER false
+#define DECODER(name) name ## _lsb
+#include "printparams.h"
+#undef BYTEORDER
+#undef DECODER
+#define BYTEORDER true
+#define DECODER(name) name ## _msb
+#include "printparams.h"
+#undef BYTEORDER
+#undef DECODER
+#define BYTEORDER c->bigendian
+
+/* the decoders for the byte order of a connection, chosen once it
+ * is known (see choose_byteorder) */
+struct byteorder {
+	size_t (*print_parameters)(struct connection *, const unsigned char *, unsigned int, const struct instruction *, bool, struct stack *, bool);
+};
+
+static const struct byteorder byteorders[2] = {
+	{ print_parameters_lsb },
+	{ print_parameters_msb }
+};
+
+static inline void choose_byteorder(struct connection *c) {
+	c->byteorder = &byteorders[c->bigendian];
 }
 
+static inline size_t print_parameters(struct connection *c, const unsigned char *buffer, unsigned int len, const struct instruction *code, bool bigrequest, struct stack *oldstack, bool returnstack) {
+	return c->byteorder->print_parameters(c, buffer, len, code,
+			bigrequest, oldstack, returnstack);
+}
 
 /* replace ra(GrabButton) in requests.inc by ra2(GrabButton)
  * and add this function and all
@@ -1541,6 +936,8 @@ bool requestQueryExtension(struct connection *c, bool pre, bool bigrequest UNUSE
 	len = c->clientignore-8;
 	if( len > clientCARD16(4) )
 		len = clientCARD16(4);
+	if( len > c->clientcount - 8 )
+		len = c->clientcount - 8;
 	reply->data.extension = find_extension(c->clientbuffer+8, len);
 	if( reply->data.extension == NULL ) {
 		reply->data_type = dt_UNKNOWN_EXTENSION;
@@ -1561,8 +958,10 @@ bool requestInternAtom(struct connection *c, bool pre, bool bigrequest UNUSED, s
 	len = clientCARD16(4);
 	if( c->clientignore < (unsigned int)8 + len)
 		return false;
+	if( c->clientcount < (unsigned int)8 + len)
+		return false;
 	reply->data_type = dt_ATOM;
-	reply->data.atom = newAtom((const char*)c->clientbuffer+8, len);
+	reply->data.atom = newAtom(c, (const char*)c->clientbuffer+8, len);
 	return false;
 }
 
@@ -1582,11 +981,12 @@ bool requestGetAtomName(struct connection *c, bool pre, bool bigrequest UNUSED,
 
 /* Reactions to some replies */
 
-void replyListFontsWithInfo(struct connection *c, bool *ignore, bool *dontremove, struct expectedreply *dummy UNUSED) {
+void replyListFontsWithInfo(struct connection *c, bool *ignore, bool *dontremove, struct expectedreply *d) {
 	unsigned int seq = serverCARD16(2);
 	if( serverCARD8(1) == 0 ) {
 
-		startline(c, TO_CLIENT, "%04x:%u: Reply to ListFontsWithInfo: end of list\n", seq, c->serverignore);
+		if( d->show )
+			startline(c, TO_CLIENT, "%04x:%u: Reply to ListFontsWithInfo: end of list\n", seq, c->serverignore);
 		*ignore = true;
 	} else
 		*dontremove = true;
@@ -1609,6 +1009,8 @@ void replyQueryExtension(struct connection *c, bool *ignore UNUSED, bool *dontre
 			n->major_opcode = serverCARD8(9);
 			n->first_event = serverCARD8(10);
 			n->first_error = serverCARD8(11);
+			get_extensiontables(c)->unknownopcodes[n->major_opcode]
+				= n->name;
 		}
 	}
 	if( d->data_type == dt_EXTENSION && d->data.extension != NULL ) {
@@ -1622,6 +1024,7 @@ void replyQueryExtension(struct connection *c, bool *ignore UNUSED, bool *dontre
 		u->first_event = serverCARD8(10);
 		u->first_error = serverCARD8(11);
 		c->usedextensions = u;
+		register_used_extension(c, u);
 	}
 	if( denyallextensions ) {
 		/* disable all extensions */
@@ -1635,16 +1038,18 @@ void replyInternAtom(struct connection *c, bool *ignore UNUSED, bool *dontremove
 		return;
 	atom = serverCARD32(8);
 	internAtom(c, atom, d->data.atom);
+	d->data.atom = NULL;
 }
 
 void replyGetAtomName(struct connection *c, bool *ignore UNUSED, bool *dontremove UNUSED, struct expectedreply *d) {
-	struct atom *atom;
 	uint16_t len;
 	if( d->data_type != dt_CARD32 || d->data.card32 == 0 )
 		return;
 	len = serverCARD16(8);
-	atom = newAtom((const char *)c->serverbuffer+32, len);
-	internAtom(c, d->data.card32, atom);
+	if( c->servercount < (unsigned int)32 + len )
+		return;
+	rememberAtom(c, d->data.card32,
+			(const char *)c->serverbuffer+32, len);
 }
 
 #define ft_COUNT8 ft_STORE8
@@ -1655,37 +1060,22 @@ void replyGetAtomName(struct connection *c, bool *ignore UNUSED, bool *dontremov
 
 const struct request *requests;
 size_t num_requests;
-const struct parameter *unexpected_reply;
-
-static inline void free_expectedreplylist(struct expectedreply *r) {
-
-	while( r != NULL ) {
-		struct expectedreply *n = r->next;
-		free(r);
-		r = n;
-	}
-}
+const struct instruction *unexpected_reply;
+const char *protocol_names;
 
 static inline const struct extension *find_extension_by_opcode(struct connection *c, unsigned char req) {
-	struct usedextension *u;
+	const struct usedextension *u;
 
-	for( u = c->usedextensions; u != NULL ; u = u->next ) {
-		if( req != u->major_opcode )
-			continue;
-		return u->extension;
-	}
-	return NULL;
+	if( c->extensiontables == NULL )
+		return NULL;
+	u = c->extensiontables->opcodes[req];
+	return (u != NULL)?u->extension:NULL;
 }
 
 static inline const char *find_unknown_extension(struct connection *c, unsigned char req) {
-	struct unknownextension *e;
-
-	for( e = c->unknownextensions ; e != NULL ; e = e->next ) {
-		if( req == e->major_opcode ) {
-			return e->name;
-		}
-	}
-	return NULL;
+	if( c->extensiontables == NULL )
+		return NULL;
+	return c->extensiontables->unknownopcodes[req];
 }
 
 static inline const struct request *find_extension_request(struct connection *c,unsigned char req,unsigned char subreq,const char **extension) {
@@ -1706,13 +1096,152 @@ static inline const struct request *find_extension_request(struct connection *c,
 	return NULL;
 }
 
+/* make room for a message of len bytes, unless it is too big anyway
+ * (then only the start of it is decoded, see stream_start) */
+static void buffer_need(struct ringbuffer *b, size_t len) {
+	size_t size;
+
+	if( len <= b->size || len > maxbuffersize )
+		return;
+	size = 2*b->size;
+	if( size < len )
+		size = len;
+	if( size > maxbuffersize )
+		size = maxbuffersize;
+	/* if that fails it stays as it is and the message is truncated */
+	(void)ringbuffer_resize(b, size);
+}
+
+/* make the first len bytes (or all there is, if less) of the current
+ * message (starting at c->clientstart in the client's ring buffer)
+ * available as c->clientbuffer, c->clientcount */
+static inline void client_view(struct connection *c, size_t len) {
+	struct ringbuffer *b = &c->clientring;
+	size_t start = c->clientstart;
+
+	if( len > b->count - start )
+		len = b->count - start;
+	c->clientbuffer = ringbuffer_contiguous(b, start, len);
+	c->clientsplit = c->clientbuffer == NULL;
+	if( c->clientsplit ) {
+		/* no memory to move it, so only the part before the end
+		 * of the buffer is decoded (see client_stuck) */
+		c->clientbuffer = b->data + b->start + start;
+		len = b->size - b->start - start;
+	}
+	c->clientcount = len;
+}
+
+static inline void server_view(struct connection *c, size_t len) {
+	struct ringbuffer *b = &c->serverring;
+	size_t start = c->serverstart;
+
+	if( len > b->count - start )
+		len = b->count - start;
+	c->serverbuffer = ringbuffer_contiguous(b, start, len);
+	c->serversplit = c->serverbuffer == NULL;
+	if( c->serversplit ) {
+		c->serverbuffer = b->data + b->start + start;
+		len = b->size - b->start - start;
+	}
+	c->servercount = len;
+}
+
+/* the current message cannot get any more complete: the ring buffer
+ * is full and there is nothing before it that could be sent on, or it
+ * could not be made contiguous */
+static inline bool client_stuck(const struct connection *c) {
+	return c->clientsplit ||
+		(c->clientstart == 0 && ringbuffer_full(&c->clientring));
+}
+
+static inline bool server_stuck(const struct connection *c) {
+	return c->serversplit ||
+		(c->serverstart == 0 && ringbuffer_full(&c->serverring));
+}
+
+/* The current message does not fit into the buffer, so only its start
+ * is decoded. The rest is sent on in pieces, stream_received notes when
+ * all of it was read (with --checksum-streamed summing it up). */
+static void stream_start(struct streamed *s, size_t len, unsigned int seq) {
+	s->len = len;
+	s->left = len;
+	s->hash = UINT32_C(2166136261);
+	s->seq = seq;
+}
+
+/* Follow a streamed message through what was read since last time.
+ * It is the last decoded message, so it ends where the decoded part
+ * of the ring buffer ends, its s->left bytes not yet seen before that.
+ * Called before anything after it is decoded, so the summary comes
+ * in order, and before the bytes are sent on and gone. */
+static void stream_received(struct connection *c, bool fromserver) {
+	struct streamed *s = fromserver?&c->serverstreamed:&c->clientstreamed;
+	const struct ringbuffer *b = fromserver?&c->serverring:&c->clientring;
+	size_t end = fromserver?c->serverignore:c->clientignore;
+	size_t ofs, len, j;
+	struct iovec iov[2];
+	uint32_t hash;
+	int i, count;
+
+	if( s->left == 0 )
+		return;
+	assert( s->left <= end );
+	ofs = end - s->left;
+	if( b->count <= ofs )
+		return;
+	len = b->count - ofs;
+	if( len > s->left )
+		len = s->left;
+	if( checksum_streamed ) {
+		count = ringbuffer_data(b, iov, ofs + len);
+		hash = s->hash;
+		for( i = 0 ; i < count ; i++ ) {
+			const unsigned char *d = iov[i].iov_base;
+			size_t l = iov[i].iov_len;
+
+			/* skip what is before the new bytes */
+			if( ofs >= l ) {
+				ofs -= l;
+				continue;
+			}
+			for( j = ofs ; j < l ; j++ )
+				hash = (hash ^ d[j]) * UINT32_C(16777619);
+			ofs = 0;
+		}
+		s->hash = hash;
+	}
+	s->left -= len;
+	/* (with --filter the message itself might not be shown) */
+	if( s->left > 0 || filter_active )
+		return;
+	if( checksum_streamed )
+		startline(c, fromserver?TO_CLIENT:TO_SERVER,
+			"%04x:%llu: sent on completely, only the start was decoded (FNV-1a %08" PRIx32 ")\n",
+			s->seq & 0xffff, s->len, s->hash);
+	else
+		startline(c, fromserver?TO_CLIENT:TO_SERVER,
+			"%04x:%llu: sent on completely, only the start was decoded\n",
+			s->seq & 0xffff, s->len);
+}
+
+/* when the current message was read (or sent on, which is the same
+ * but for a few syscalls) */
+static inline uint64_t message_time(const struct connection *c) {
+	if( c->monotonictime != 0 )
+		return c->monotonictime;
+	return stats_clock();
+}
+
 static inline void print_client_request(struct connection *c,bool bigrequest) {
+	struct outbuf *o = &c->output;
 	unsigned char req = clientCARD8(0);
 	unsigned char subreq = clientCARD8(1);
 	const struct request *r;
-	const char *extensionname = "";
-	bool ignore;
+	const char *extensionname = "", *extension = NULL, *name;
+	bool ignore, showreply = false;
 	size_t len;
+	uint64_t start = stats_start();
 	unsigned long stackvalues[30];
 	struct stack stack;
 	stack.base = stackvalues;
@@ -1734,42 +1263,60 @@ static inline void print_client_request(struct connection *c,bool bigrequest) {
 		ignore = false;
 	else
 		ignore = r->request_func(c,true,bigrequest,NULL);
+	name = r->name;
+	if( extensionname[0] != '\0' )
+		extension = extensionname;
+	if( !ignore && !filter_shown(fc_REQUEST, extension, name) )
+		ignore = true;
+	if( r->answers != NULL )
+		showreply = filter_shown(fc_REPLY, extension, name);
 	if( !ignore ) {
-		const char *name;
-
-		name = r->name;
 		if( name == NULL )
 			name = "UNKNOWN";
 		assert( r->parameters != NULL);
-		if( extensionname[0] == '\0' )
-			startline(c, TO_SERVER, "%04x:%3u: Request(%hhu): %s ",
-				(unsigned int)(c->seq),c->clientignore,
-				req, name
-		      );
-		else
-			startline(c, TO_SERVER, "%04x:%3u: %s-Request(%hhu,%hhu): %s ",
-				(unsigned int)(c->seq),
-				c->clientignore,
-				extensionname, req, subreq,
-				name
-		      );
+		print_prefix(c, TO_SERVER);
+		out_xdigits(o, (unsigned int)(c->seq), 4);
+		out_char(o, ':');
+		out_uint_pad(o, c->clientignore, 3, ' ');
+		out_string(o, ": ");
+		if( extension == NULL ) {
+			out_string(o, "Request(");
+			out_uint(o, req);
+		} else {
+			out_string(o, extension);
+			out_string(o, "-Request(");
+			out_uint(o, req);
+			out_char(o, ',');
+			out_uint(o, subreq);
+		}
+		out_string(o, "): ");
+		out_string(o, name);
+		out_char(o, ' ');
 		if( r->parameters != NULL )
 			print_parameters(c, c->clientbuffer, len,
 					r->parameters, bigrequest, &stack, true);
 		if( r->request_func != NULL )
 			(void)r->request_func(c,false,bigrequest,NULL);
-		putc('\n',out);
+		endline(c);
+	} else if( showreply && r->record_variables > 0 ) {
+		/* the reply needs the values stored while printing */
+		size_t mark = o->used;
+
+		print_parameters(c, c->clientbuffer, len,
+				r->parameters, bigrequest, &stack, true);
+		o->used = mark;
 	}
 	if( r->answers != NULL ) {
 		/* register an awaited response */
-		int vc = r->record_variables;;
-		struct expectedreply *a = malloc(sizeof(struct expectedreply)
-				+ vc * sizeof(long));
-		if( a == NULL )
-			abort();
-		a->next = c->expectedreplies;
-		a->seq = c->seq;
+		int vc = r->record_variables;
+		struct expectedreply *a = expect_reply(c, c->seq);
+
 		a->from = r;
+		a->show = showreply;
+		a->major = req;
+		a->minor = (extension != NULL)?subreq:0;
+		a->extension = extension;
+		a->sent = stats_enabled?message_time(c):0;
 		a->data_type = dt_NONE;
 		a->data.data = NULL;
 		while( vc > 0 ) {
@@ -1780,11 +1327,14 @@ static inline void print_client_request(struct connection *c,bool bigrequest) {
 		}
 		if( r->request_func != NULL )
 			(void)r->request_func(c,false,bigrequest,a);
-		c->expectedreplies = a;
 	}
+	if( stats_enabled )
+		stats_count(c, sc_REQUEST, req, (extension != NULL)?subreq:0,
+				extension, r->name, c->clientignore, start);
 }
 
 static inline void print_generic_event(struct connection *c, const unsigned char *buffer, size_t len, const struct event *event) {
+	struct outbuf *o = &c->output;
 	unsigned long stackvalues[30];
 	struct stack stack;
 	stack.base = stackvalues;
@@ -1798,34 +1348,48 @@ static inline void print_generic_event(struct connection *c, const unsigned char
 	if( extension == NULL ) {
 		const char *name = find_unknown_extension(c, opcode);
 		if( name != NULL ) {
-			fprintf(out, "%s(%hhu) ", name, opcode);
+			out_string(o, name);
+			out_char(o, '(');
+			out_uint(o, opcode);
+			out_string(o, ") ");
 		} else {
-			fprintf(out, "unknown extension %hhu ", opcode);
+			out_string(o, "unknown extension ");
+			out_uint(o, opcode);
+			out_char(o, ' ');
 		}
 		print_parameters(c, buffer, len, event->parameters, false,
 				&stack, false);
 		return;
 	}
-	fprintf(out, "%s(%hhu) ", extension->name, opcode);
+	out_string(o, extension->name);
+	out_char(o, '(');
+	out_uint(o, opcode);
+	out_string(o, ") ");
 	if( evtype >= extension->numxgevents
 			|| extension->xgevents[evtype].name == NULL ) {
-		fprintf(out, "unknown(%hu) ", evtype);
+		out_string(o, "unknown(");
+		out_uint(o, evtype);
+		out_string(o, ") ");
 		print_parameters(c, buffer, len,
 				event->parameters, false, &stack, false);
 	} else {
 		const struct event *xgevent = &extension->xgevents[evtype];
-		const struct parameter *parameters = xgevent->parameters;
+		const struct instruction *parameters = xgevent->parameters;
 
 		if( parameters == NULL )
 			parameters = event->parameters;
 
-		fprintf(out, "%s(%hu) ", xgevent->name, evtype);
+		out_string(o, xgevent->name);
+		out_char(o, '(');
+		out_uint(o, evtype);
+		out_string(o, ") ");
 		print_parameters(c, buffer, len, parameters, false,
 				&stack, false);
 	}
 }
 
 static void print_event_data(struct connection *c, const unsigned char *buffer, size_t len, const struct event *event, const char *extension) {
+	struct outbuf *o = &c->output;
 	uint8_t code = getCARD8(0);
 	unsigned long stackvalues[30];
 	struct stack stack;
@@ -1834,18 +1398,22 @@ static void print_event_data(struct connection *c, const unsigned char *buffer,
 	stack.ofs = 0;
 
 	if( (code & 0x80) != 0 )
-		fputs("(generated) ",out);
+		out_string(o, "(generated) ");
 	code &= 0x7F;
 	if( event == NULL ) {
-		fprintf(out, "unknown code %hhu", code);
+		out_string(o, "unknown code ");
+		out_uint(o, code);
 		// TODO: print data as LISTofCARD8 ?
 		return;
 	}
 	if( extension != NULL ) {
-		fputs(extension, out);
-		putc('-', out);
+		out_string(o, extension);
+		out_char(o, '-');
 	}
-	fprintf(out,"%s(%hhu) ", event->name, code);
+	out_string(o, event->name);
+	out_char(o, '(');
+	out_uint(o, code);
+	out_string(o, ") ");
 	switch( event->type ) {
 		case event_normal:
 			print_parameters(c, buffer, len, event->parameters,
@@ -1858,142 +1426,228 @@ static void print_event_data(struct connection *c, const unsigned char *buffer,
 	}
 }
 
+/* the names of an event for --filter and --stats, for generic events
+ * those of the extension and event type, which are returned in *minor */
+static void event_names(struct connection *c, const struct event *event, const char **extension, const char **name, unsigned int *minor) {
+	*name = NULL;
+	*minor = 0;
+	if( event == NULL )
+		return;
+	*name = event->name;
+	if( event->type == event_xge ) {
+		uint8_t opcode = serverCARD8(1);
+		uint16_t evtype = serverCARD16(8);
+		const struct extension *e;
+
+		*minor = (opcode << 16) | evtype;
+		e = find_extension_by_opcode(c, opcode);
+		if( e == NULL )
+			*extension = find_unknown_extension(c, opcode);
+		else {
+			*extension = e->name;
+			if( evtype < e->numxgevents
+			    && e->xgevents[evtype].name != NULL )
+				*name = e->xgevents[evtype].name;
+		}
+	}
+}
+
 static inline void print_server_event(struct connection *c) {
+	struct outbuf *o = &c->output;
 	const struct event *event;
-	const char *name;
+	const char *name, *extension, *eventname = NULL;
+	unsigned int minor = 0;
+	uint64_t start = stats_start();
 
 	event = find_event(c, c->serverbuffer, &name);
 	if( event != NULL && event->type == event_xge) {
-		if( c->servercount < 32 + 4*serverCARD32(4) ) {
+		size_t len = 32 + 4*serverCARD32(4);
+
+		buffer_need(&c->serverring, len);
+		server_view(c, len);
+		if( c->servercount < len && !server_stuck(c) ) {
 			/* wait till fully received */
 			return;
 		}
-		c->serverignore = 32 + 4*serverCARD32(4);
+		c->serverignore = len;
+		if( c->servercount < len )
+			stream_start(&c->serverstreamed, len, serverCARD16(2));
 	} else
 		c->serverignore = 32;
 
-	startline(c, TO_CLIENT, "%04llx: Event ", (unsigned long long)c->seq);
-	print_event_data(c, c->serverbuffer, c->serverignore, event, name);
-	putc('\n',out);
+	extension = name;
+	if( filter_active || stats_enabled )
+		event_names(c, event, &extension, &eventname, &minor);
+	if( !filter_active || filter_match(fc_EVENT, extension, eventname) ) {
+		print_prefix(c, TO_CLIENT);
+		out_xdigits(o, c->seq, 4);
+		out_string(o, ": Event ");
+		print_event_data(c, c->serverbuffer, c->serverignore,
+				event, name);
+		endline(c);
+	}
+	if( stats_enabled )
+		stats_count(c, sc_EVENT, serverCARD8(0) & 0x7F, minor,
+				extension, eventname, c->serverignore, start);
 }
 
 
 static inline void print_server_reply(struct connection *c) {
+	struct outbuf *o = &c->output;
 	unsigned int seq;
-	struct expectedreply *replyto,**lastp;
+	struct expectedreply *replyto;
 	size_t len;
+	uint64_t start = stats_start();
 	unsigned long stackvalues[30];
 	struct stack stack;
 	stack.base = stackvalues;
 	stack.num = 30;
 	stack.ofs = 0;
 
-	c->serverignore = 32 + 4*serverCARD32(4);
-	len = c->serverignore;
-	if( len > c->servercount )
+	len = 32 + 4*serverCARD32(4);
+	buffer_need(&c->serverring, len);
+	server_view(c, len);
+	if( c->servercount < len && !server_stuck(c) )
+		/* wait till fully received */
+		return;
+	c->serverignore = len;
+	if( len > c->servercount ) {
+		stream_start(&c->serverstreamed, len, serverCARD16(2));
 		len = c->servercount;
+	}
 
 	seq = serverCARD16(2);
-	for( lastp = &c->expectedreplies ;
-			(replyto=*lastp) != NULL ; lastp=&replyto->next){
-		if( (replyto->seq & 0xFFFF ) == seq ) {
-			bool ignore = false, dontremove = false;
-
-			assert( replyto->from != NULL);
-			if( replyto->from->reply_func != NULL )
-				replyto->from->reply_func(c, &ignore, &dontremove, replyto);
-
-			if( !ignore ) {
-				const char *name = replyto->from->name;
-				int i;
-
-				if( name == NULL )
-					name = "UNKNOWN";
-				startline(c, TO_CLIENT, "%04x:%u: Reply to %s: ",
-						seq,
-						(unsigned int)c->serverignore,
-						name);
-				for( i = 0;
-				     i < replyto->from->record_variables;
-				     i++ ) {
-					push(&stack, replyto->values[i]);
-				}
-				print_parameters(c, c->serverbuffer, len,
-					replyto->from->answers, false,
-					&stack, false);
-				putc('\n',out);
+	replyto = find_expected_reply(c, seq);
+	if( replyto != NULL ) {
+		bool ignore = false, dontremove = false;
+
+		assert( replyto->from != NULL);
+		if( replyto->from->reply_func != NULL )
+			replyto->from->reply_func(c, &ignore, &dontremove, replyto);
+
+		if( !ignore && replyto->show ) {
+			const char *name = replyto->from->name;
+			int i;
+
+			if( name == NULL )
+				name = "UNKNOWN";
+			print_prefix(c, TO_CLIENT);
+			out_xdigits(o, seq, 4);
+			out_char(o, ':');
+			out_uint(o, c->serverignore);
+			out_string(o, ": Reply to ");
+			out_string(o, name);
+			out_string(o, ": ");
+			for( i = 0;
+			     i < replyto->from->record_variables;
+			     i++ ) {
+				push(&stack, replyto->values[i]);
 			}
-			if( !dontremove ) {
-				*lastp = replyto->next;
-				if( replyto->next != NULL ) {
-					startline(c, TO_CLIENT, " still waiting for reply to seq=%04llx\n", (unsigned long long)replyto->next->seq);
-				}
-				free(replyto);
+			print_parameters(c, c->serverbuffer, len,
+				replyto->from->answers, false,
+				&stack, false);
+			endline(c);
+		}
+		if( stats_enabled ) {
+			stats_count(c, sc_REPLY, replyto->major,
+					replyto->minor,
+					replyto->extension,
+					replyto->from->name,
+					c->serverignore, start);
+			stats_roundtrip(c, replyto->major,
+					replyto->minor,
+					replyto->extension,
+					replyto->from->name,
+					message_time(c) - replyto->sent);
+		}
+		if( !dontremove ) {
+			if( replyto->older != NULL && replyto->show ) {
+				startline(c, TO_CLIENT, " still waiting for reply to seq=%04llx\n", (unsigned long long)replyto->older->seq);
 			}
-			return;
+			forget_expected_reply(c, replyto);
 		}
+		return;
+	}
+	if( filter_shown(fc_REPLY, NULL, NULL) ) {
+		startline(c, TO_CLIENT, "%04x:%u: unexpected Reply: ",
+				seq, (unsigned int)c->serverignore);
+		print_parameters(c, c->serverbuffer, len,
+				unexpected_reply, false, &stack, false);
+		endline(c);
 	}
-	startline(c, TO_CLIENT, "%04x:%u: unexpected Reply: ",
-			seq, (unsigned int)c->serverignore);
-	print_parameters(c, c->serverbuffer, len,
-			unexpected_reply, false, &stack, false);
-	putc('\n',out);
+	if( stats_enabled )
+		stats_count(c, sc_REPLY, 0, 0, NULL, "unexpected",
+				c->serverignore, start);
 }
 
 const char * const *errors;
 size_t num_errors;
 
 static inline void print_server_error(struct connection *c) {
+	struct outbuf *o = &c->output;
 	unsigned int cmd = serverCARD8(1);
-	struct usedextension *u;
-	const char *errorname;
+	const struct usedextension *u;
+	const char *errorname, *extension = NULL;
 	uint16_t seq;
-	struct expectedreply *replyto, **lastp;
+	uint64_t start = stats_start();
+	struct expectedreply *replyto;
 
 	c->serverignore = 32;
 	if( cmd < num_errors )
 		errorname = errors[cmd];
 	else {
 		errorname = "unknown";
-		for( u = c->usedextensions; u != NULL ; u = u->next ) {
-			unsigned int i;
-			if( cmd < u->first_error )
-				continue;
-			i = cmd-u->first_error;
-			if( i >= u->extension->numerrors )
-				continue;
-			errorname = u->extension->errors[i];
-			break;
+		if( c->extensiontables != NULL
+		    && (u = c->extensiontables->errors[cmd]) != NULL ) {
+			errorname = u->extension->errors[cmd - u->first_error];
+			extension = u->extension->name;
 		}
 
 	}
 	seq = (unsigned int)serverCARD16(2);
-	startline(c, TO_CLIENT, "%04x:Error %hhu=%s: major=%u, minor=%u, bad=%u\n",
-			seq,
-			cmd,
-			errorname,
-			(int)serverCARD8(10),
-			(int)serverCARD16(8),
-			(int)serverCARD32(4));
-	/* don't wait for any answer */
-	for( lastp = &c->expectedreplies ;
-			(replyto=*lastp) != NULL ; lastp=&replyto->next){
-		if( (replyto->seq & 0xFFFF ) == seq ) {
-			*lastp = replyto->next;
-			free(replyto);
-			return;
-		}
+	if( filter_shown(fc_ERROR, extension, errorname) ) {
+		print_prefix(c, TO_CLIENT);
+		out_xdigits(o, seq, 4);
+		out_string(o, ":Error ");
+		out_uint(o, (unsigned char)cmd);
+		out_char(o, '=');
+		out_string(o, errorname);
+		out_string(o, ": major=");
+		out_uint(o, serverCARD8(10));
+		out_string(o, ", minor=");
+		out_uint(o, serverCARD16(8));
+		out_string(o, ", bad=");
+		out_uint(o, serverCARD32(4));
+		endline(c);
 	}
+	if( stats_enabled )
+		stats_count(c, sc_ERROR, cmd, 0, extension, errorname,
+				32, start);
+	/* don't wait for any answer */
+	replyto = find_expected_reply(c, seq);
+	if( replyto != NULL )
+		forget_expected_reply(c, replyto);
 }
 
-const struct parameter *setup_parameters;
+const struct instruction *setup_parameters;
 
-void parse_client(struct connection *c) {
+/* only warn about an incomplete request once all before it are sent on
+ * (parse_client looks at it again then), and only once for each, as it
+ * is looked at again for every piece of it read */
+static inline bool waiting_shown(struct connection *c) {
+	if( filter_active || c->clientstart != 0 || c->clientwaited )
+		return false;
+	c->clientwaited = true;
+	return true;
+}
+
+static void parse_client_message(struct connection *c) {
 	size_t l;
 	bool bigrequest;
 
 	switch( c->clientstate ) {
 	 case c_start:
+		 client_view(c, 12);
 		 if( c->clientcount < 12 ) {
 			 return;
 		 }
@@ -2008,69 +1662,115 @@ void parse_client(struct connection *c) {
 			return;
 		 }
 		 l = 12 + padded(clientCARD16(6)) + padded(clientCARD16(8));
+		 buffer_need(&c->clientring, l);
+		 client_view(c, l);
 		 if( c->clientcount < l ) {
 			 /* wait for auth data first */
 			 return;
 		 }
 		 c->clientignore =  l;
-
-		 startline(c, TO_SERVER, " am %s want %d:%d authorising with '%*s' of length %d\n",
-				 c->bigendian?"msb-first":"lsb-first",
-				 (int)clientCARD16(2),
-				 (int)clientCARD16(4),
-				 (int)clientCARD16(6),
-				 &c->clientbuffer[12],
-				 (int)clientCARD16(8));
+		 choose_byteorder(c);
+
+		 if( filter_shown(fc_SETUP, NULL, NULL) )
+			 startline(c, TO_SERVER, " am %s want %d:%d authorising with '%*s' of length %d\n",
+					 c->bigendian?"msb-first":"lsb-first",
+					 (int)clientCARD16(2),
+					 (int)clientCARD16(4),
+					 (int)clientCARD16(6),
+					 &c->clientbuffer[12],
+					 (int)clientCARD16(8));
 		 c->clientstate = c_normal;
 		 return;
 	 case c_normal:
+		 client_view(c, 8);
 		 if( c->clientcount < 4 ) {
-			 startline(c, TO_SERVER, " Warning: Waiting for rest of package (yet only got %u)!\n", c->clientcount);
+			 if( waiting_shown(c) )
+				 startline(c, TO_SERVER, " Warning: Waiting for rest of package (yet only got %u)!\n", c->clientcount);
 			 return;
 		 }
 		 l = 4*clientCARD16(2);
 		 if( l == 0 ) {
 			 if( c->clientcount < 8 ) {
-				 startline(c, TO_SERVER, " Warning: Waiting for rest of package (yet only got %u)!\n", c->clientcount);
+				 if( waiting_shown(c) )
+					 startline(c, TO_SERVER, " Warning: Waiting for rest of package (yet only got %u)!\n", c->clientcount);
 				 return;
 			 }
 			 l = 4*clientCARD32(4);
 			 bigrequest = true;
 		 } else
 			 bigrequest = false;
-		 if( c->clientcount == sizeof(c->clientbuffer) )
-			 startline(c, TO_SERVER, " Warning: buffer filled!\n");
-		 else if( c->clientcount < l ) {
-			 startline(c, TO_SERVER, " Warning: Waiting for rest of package (yet got %u of %u)!\n", c->clientcount,(unsigned int)l);
+		 buffer_need(&c->clientring, l);
+		 client_view(c, l);
+		 /* (if stuck it is streamed, nothing is cut off) */
+		 if( c->clientcount < l && !client_stuck(c) ) {
+			 if( waiting_shown(c) )
+				 startline(c, TO_SERVER, " Warning: Waiting for rest of package (yet got %u of %u)!\n", c->clientcount,(unsigned int)l);
 			 return;
 		 }
 		 c->clientignore = l;
+		 c->clientwaited = false;
 		 print_client_request(c,bigrequest);
+		 if( c->clientcount < l )
+			 stream_start(&c->clientstreamed, l, c->seq);
 		 return;
 	 case c_amlost:
-		 c->clientignore = c->clientcount;
+		 c->clientignore = c->clientring.count - c->clientstart;
 		 return;
 	}
 	assert(false);
 }
 
-void parse_server(struct connection *c) {
+/* Decode all complete messages after the first c->clientignore bytes
+ * (those already decoded but not yet sent on), so that everything
+ * decoded can be sent on at once. With --interactive only one, so
+ * every request can be confirmed on its own. */
+void parse_client(struct connection *c) {
+	unsigned int decoded = c->clientignore;
+
+	stream_received(c, false);
+	/* (a streamed message not yet complete, or --interactive
+	 * waiting for the decoded ones to be sent on) */
+	if( decoded >= c->clientring.count || (decoded > 0 && interactive) )
+		return;
+	do {
+		c->clientstart = decoded;
+		c->clientignore = 0;
+		parse_client_message(c);
+		decoded += c->clientignore;
+	} while( c->clientignore > 0 && !interactive
+			&& decoded < c->clientring.count );
+	c->clientignore = decoded;
+	/* the start of a message streamed from now on */
+	stream_received(c, false);
+}
+
+static void parse_server_message(struct connection *c) {
 	/* additional len in multiple of 4 */
 	unsigned int len,cmd;
 
 	if( c->serverstate == s_amlost ) {
-		c->serverignore = c->servercount;
+		c->serverignore = c->serverring.count - c->serverstart;
 		return;
 	}
+	server_view(c, 32);
 	if( c->servercount < 8 )
 		return;
 	switch( c->serverstate ) {
 	 case s_start:
+		 /* usually already chosen by parse_client */
+		 if( c->byteorder == NULL )
+			 choose_byteorder(c);
 		 len = serverCARD16(6);
+		 buffer_need(&c->serverring, 8+4*len);
+		 server_view(c, 8+4*len);
 		 if( c->servercount/4 < 2+len )
 			 return;
 		 c->serverignore = 8+4*len;
 		 cmd = serverCARD8(0);
+		 if( cmd == 1 )
+			 c->serverstate = s_normal;
+		 if( !filter_shown(fc_SETUP, NULL, NULL) )
+			 return;
 		 switch( cmd ) {
 		  case 0:
 			  startline(c, TO_CLIENT, " Failed, version is %d:%d reason is '%*s'.\n",
@@ -2099,9 +1799,8 @@ void parse_server(struct connection *c) {
 						  c->serverignore,
 						  setup_parameters,
 						  false, &stack, false);
-				  putc('\n',out);
+				  endline(c);
 			  }
-			  c->serverstate = s_normal;
 			  break;
 		 }
 		 return;
@@ -2126,28 +1825,76 @@ void parse_server(struct connection *c) {
 	assert(false);
 }
 
+/* like parse_client (but --interactive only waits for requests) */
+void parse_server(struct connection *c) {
+	unsigned int decoded = c->serverignore;
+
+	stream_received(c, true);
+	if( decoded >= c->serverring.count )
+		return;
+	do {
+		c->serverstart = decoded;
+		c->serverignore = 0;
+		parse_server_message(c);
+		decoded += c->serverignore;
+	} while( c->serverignore > 0 && decoded < c->serverring.count );
+	c->serverignore = decoded;
+	stream_received(c, true);
+}
+
+/* some messages did not reach the parser (see decoder.c),
+ * if cut the last message it got was cut short */
+void parse_skipped(struct connection *c, bool fromserver, bool cut, unsigned int messages, unsigned long long bytes) {
+	struct ringbuffer *b = fromserver?&c->serverring:&c->clientring;
+	unsigned int *ignore = fromserver?&c->serverignore:&c->clientignore;
+
+	if( cut ) {
+		/* the rest of it will not come */
+		if( *ignore > 0 && messages > 0 )
+			messages--;
+		ringbuffer_consume(b, b->count);
+		*ignore = 0;
+		if( fromserver )
+			c->serverstreamed.left = 0;
+		else {
+			c->clientstreamed.left = 0;
+			c->clientwaited = false;
+		}
+	}
+	if( fromserver ) {
+		if( c->serverstate == s_start ) {
+			if( c->byteorder == NULL )
+				choose_byteorder(c);
+			c->serverstate = s_normal;
+		}
+		startline(c, TO_CLIENT, " Warning: decoder fell behind, skipped %u replies or events (%llu bytes)\n", messages, bytes);
+	} else {
+		if( c->clientstate == c_start ) {
+			c->clientstate = c_amlost;
+			c->serverstate = s_amlost;
+		} else if( c->clientstate == c_normal )
+			c->seq += messages;
+		startline(c, TO_SERVER, " Warning: decoder fell behind, skipped %u requests (%llu bytes)\n", messages, bytes);
+	}
+}
+
 const struct event *events;
 size_t num_events;
 
 static const struct event *find_event(struct connection *c, const unsigned char *buffer, const char **extension_name) {
-	struct usedextension *u;
+	const struct usedextension *u;
 	uint8_t code = getCARD8(0);
 
+	*extension_name = NULL;
 	code &= 0x7F;
 	/* first look in extensions, in case we are on an xserver that
 	 * uses some of the new core event codes for extensions */
-	for( u = c->usedextensions ; u != NULL ; u = u->next ) {
-		if( u->first_event == 0)
-			continue;
-		if( code >= u->first_event &&
-				code-u->first_event < u->extension->numevents) {
-			*extension_name = u->extension->name;
-			return u->extension->events +
-				(code - u->first_event);
-		}
+	if( c->extensiontables != NULL
+	    && (u = c->extensiontables->events[code]) != NULL ) {
+		*extension_name = u->extension->name;
+		return u->extension->events + (code - u->first_event);
 	}
 	if( code > 1 || code <= num_events ) {
-		*extension_name = NULL;
 		return &events[code];
 	}
 	return NULL;
@@ -2158,15 +1905,58 @@ static const struct event *find_event(struct connection *c, const unsigned char
 const struct extension *extensions;
 size_t num_extensions;
 
-const struct extension *find_extension(const uint8_t *name,size_t len) {
-	unsigned int i;
+/* extensions by name, with linear probing,
+ * each entry is the index into extensions plus one or 0 if unused */
+static unsigned int *extensionindex;
+static size_t extensionindexmask;
+
+static inline size_t extension_hash(const uint8_t *name, size_t len) {
+	uint32_t h = 2166136261U;
+
+	while( len-- > 0 )
+		h = (h ^ *(name++)) * 16777619U;
+	return h;
+}
+
+/* to be called once extensions is set */
+bool index_extensions(void) {
+	size_t size = 16, i, h;
+
+	while( size < 2 * num_extensions )
+		size *= 2;
+	extensionindex = calloc(size, sizeof(unsigned int));
+	if( extensionindex == NULL ) {
+		fputs("Out of memory!\n", stderr);
+		return false;
+	}
+	extensionindexmask = size - 1;
 	for( i = 0 ; i < num_extensions ; i++ ) {
-		if( len < extensions[i].namelen )
-			continue;
-// TODO: why only compare up the length here?
-		if( strncmp((const char*)extensions[i].name,(const char*)name,len) == 0 )
-			return extensions + i;
+		h = extension_hash((const uint8_t *)extensions[i].name,
+				extensions[i].namelen);
+		while( extensionindex[h & extensionindexmask] != 0 )
+			h++;
+		extensionindex[h & extensionindexmask] = i + 1;
 	}
+	return true;
+}
+
+const struct extension *find_extension(const uint8_t *name,size_t len) {
+	const struct extension *e;
+	const uint8_t *nul;
+	size_t h;
+	unsigned int i;
 
+	if( extensionindex == NULL )
+		return NULL;
+	/* the name may be followed by NUL bytes */
+	nul = memchr(name, '\0', len);
+	if( nul != NULL )
+		len = nul - name;
+	for( h = extension_hash(name, len) ;
+	     (i = extensionindex[h & extensionindexmask]) != 0 ; h++ ) {
+		e = &extensions[i - 1];
+		if( e->namelen == len && memcmp(e->name, name, len) == 0 )
+			return e;
+	}
 	return NULL;
 }
@@ -1,11 +1,24 @@
 #ifndef XTRACE_PARSE_H
 #define XTRACE_PARSE_H
 
+/* Names in constants, values and instructions are the offset in
+ * protocol_names, 0 meaning none. */
+extern const char *protocol_names;
+static inline const char *protocol_name(uint32_t name) {
+	return protocol_names + name;
+}
+
+/* Lists of constants are preceded by a header with the minimum
+ * value and (size<<1)|isdense of a table before that, either indexed
+ * by value - minimum (name 0 if there is no such value) or sorted
+ * by value. */
 struct constant {
-	unsigned long value;
-	const char *name;
+	uint32_t value;
+	/* 0 means end of list */
+	uint32_t name;
 };
 struct event;
+struct expectedreply;
 
 typedef bool request_func(struct connection*, bool, bool, struct expectedreply *);
 typedef void reply_func(struct connection*, bool*, bool*, struct expectedreply *);
@@ -13,17 +26,19 @@ typedef void event_func(struct connection *, const unsigned char *, const struct
 
 struct request {
 	const char *name;
-	const struct parameter *parameters;
-	const struct parameter *answers;
+	/* compiled from the parameter lists, see struct instruction */
+	const struct instruction *parameters;
+	const struct instruction *answers;
 
 	request_func *request_func;
 	reply_func *reply_func;
 	/* stack values to be transfered to the reply code */
 	int record_variables;
 };
+#define MAX_RECORD_VARIABLES 30
 struct event {
 	const char *name;
-	const struct parameter *parameters;
+	const struct instruction *parameters;
 	enum event_type { event_normal = 0, event_xge = 1} type;
 #define event_COUNT 2
 };
@@ -46,6 +61,7 @@ struct parameter {
 	 * applies to. If OFS_LATER it is after the last list item
 	 * in this parameter-list. */
 	size_t offse;
+#define OFS_LATER ((size_t)-1)
 	/* NULL means end of list */
 	const char *name;
 	enum fieldtype {
@@ -147,12 +163,77 @@ struct parameter {
 	} o;
 };
 struct value {
-	unsigned long flag;
-	/* NULL means EndOfValues */
-	const char *name;
-	/* only elementary type (<= ft_BITMASK32 are allowed ), */
-	enum fieldtype type;
 	const struct constant *constants;
+	uint32_t flag;
+	/* 0 means EndOfValues */
+	uint32_t name;
+	/* only elementary type (<= ft_BITMASK32 are allowed ), */
+	uint8_t type;
+};
+
+/* What finalize_everything makes out of a parameter list for
+ * print_parameters: every field (or the next instruction) already
+ * at its offset, IFs comparing with a number and jumping to the
+ * other list's code. */
+enum opcode {
+	/* end of the list */
+	op_END,
+	/* a field of the corresponding fieldtype */
+	op_INT8, op_INT16, op_INT32,
+	op_UINT8, op_UINT16, op_UINT32,
+	op_CARD8, op_CARD16, op_CARD32,
+	op_ENUM8, op_ENUM16, op_ENUM32,
+	op_STORE8, op_STORE16, op_STORE32,
+	op_PUSH8, op_PUSH16, op_PUSH32,
+	op_BITMASK8, op_BITMASK16, op_BITMASK32,
+	op_CARD64, op_ATOM, op_BE32,
+	op_FIXED, op_FIXED3232, op_FLOAT32,
+	op_FRACTION16_16, op_FRACTION32_32, op_UFRACTION32_32,
+	op_INT32_32, op_EVENT,
+	op_STRING8, op_LISTofCARD8, op_LISTofCARD16,
+	op_LISTofCARD32, op_LISTofCARD64, op_LISTofATOM,
+	op_LISTofUINT8, op_LISTofUINT16, op_LISTofUINT32,
+	op_LISTofINT8, op_LISTofINT16, op_LISTofINT32,
+	op_LISTofFIXED, op_LISTofFIXED3232, op_LISTofFLOAT32,
+	op_LISTofFormat, op_LISTofVALUE,
+	op_Struct, op_LISTofStruct, op_LISTofVarStruct,
+	/* continue with o.code if the value is arg
+	 * (or the atom with that name for IFATOM) */
+	op_IF8, op_IF16, op_IF32, op_IFATOM,
+	op_FORMAT8,
+	/* end of the last list is ofs or rounded up to 4 bytes */
+	op_LASTMARKER, op_ROUND,
+	/* size is arg, the stored value or stack value arg,
+	 * multiplied by ofs */
+	op_SET_SIZE, op_SET_SIZE_STORED, op_SET_SIZE_STACK,
+	/* stored value is stack value arg, is decremented by,
+	 * divided by or set to arg */
+	op_GET, op_DECREMENT_STORED, op_DIVIDE_STORED, op_SET,
+	/* the next arg fields are all at fixed offsets before ofs,
+	 * so only need to be checked once */
+	op_RUN
+};
+struct instruction {
+	/* enum opcode */
+	uint8_t op;
+	/* IN_LATER: the field starts after the last list,
+	 * IN_BIG: ofs is after the length, so moves in a big request */
+	uint8_t flags;
+#define IN_LATER 1
+#define IN_BIG 2
+	uint16_t ofs;
+	union {
+		uint32_t name;
+		/* see above, for those without a name */
+		uint32_t arg;
+	};
+	union instruction_option {
+		const struct constant *constants;
+		const struct value *values;
+		/* the fields of Structs (after one op_END with the size
+		 * of an item as arg), where to continue for IFs */
+		const struct instruction *code;
+	} o;
 };
 
 extern const struct request *requests;
@@ -163,8 +244,9 @@ extern const const char * const *errors;
 extern size_t num_errors;
 extern const struct extension *extensions;
 extern size_t num_extensions;
-extern const struct parameter *unexpected_reply;
-extern const struct parameter *setup_parameters;
+bool index_extensions(void);
+extern const struct instruction *unexpected_reply;
+extern const struct instruction *setup_parameters;
 
 /* special handlers, for the SPECIAL requests/events */
 extern request_func requestQueryExtension;
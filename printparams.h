@@ -0,0 +1,1333 @@
+/* Included by parse.c once for each byte order, with BYTEORDER set to
+ * false or true and DECODER(name) appending _lsb or _msb to the names,
+ * so every getCARD16/32/64 in here is a plain load (byte swapped if
+ * needed) without looking at c->bigendian. */
+
+#define printLISTofCARD16 DECODER(printLISTofCARD16)
+#define printLISTofCARD32 DECODER(printLISTofCARD32)
+#define printLISTofCARD64 DECODER(printLISTofCARD64)
+#define printLISTofFIXED DECODER(printLISTofFIXED)
+#define printLISTofFIXED3232 DECODER(printLISTofFIXED3232)
+#define printLISTofFLOAT32 DECODER(printLISTofFLOAT32)
+#define printLISTofATOM DECODER(printLISTofATOM)
+#define printLISTofINT16 DECODER(printLISTofINT16)
+#define printLISTofINT32 DECODER(printLISTofINT32)
+#define printLISTofUINT16 DECODER(printLISTofUINT16)
+#define printLISTofUINT32 DECODER(printLISTofUINT32)
+#define printLISTofVALUE DECODER(printLISTofVALUE)
+#define printLISTofStruct DECODER(printLISTofStruct)
+#define printLISTofVarStruct DECODER(printLISTofVarStruct)
+#define measure_parameters DECODER(measure_parameters)
+#define print_parameters DECODER(print_parameters)
+
+static size_t print_parameters(struct connection *c, const unsigned char *buffer, unsigned int len, const struct instruction *code, bool bigrequest, struct stack *oldstack, bool returnstack);
+static size_t measure_parameters(struct connection *c, const unsigned char *buffer, size_t len, const struct instruction *code, struct stack *oldstack);
+
+static size_t printLISTofCARD16(struct connection *c,const uint8_t *buffer,size_t buflen,const struct instruction *p,size_t len, size_t ofs){
+	struct outbuf *o = &c->output;
+	bool notfirst = false;
+	size_t nr = 0;
+
+	if( buflen < ofs )
+		return ofs;
+	if( (buflen - ofs)/2 <= len )
+		len = (buflen - ofs)/2;
+
+	if( print_offsets )
+		print_offset(o, ofs);
+	print_name(o, protocol_name(p->name));
+	if( p->o.constants == NULL )
+		return printHexList(o, buffer, len, ofs, 2, BYTEORDER);
+	while( len > 0 ) {
+		const char *value;
+		uint16_t u16;
+
+		if( nr == maxshownlistlen ) {
+			out_string(o, ",...");
+			/* the rest only needs to be skipped */
+			ofs += 2*len;
+			break;
+		}
+		if( notfirst )
+			out_char(o, ',');
+		notfirst = true;
+		u16 = getCARD16(ofs);
+		value = findConstant(p->o.constants, u16);
+		if( value ) {
+			out_string(o, value);
+			out_char(o, '(');
+			out_hex(o, u16, 1);
+			out_char(o, ')');
+		} else
+			out_hex(o, u16, 4);
+		len--;ofs+=2;nr++;
+	}
+	out_char(o, ';');
+	return ofs;
+}
+
+static size_t printLISTofCARD32(struct connection *c,const uint8_t *buffer,size_t buflen,const struct instruction *p,size_t len, size_t ofs){
+	struct outbuf *o = &c->output;
+	bool notfirst = false;
+	size_t nr = 0;
+
+	if( buflen < ofs )
+		return ofs;
+	if( (buflen - ofs)/4 <= len )
+		len = (buflen - ofs)/4;
+
+	if( print_offsets )
+		print_offset(o, ofs);
+	print_name(o, protocol_name(p->name));
+	if( p->o.constants == NULL )
+		return printHexList(o, buffer, len, ofs, 4, BYTEORDER);
+	while( len > 0 ) {
+		const char *value;
+		uint32_t u32;
+
+		if( nr == maxshownlistlen ) {
+			out_string(o, ",...");
+			/* the rest only needs to be skipped */
+			ofs += 4*len;
+			break;
+		}
+		if( notfirst )
+			out_char(o, ',');
+		notfirst = true;
+		u32 = getCARD32(ofs);
+		value = findConstant(p->o.constants, u32);
+		if( value ) {
+			out_string(o, value);
+			out_char(o, '(');
+			out_hex(o, u32, 1);
+			out_char(o, ')');
+		} else
+			out_hex(o, u32, 8);
+		len--;ofs+=4;nr++;
+	}
+	out_char(o, ';');
+	return ofs;
+}
+
+static size_t printLISTofCARD64(struct connection *c,const uint8_t *buffer,size_t buflen,const struct instruction *p,size_t len, size_t ofs){
+	struct outbuf *o = &c->output;
+	bool notfirst = false;
+	size_t nr = 0;
+
+	if( buflen < ofs )
+		return ofs;
+	if( (buflen - ofs)/8 <= len )
+		len = (buflen - ofs)/8;
+
+	if( print_offsets )
+		print_offset(o, ofs);
+	print_name(o, protocol_name(p->name));
+	while( len > 0 ) {
+		uint64_t u64;
+
+		if( nr == maxshownlistlen ) {
+			out_string(o, ",...");
+			/* the rest only needs to be skipped */
+			ofs += 8*len;
+			break;
+		}
+		if( notfirst )
+			out_char(o, ',');
+		notfirst = true;
+		u64 = getCARD64(ofs);
+		out_hex(o, u64, 16);
+		len--;ofs+=8;nr++;
+	}
+	out_char(o, ';');
+	return ofs;
+}
+
+static size_t printLISTofFIXED(struct connection *c,const uint8_t *buffer,size_t buflen,const struct instruction *p,size_t len, size_t ofs){
+	struct outbuf *o = &c->output;
+	bool notfirst = false;
+	size_t nr = 0;
+
+	if( buflen < ofs )
+		return ofs;
+	if( (buflen - ofs)/4 <= len )
+		len = (buflen - ofs)/4;
+
+	if( print_offsets )
+		print_offset(o, ofs);
+	print_name(o, protocol_name(p->name));
+	while( len > 0 ) {
+		int32_t i32;
+
+		if( nr == maxshownlistlen ) {
+			out_string(o, ",...");
+			/* the rest only needs to be skipped */
+			ofs += 4*len;
+			break;
+		}
+		if( notfirst )
+			out_char(o, ',');
+		notfirst = true;
+		i32 = getCARD32(ofs);
+		out_fixed(o, i32, 6);
+		len--;ofs+=4;nr++;
+	}
+	out_char(o, ';');
+	return ofs;
+}
+
+static size_t printLISTofFIXED3232(struct connection *c, const uint8_t *buffer, size_t buflen, const struct instruction *p, size_t len, size_t ofs){
+	struct outbuf *o = &c->output;
+	bool notfirst = false;
+	size_t nr = 0;
+
+	if( buflen < ofs )
+		return ofs;
+	if( (buflen - ofs)/8 <= len )
+		len = (buflen - ofs)/8;
+
+	if( print_offsets )
+		print_offset(o, ofs);
+	print_name(o, protocol_name(p->name));
+	while( len > 0 ) {
+		int32_t i32;
+		uint32_t u32;
+		double d;
+
+		if( nr == maxshownlistlen ) {
+			out_string(o, ",...");
+			/* the rest only needs to be skipped */
+			ofs += 8*len;
+			break;
+		}
+		if( notfirst )
+			out_char(o, ',');
+		notfirst = true;
+		i32 = getCARD32(ofs);
+		u32 = getCARD32(ofs + 4);
+		d = i32 + (u32 / ((double)65536.0 * (double)65536.0)) ;
+		out_double(o, 11, d);
+		len--; ofs += 8; nr++;
+	}
+	out_char(o, ';');
+	return ofs;
+}
+
+
+static size_t printLISTofFLOAT32(struct connection *c, const uint8_t *buffer, size_t buflen, const struct instruction *p, size_t len, size_t ofs){
+	struct outbuf *o = &c->output;
+	bool notfirst = false;
+	size_t nr = 0;
+
+	if( buflen < ofs )
+		return ofs;
+	if( (buflen - ofs)/4 <= len )
+		len = (buflen - ofs)/4;
+
+	if( print_offsets )
+		print_offset(o, ofs);
+	print_name(o, protocol_name(p->name));
+	while( len > 0 ) {
+		uint32_t u32;
+		float f;
+
+		if( nr == maxshownlistlen ) {
+			out_string(o, ",...");
+			/* the rest only needs to be skipped */
+			ofs += 4*len;
+			break;
+		}
+		if( notfirst )
+			out_char(o, ',');
+		notfirst = true;
+		u32 = getCARD32(ofs);
+		memcpy(&f, &u32, 4);
+		out_double(o, 6, f);
+		len--;ofs+=4;nr++;
+	}
+	out_char(o, ';');
+	return ofs;
+}
+
+static size_t printLISTofATOM(struct connection *c,const uint8_t *buffer,size_t buflen,const struct instruction *p,size_t len, size_t ofs){
+	struct outbuf *o = &c->output;
+	bool notfirst = false;
+	size_t nr = 0;
+
+	if( buflen < ofs )
+		return ofs;
+	if( (buflen - ofs)/4 <= len )
+		len = (buflen - ofs)/4;
+
+	if( print_offsets )
+		print_offset(o, ofs);
+	print_name(o, protocol_name(p->name));
+	while( len > 0 ) {
+		const char *value;
+		uint32_t u32;
+
+		if( nr == maxshownlistlen ) {
+			out_string(o, ",...");
+			/* the rest only needs to be skipped */
+			ofs += 4*len;
+			break;
+		}
+		if( notfirst )
+			out_char(o, ',');
+		notfirst = true;
+		u32 = getCARD32(ofs);
+		value = findConstant(p->o.constants, u32);
+		if( value ) {
+			out_string(o, value);
+			out_char(o, '(');
+			out_hex(o, u32, 1);
+			out_char(o, ')');
+		} else if( (value = getAtom(c,u32)) == NULL )
+			out_hex(o, u32, 1);
+		else {
+			out_hex(o, u32, 1);
+			out_string(o, "(\"");
+			out_string(o, value);
+			out_string(o, "\")");
+		}
+		len--;ofs+=4;nr++;
+	}
+	out_char(o, ';');
+	return ofs;
+}
+
+static size_t printLISTofINT16(struct connection *c,const uint8_t *buffer,size_t buflen,const struct instruction *p,size_t len, size_t ofs){
+	struct outbuf *o = &c->output;
+	bool notfirst = false;
+	size_t nr = 0;
+
+	if( buflen < ofs )
+		return ofs;
+	if( (buflen - ofs)/2 <= len )
+		len = (buflen - ofs)/2;
+
+	if( print_offsets )
+		print_offset(o, ofs);
+	print_name(o, protocol_name(p->name));
+	while( len > 0 ) {
+		const char *value;
+		int16_t i16;
+
+		if( nr == maxshownlistlen ) {
+			out_string(o, ",...");
+			/* the rest only needs to be skipped */
+			ofs += 2*len;
+			break;
+		}
+		if( notfirst )
+			out_char(o, ',');
+		notfirst = true;
+		i16 = getCARD16(ofs);
+		value = findConstant(p->o.constants, i16);
+		if( value ) {
+			out_string(o, value);
+			out_char(o, '(');
+			out_int(o, i16);
+			out_char(o, ')');
+		} else
+			out_int(o, i16);
+		len--;ofs+=2;nr++;
+	}
+	out_char(o, ';');
+	return ofs;
+}
+
+static size_t printLISTofINT32(struct connection *c,const uint8_t *buffer,size_t buflen,const struct instruction *p,size_t len, size_t ofs){
+	struct outbuf *o = &c->output;
+	bool notfirst = false;
+	size_t nr = 0;
+
+	if( buflen < ofs )
+		return ofs;
+	if( (buflen - ofs)/4 <= len )
+		len = (buflen - ofs)/4;
+
+	if( print_offsets )
+		print_offset(o, ofs);
+	print_name(o, protocol_name(p->name));
+	while( len > 0 ) {
+		const char *value;
+		int32_t i32;
+
+		if( nr == maxshownlistlen ) {
+			out_string(o, ",...");
+			/* the rest only needs to be skipped */
+			ofs += 4*len;
+			break;
+		}
+		if( notfirst )
+			out_char(o, ',');
+		notfirst = true;
+		i32 = getCARD32(ofs);
+		value = findConstant(p->o.constants, i32);
+		if( value ) {
+			out_string(o, value);
+			out_char(o, '(');
+			out_int(o, i32);
+			out_char(o, ')');
+		} else
+			out_int(o, i32);
+		len--;ofs+=4;nr++;
+	}
+	out_char(o, ';');
+	return ofs;
+}
+
+static size_t printLISTofUINT16(struct connection *c,const uint8_t *buffer,size_t buflen,const struct instruction *p,size_t len, size_t ofs){
+	struct outbuf *o = &c->output;
+	bool notfirst = false;
+	size_t nr = 0;
+
+	if( buflen < ofs )
+		return ofs;
+	if( (buflen - ofs)/2 <= len )
+		len = (buflen - ofs)/2;
+
+	if( print_offsets )
+		print_offset(o, ofs);
+	print_name(o, protocol_name(p->name));
+	while( len > 0 ) {
+		const char *value;
+		uint16_t u16;
+
+		if( nr == maxshownlistlen ) {
+			out_string(o, ",...");
+			/* the rest only needs to be skipped */
+			ofs += 2*len;
+			break;
+		}
+		if( notfirst )
+			out_char(o, ',');
+		notfirst = true;
+		u16 = getCARD16(ofs);
+		value = findConstant(p->o.constants, u16);
+		if( value ) {
+			out_string(o, value);
+			out_char(o, '(');
+			out_uint(o, u16);
+			out_char(o, ')');
+		} else
+			out_uint(o, u16);
+		len--;ofs+=2;nr++;
+	}
+	out_char(o, ';');
+	return ofs;
+}
+
+static size_t printLISTofUINT32(struct connection *c,const uint8_t *buffer,size_t buflen,const struct instruction *p,size_t len, size_t ofs){
+	struct outbuf *o = &c->output;
+	bool notfirst = false;
+	size_t nr = 0;
+
+	if( buflen < ofs )
+		return ofs;
+	if( (buflen - ofs)/4 <= len )
+		len = (buflen - ofs)/4;
+
+	if( print_offsets )
+		print_offset(o, ofs);
+	print_name(o, protocol_name(p->name));
+	while( len > 0 ) {
+		const char *value;
+		uint32_t u32;
+
+		if( nr == maxshownlistlen ) {
+			out_string(o, ",...");
+			/* the rest only needs to be skipped */
+			ofs += 4*len;
+			break;
+		}
+		if( notfirst )
+			out_char(o, ',');
+		notfirst = true;
+		u32 = getCARD32(ofs);
+		value = findConstant(p->o.constants, u32);
+		if( value ) {
+			out_string(o, value);
+			out_char(o, '(');
+			out_uint(o, u32);
+			out_char(o, ')');
+		} else
+			out_uint(o, u32);
+		len--;ofs+=4;nr++;
+	}
+	out_char(o, ';');
+	return ofs;
+}
+
+static size_t printLISTofVALUE(struct connection *c,const uint8_t *buffer,size_t buflen,const struct instruction *param,unsigned long valuemask, size_t ofs){
+	struct outbuf *o = &c->output;
+	const struct value *v = param->o.values;
+	const char *atom;
+	bool notfirst = false;
+
+	assert( v != NULL );
+
+	if( ofs > buflen )
+		return ofs;
+	if( print_offsets )
+		print_offset(o, ofs);
+	out_string(o, protocol_name(param->name));
+	out_string(o, "={");
+	while( buflen > ofs && buflen-ofs >= 4 ) {
+		uint32_t u32; uint16_t u16; uint8_t u8;
+		int32_t i32; int16_t i16; int8_t i8;
+		const char *constant;
+
+		if( v->name == 0 ) /* EOV */
+			break;
+		if( (valuemask & v->flag) == 0 ) {
+			v++;
+			continue;
+		}
+		if( notfirst )
+			out_char(o, ' ');
+		notfirst = true;
+		/* this is funny, but that is the protocol... */
+		u32 = getCARD32(ofs); i32 = u32;
+		u16 = u32 & 65535; i16 = u16;
+		u8 = u32 & 255; i8 = u8;
+		if( v->type == ft_INT32_32 ) {
+			long long ll;
+
+			/* XSync suddenly has 64 bit values allowed in
+			 * VALUES... */
+			if( buflen-ofs < 8 )
+				break;
+			u32 = getCARD32(ofs + 4);
+			ll = (((long long)i32)<< 32LL) + (long long)u32;
+			print_name(o, protocol_name(v->name));
+			out_int(o, ll);
+			ofs += 8;v++;
+			continue;
+		}
+		if( v->type >= ft_BITMASK8 ) {
+			assert(v->type <= ft_BITMASK32 );
+			print_bitfield(o, protocol_name(v->name),v->constants,u32);
+			ofs += 4;v++;
+			continue;
+		}
+		assert( v->type < ft_STORE8 || v->type == ft_ATOM );
+		switch( (v->type==ft_ATOM)?2:(v->type % 3) ) {
+		 case 0:
+			constant = findConstant(v->constants,u8);
+			break;
+		 case 1:
+			constant = findConstant(v->constants,u16);
+			break;
+		 default:
+			constant = findConstant(v->constants,u32);
+			break;
+		}
+		print_name(o, protocol_name(v->name));
+		if( constant != NULL ) {
+			out_string(o, constant);
+			out_char(o, '(');
+		}
+		switch( v->type ) {
+		 case ft_INT8:
+			 out_int(o, i8);
+			 break;
+		 case ft_INT16:
+			 out_int(o, i16);
+			 break;
+		 case ft_INT32:
+			 out_int(o, i32);
+			 break;
+		 case ft_UINT8:
+			 out_uint(o, u8);
+			 break;
+		 case ft_UINT16:
+			 out_uint(o, u16);
+			 break;
+		 case ft_UINT32:
+			 out_uint(o, u32);
+			 break;
+		 case ft_ENUM8:
+			 if( constant == NULL )
+				 out_string(o, "unknown:");
+		 case ft_CARD8:
+			 out_hex(o, u8, 2);
+			 break;
+		 case ft_ENUM16:
+			 if( constant == NULL )
+				 out_string(o, "unknown:");
+		 case ft_CARD16:
+			 out_hex(o, u16, 4);
+			 break;
+		 case ft_ATOM:
+			 out_hex(o, u32, 1);
+			 atom = getAtom(c, u32);
+			 if( atom != NULL ) {
+				 out_string(o, "(\"");
+				 out_string(o, atom);
+				 out_string(o, "\")");
+			 }
+			 break;
+		 case ft_ENUM32:
+			 if( constant == NULL )
+				 out_string(o, "unknown:");
+		 case ft_CARD32:
+			 out_hex(o, u32, 8);
+			 break;
+		 default:
+			 assert(0);
+		}
+		if( constant != NULL ) {
+			out_char(o, ')');
+		}
+		ofs += 4; v++;
+	}
+	out_char(o, '}');
+	/* TODO: print error if flags left or v!=EOV? */
+	return ofs;
+}
+
+static size_t printLISTofStruct(struct connection *c,const uint8_t *buffer,size_t buflen,const struct instruction *p,size_t count, size_t ofs, struct stack *stack){
+	struct outbuf *o = &c->output;
+	bool notfirst = false;
+	/* after the length of an item */
+	const struct instruction *substruct = p->o.code + 1;
+	size_t len = p->o.code->arg;
+	size_t nr = 0;
+
+	if( print_offsets )
+		print_offset(o, ofs);
+	print_name(o, protocol_name(p->name));
+	while( buflen > ofs && buflen-ofs >= len && count > 0) {
+
+		if( nr == maxshownlistlen ) {
+			out_string(o, ",...");
+			if( len == 0 )
+				ofs = SIZE_MAX;
+			else {
+				/* the rest only needs to be skipped */
+				if( (buflen - ofs)/len < count )
+					count = (buflen - ofs)/len;
+				ofs += len*count;
+			}
+			break;
+		}
+		if( notfirst )
+			out_char(o, ',');
+		notfirst = true;
+		out_char(o, '{');
+
+		print_parameters(c, buffer+ofs, len, substruct, false,
+				stack, false);
+
+		out_char(o, '}');
+		ofs += len; count--; nr++;
+	}
+	out_char(o, ';');
+	return ofs;
+}
+static size_t printLISTofVarStruct(struct connection *c,const uint8_t *buffer,size_t buflen,const struct instruction *p,size_t count, size_t ofs, struct stack *stack){
+	struct outbuf *o = &c->output;
+	bool notfirst = false;
+//	size_t ofs = (p->offset<0)?lastofs:p->offset;
+	const struct instruction *substruct = p->o.code + 1;
+	/* in this case this is only the minimum value */
+	size_t len = p->o.code->arg;
+	size_t nr = 0;
+
+	if( print_offsets )
+		print_offset(o, ofs);
+	print_name(o, protocol_name(p->name));
+	while( buflen > ofs && buflen-ofs >= len && count > 0) {
+		size_t lentoadd;
+
+		if( nr >= maxshownlistlen ) {
+			out_string(o, ",...");
+			/* the rest is only measured */
+			while( buflen > ofs && buflen-ofs >= len && count > 0) {
+				lentoadd = measure_parameters(c, buffer+ofs,
+						buflen-ofs, substruct, stack);
+				/* (all others would be the same) */
+				if( lentoadd == 0 )
+					break;
+				ofs += lentoadd; count--;
+			}
+			break;
+		}
+		if( notfirst ) {
+			out_char(o, ',');
+			if( print_offsets )
+				print_offset(o, ofs);
+		}
+		notfirst = true;
+		out_char(o, '{');
+
+		lentoadd = print_parameters(c, buffer+ofs, buflen-ofs,
+				substruct, false, stack, false);
+
+		out_char(o, '}');
+		ofs += lentoadd; count--; nr++;
+	}
+	out_char(o, ';');
+	return ofs;
+}
+
+/* What print_parameters would return (for a struct, so never a big
+ * request), without printing anything. Only what is needed to know
+ * where lists end is looked at. */
+static size_t measure_parameters(struct connection *c, const unsigned char *buffer, size_t len, const struct instruction *code, struct stack *oldstack) {
+	const struct instruction *in, *next;
+	unsigned long stored = INT_MAX;
+	unsigned char format = 0;
+	size_t lastofs = 0;
+	struct stack newstack = *oldstack;
+	bool sizeset = false;
+
+	for( next = code ; (in = next++)->op != op_END ; ) {
+		size_t ofs, size;
+#ifdef STUPIDCC
+		unsigned long l = 0;
+#else
+		unsigned long l;
+#endif
+		const char *atomname;
+
+		if( (in->flags & IN_LATER) != 0 )
+			ofs = lastofs;
+		else
+			ofs = in->ofs;
+
+		switch( (enum opcode)in->op ) {
+		 case op_IF8:
+			if( (in->flags & IN_LATER) != 0 )
+				l = stored & 0xFF;
+			else if( ofs < len )
+				l = getCARD8(ofs);
+			else
+				continue;
+			if( l == in->arg )
+				next = in->o.code;
+			continue;
+		 case op_IF16:
+			if( (in->flags & IN_LATER) != 0 )
+				l = stored & 0xFFFF;
+			else if( ofs+1 < len )
+				l = getCARD16(ofs);
+			else
+				continue;
+			if( l == in->arg )
+				next = in->o.code;
+			continue;
+		 case op_IF32:
+			if( (in->flags & IN_LATER) != 0 )
+				l = stored;
+			else if( ofs+3 < len )
+				l = getCARD32(ofs);
+			else
+				continue;
+			if( l == in->arg )
+				next = in->o.code;
+			continue;
+		 case op_IFATOM:
+			if( (in->flags & IN_LATER) != 0 )
+				atomname = getAtom(c, stored);
+			else if( ofs+4 >= len )
+				continue;
+			else
+				atomname = getAtom(c, getCARD32(ofs));
+			if( atomname != NULL &&
+					strcmp(atomname, protocol_name(in->name)) == 0 )
+				next = in->o.code;
+			continue;
+		 case op_STORE8:
+			if( ofs + 1 <= len )
+				stored = getCARD8(ofs);
+			continue;
+		 case op_PUSH8:
+			if( ofs + 1 <= len )
+				push(&newstack, getCARD8(ofs));
+			continue;
+		 case op_STORE16:
+			if( ofs + 2 <= len )
+				stored = getCARD16(ofs);
+			continue;
+		 case op_PUSH16:
+			if( ofs + 2 <= len )
+				push(&newstack, getCARD16(ofs));
+			continue;
+		 case op_STORE32:
+			if( ofs + 4 <= len )
+				stored = getCARD32(ofs);
+			continue;
+		 case op_PUSH32:
+			if( ofs + 4 <= len )
+				push(&newstack, getCARD32(ofs));
+			continue;
+		 case op_LASTMARKER:
+			lastofs = ofs;
+			continue;
+		 case op_ROUND:
+			lastofs = (lastofs+3)& ~3;
+			continue;
+		 case op_SET_SIZE:
+		 case op_SET_SIZE_STORED:
+		 case op_SET_SIZE_STACK:
+			sizeset = true;
+			if( in->op == op_SET_SIZE_STORED )
+				l = stored;
+			else if( in->op == op_SET_SIZE_STACK )
+				l = getFromStack(&newstack, in->arg);
+			else
+				l = in->arg;
+			l *= in->ofs;
+			if( len > l )
+				len = l;
+			continue;
+		 case op_FORMAT8:
+			if( ofs < len )
+				format = getCARD8(ofs);
+			continue;
+		 case op_GET:
+			stored = getFromStack(&newstack, in->arg);
+			continue;
+		 case op_DECREMENT_STORED:
+			if( stored < in->arg )
+				stored = 0;
+			else
+				stored -= in->arg;
+			continue;
+		 case op_DIVIDE_STORED:
+			stored /= in->arg;
+			continue;
+		 case op_SET:
+			stored = in->arg;
+			continue;
+		 case op_STRING8:
+		 case op_LISTofCARD8:
+		 case op_LISTofUINT8:
+		 case op_LISTofINT8:
+			size = 1;
+			break;
+		 case op_LISTofCARD16:
+		 case op_LISTofUINT16:
+		 case op_LISTofINT16:
+			size = 2;
+			break;
+		 case op_LISTofCARD32:
+		 case op_LISTofUINT32:
+		 case op_LISTofINT32:
+		 case op_LISTofATOM:
+		 case op_LISTofFIXED:
+		 case op_LISTofFLOAT32:
+			size = 4;
+			break;
+		 case op_LISTofCARD64:
+		 case op_LISTofFIXED3232:
+			size = 8;
+			break;
+		 case op_LISTofFormat:
+			if( format == 8 || format == 16 || format == 32 )
+				size = format / 8;
+			else {
+				lastofs = ofs;
+				continue;
+			}
+			break;
+		 case op_LISTofStruct:
+			size = in->o.code->arg;
+			if( size == 0 ) {
+				/* like printLISTofStruct, which only gets
+				 * past empty items until it cuts the list */
+				if( len > ofs && stored > maxshownlistlen )
+					lastofs = SIZE_MAX;
+				else
+					lastofs = ofs;
+				continue;
+			}
+			break;
+		 case op_LISTofVarStruct: {
+			size_t min = in->o.code->arg;
+
+			for( l = stored ; len > ofs && len-ofs >= min && l > 0 ; l-- ) {
+				size_t s = measure_parameters(c, buffer+ofs,
+						len-ofs, in->o.code + 1,
+						&newstack);
+				if( s == 0 )
+					break;
+				ofs += s;
+			}
+			lastofs = ofs;
+			continue;
+		 }
+		 case op_LISTofVALUE:
+			lastofs = values_end(in->o.values, len, stored, ofs);
+			continue;
+		 default:
+			/* fields not changing anything */
+			continue;
+		}
+		lastofs = list_end(len, ofs, stored, size);
+	}
+	if( sizeset )
+		return len;
+	else
+		return lastofs;
+}
+
+static size_t print_parameters(struct connection *c, const unsigned char *buffer, unsigned int len, const struct instruction *code, bool bigrequest, struct stack *oldstack, bool returnstack) {
+	struct outbuf *o = &c->output;
+	const struct instruction *in, *next;
+	unsigned long stored = INT_MAX;
+	unsigned char format = 0;
+	bool printspace = false;
+	size_t lastofs = 0;
+	struct stack newstack = *oldstack;
+	bool sizeset = false;
+	/* jump over 32 bit extended length */
+	size_t shift = bigrequest?4:0;
+
+	for( next = code ; (in = next++)->op != op_END ; ) {
+		size_t ofs, s;
+		int16_t i16; int32_t i32;
+		uint16_t u16; uint32_t u32, uu;
+#ifdef STUPIDCC
+		unsigned long l = 0;
+#else
+		unsigned long l;
+#endif
+		const char *atomname;
+		double d;
+		float f;
+		long long ll;
+
+		if( (in->flags & IN_LATER) != 0 )
+			ofs = lastofs;
+		else if( (in->flags & IN_BIG) != 0 )
+			ofs = in->ofs + shift;
+		else
+			ofs = in->ofs;
+
+		/* those do not print anything: */
+		switch( (enum opcode)in->op ) {
+		 case op_IF8:
+			if( (in->flags & IN_LATER) != 0 )
+				l = stored & 0xFF;
+			else if( ofs < len )
+				l = getCARD8(ofs);
+			else
+				continue;
+			if( l == in->arg )
+				next = in->o.code;
+			continue;
+		 case op_IF16:
+			if( (in->flags & IN_LATER) != 0 )
+				l = stored & 0xFFFF;
+			else if( ofs+1 < len )
+				l = getCARD16(ofs);
+			else
+				continue;
+			if( l == in->arg )
+				next = in->o.code;
+			continue;
+		 case op_IF32:
+			if( (in->flags & IN_LATER) != 0 )
+				l = stored;
+			else if( ofs+3 < len )
+				l = getCARD32(ofs);
+			else
+				continue;
+			if( l == in->arg )
+				next = in->o.code;
+			continue;
+		 case op_IFATOM:
+			if( (in->flags & IN_LATER) != 0 )
+				atomname = getAtom(c, stored);
+			else if( ofs+4 >= len )
+				continue;
+			else
+				atomname = getAtom(c, getCARD32(ofs));
+			if( atomname == NULL )
+				continue;
+			if( strcmp(atomname, protocol_name(in->name)) == 0 )
+				next = in->o.code;
+			continue;
+		 case op_RUN:
+			/* if the last field is there, all are */
+			if( ofs > len )
+				continue;
+			for( ; next <= in + in->arg ; next++ ) {
+				ofs = next->ofs;
+				if( (next->flags & IN_BIG) != 0 )
+					ofs += shift;
+				if( printspace )
+					out_char(o, ' ');
+				printspace = true;
+				switch( (enum opcode)next->op ) {
+				 case op_INT8:
+				 case op_UINT8:
+				 case op_CARD8:
+				 case op_ENUM8:
+					print_number(o, next, ofs, getCARD8(ofs));
+					break;
+				 case op_INT16:
+				 case op_UINT16:
+				 case op_CARD16:
+				 case op_ENUM16:
+					print_number(o, next, ofs, getCARD16(ofs));
+					break;
+				 case op_ATOM:
+					print_atom(c, next, ofs, getCARD32(ofs));
+					break;
+				 default:
+					print_number(o, next, ofs, getCARD32(ofs));
+					break;
+				}
+			}
+			continue;
+		 default:
+			break;
+		}
+
+		if( printspace )
+			out_char(o, ' ');
+		printspace = true;
+
+		switch( (enum opcode)in->op ) {
+		 case op_INT8:
+		 case op_UINT8:
+		 case op_CARD8:
+		 case op_ENUM8:
+			if( ofs + 1 > len )
+				/* this field is missing */
+				continue;
+			print_number(o, in, ofs, getCARD8(ofs));
+			continue;
+		 case op_INT16:
+		 case op_UINT16:
+		 case op_CARD16:
+		 case op_ENUM16:
+			if( ofs + 2 > len )
+				continue;
+			print_number(o, in, ofs, getCARD16(ofs));
+			continue;
+		 case op_INT32:
+		 case op_UINT32:
+		 case op_CARD32:
+		 case op_ENUM32:
+			if( ofs + 4 > len )
+				continue;
+			print_number(o, in, ofs, getCARD32(ofs));
+			continue;
+		 case op_STORE8:
+		 case op_PUSH8:
+		 case op_BITMASK8:
+			if( ofs + 1 > len )
+				continue;
+			l = getCARD8(ofs);
+			break;
+		 case op_STORE16:
+		 case op_PUSH16:
+		 case op_BITMASK16:
+			if( ofs + 2 > len )
+				continue;
+			l = getCARD16(ofs);
+			break;
+		 case op_STORE32:
+		 case op_PUSH32:
+		 case op_BITMASK32:
+			if( ofs + 4 > len )
+				continue;
+			l = getCARD32(ofs);
+			break;
+		 case op_LASTMARKER:
+			lastofs = ofs;
+			printspace = false;
+			continue;
+		 case op_ROUND:
+			lastofs = (lastofs+3)& ~3;
+			printspace = false;
+			continue;
+		 case op_SET_SIZE:
+		 case op_SET_SIZE_STORED:
+		 case op_SET_SIZE_STACK:
+			printspace = false;
+			sizeset = true;
+			if( in->op == op_SET_SIZE_STORED )
+				s = stored;
+			else if( in->op == op_SET_SIZE_STACK )
+				s = getFromStack(&newstack, in->arg);
+			else
+				s = in->arg;
+			s *= in->ofs;
+			if( len > s )
+				len = s;
+			continue;
+		 case op_FORMAT8:
+			if( ofs < len )
+				format = getCARD8(ofs);
+			printspace = false;
+			continue;
+		 case op_STRING8:
+			lastofs = printSTRING8(o, buffer,len,in,stored,ofs);
+			continue;
+		 case op_LISTofCARD8:
+			lastofs = printLISTofCARD8(o, buffer, len,
+					protocol_name(in->name), in->o.constants,
+					stored, ofs);
+			continue;
+		 case op_LISTofCARD16:
+			lastofs = printLISTofCARD16(c,buffer,len,in,stored,ofs);
+			continue;
+		 case op_LISTofCARD32:
+			lastofs = printLISTofCARD32(c,buffer,len,in,stored,ofs);
+			continue;
+		 case op_LISTofCARD64:
+			lastofs = printLISTofCARD64(c,buffer,len,in,stored,ofs);
+			continue;
+		 case op_LISTofATOM:
+			lastofs = printLISTofATOM(c,buffer,len,in,stored,ofs);
+			continue;
+		 case op_LISTofUINT8:
+			lastofs = printLISTofUINT8(o, buffer,len,in,stored,ofs);
+			continue;
+		 case op_LISTofUINT16:
+			lastofs = printLISTofUINT16(c,buffer,len,in,stored,ofs);
+			continue;
+		 case op_LISTofUINT32:
+			lastofs = printLISTofUINT32(c,buffer,len,in,stored,ofs);
+			continue;
+		 case op_LISTofINT8:
+			lastofs = printLISTofINT8(o, buffer,len,in,stored,ofs);
+			continue;
+		 case op_LISTofINT16:
+			lastofs = printLISTofINT16(c,buffer,len,in,stored,ofs);
+			continue;
+		 case op_LISTofINT32:
+			lastofs = printLISTofINT32(c,buffer,len,in,stored,ofs);
+			continue;
+		 case op_LISTofFormat:
+			switch( format ) {
+			 case 8:
+				lastofs = printLISTofCARD8(o, buffer, len,
+						protocol_name(in->name), in->o.constants,
+						stored, ofs);
+				break;
+			 case 16:
+				lastofs = printLISTofCARD16(c,buffer,len,in,stored,ofs);
+				break;
+			 case 32:
+				lastofs = printLISTofCARD32(c,buffer,len,in,stored,ofs);
+				break;
+			 default:
+				lastofs = ofs;
+				break;
+			}
+			continue;
+		 case op_Struct:
+			printLISTofStruct(c,buffer,len,in,1,ofs,&newstack);
+			continue;
+		 case op_LISTofStruct:
+			lastofs = printLISTofStruct(c,buffer,len,in,stored,ofs,&newstack);
+			continue;
+		 case op_LISTofVarStruct:
+			lastofs = printLISTofVarStruct(c,buffer,len,in,stored,ofs,&newstack);
+			continue;
+		 case op_LISTofVALUE:
+			lastofs = printLISTofVALUE(c,buffer,len,in,stored,ofs);
+			continue;
+		 case op_FIXED:
+			if( ofs + 4 > len )
+				continue;
+			if( print_offsets )
+				print_offset(o, ofs);
+			print_name(o, protocol_name(in->name));
+			i32 = getCARD32(ofs);
+			out_fixed(o, i32, 6);
+			continue;
+		 case op_LISTofFIXED:
+			lastofs = printLISTofFIXED(c,buffer,len,in,stored,ofs);
+			continue;
+		 case op_FIXED3232:
+			if( ofs + 8 > len )
+				continue;
+			if( print_offsets )
+				print_offset(o, ofs);
+			print_name(o, protocol_name(in->name));
+			i32 = getCARD32(ofs);
+			u32 = getCARD32(ofs + 4);
+			d = i32 + (u32 / ((double)65536.0 * (double)65536.0));
+			out_double(o, 11, d);
+			continue;
+		 case op_LISTofFIXED3232:
+			lastofs = printLISTofFIXED3232(c, buffer, len, in,
+					stored, ofs);
+			continue;
+		 case op_FLOAT32:
+			if( ofs + 4 > len )
+				continue;
+			if( print_offsets )
+				print_offset(o, ofs);
+			print_name(o, protocol_name(in->name));
+			/* how exactly is this float transfered? */
+			u32 = getCARD32(ofs);
+			memcpy(&f, &u32, 4);
+			out_double(o, 6, f);
+			continue;
+		 case op_LISTofFLOAT32:
+			lastofs = printLISTofFLOAT32(c,buffer,len,in,stored,ofs);
+			continue;
+		 case op_FRACTION16_16:
+			if( ofs + 4 > len )
+				continue;
+			if( print_offsets )
+				print_offset(o, ofs);
+			print_name(o, protocol_name(in->name));
+			i16 = getCARD16(ofs);
+			u16 = getCARD16(ofs + 2);
+			out_int(o, i16);
+			out_char(o, '/');
+			out_uint(o, u16);
+			continue;
+		 case op_FRACTION32_32:
+			if( ofs + 8 > len )
+				continue;
+			if( print_offsets )
+				print_offset(o, ofs);
+			print_name(o, protocol_name(in->name));
+			i32 = getCARD32(ofs);
+			u32 = getCARD32(ofs + 4);
+			out_int(o, i32);
+			out_char(o, '/');
+			out_uint(o, u32);
+			continue;
+		 case op_UFRACTION32_32:
+			if( ofs + 8 > len )
+				continue;
+			if( print_offsets )
+				print_offset(o, ofs);
+			print_name(o, protocol_name(in->name));
+			uu = getCARD32(ofs);
+			u32 = getCARD32(ofs + 4);
+			out_uint(o, uu);
+			out_char(o, '/');
+			out_uint(o, u32);
+			continue;
+		 case op_INT32_32:
+			if( ofs + 8 > len )
+				continue;
+			if( print_offsets )
+				print_offset(o, ofs);
+			print_name(o, protocol_name(in->name));
+			i32 = getCARD32(ofs);
+			u32 = getCARD32(ofs + 4);
+			ll = (((long long)i32)<< 32LL) + (long long)u32;
+			out_int(o, ll);
+			continue;
+		 case op_EVENT:
+			if( len >= ofs + 32 )
+				print_event(c, buffer + ofs, len - ofs);
+			// TODO: do something with the size here?
+			continue;
+		 case op_ATOM:
+			if( ofs + 4 > len )
+				continue;
+			print_atom(c, in, ofs, getCARD32(ofs));
+			continue;
+		 case op_BE32:
+			if( ofs + 4 > len )
+				continue;
+			print_name(o, protocol_name(in->name));
+			out_hex(o, getBE32(ofs), 8);
+			continue;
+		 case op_GET:
+			stored = getFromStack(&newstack, in->arg);
+			printspace = false;
+			continue;
+		 case op_DECREMENT_STORED:
+			if( stored < in->arg )
+				stored = 0;
+			else
+				stored -= in->arg;
+			printspace = false;
+			continue;
+		 case op_DIVIDE_STORED:
+			if (stored % in->arg)
+				fprintf(stderr, "count (%lu) not divisible by %lu\n", stored, (unsigned long)in->arg);
+			stored /= in->arg;
+			printspace = false;
+			continue;
+		 case op_SET:
+			stored = in->arg;
+			printspace = false;
+			continue;
+		 case op_CARD64: {
+			uint64_t u64 = getCARD64(ofs);
+			if( print_offsets )
+				print_offset(o, ofs);
+			print_name(o, protocol_name(in->name));
+			out_hex(o, u64, 16);
+			continue;
+                 }
+		 case op_END:
+		 case op_IF8:
+		 case op_IF16:
+		 case op_IF32:
+		 case op_IFATOM:
+		 case op_RUN:
+		 default:
+			 assert(0);
+			 continue;
+		}
+		/* STORE, PUSH and BITMASK */
+		if( in->op >= op_BITMASK8 ) {
+			print_bitfield(o, protocol_name(in->name), in->o.constants, l);
+			continue;
+		}
+		if( in->op >= op_PUSH8 )
+			push(&newstack,l);
+		else
+			stored = l;
+		if( !print_counts) {
+			printspace = false;
+			continue;
+		}
+		print_number(o, in, ofs, l);
+	}
+	if( returnstack )
+		*oldstack = newstack;
+	else
+		pop(&newstack,oldstack);
+	if( sizeset ) {
+		if( lastofs < len ) {
+			if( printspace )
+				out_char(o, ' ');
+			lastofs = printLISTofCARD8(o, buffer, len,
+					"unexpected-data", NULL,
+					len - lastofs, lastofs);
+			assert( lastofs == len );
+		} else if( lastofs > len ) {
+			out_string(o, "[strange: size-len=");
+			out_uint(o, lastofs-len);
+			out_char(o, ']');
+		}
+		return len;
+	} else
+		return lastofs;
+}
+
+#undef printLISTofCARD16
+#undef printLISTofCARD32
+#undef printLISTofCARD64
+#undef printLISTofFIXED
+#undef printLISTofFIXED3232
+#undef printLISTofFLOAT32
+#undef printLISTofATOM
+#undef printLISTofINT16
+#undef printLISTofINT32
+#undef printLISTofUINT16
+#undef printLISTofUINT32
+#undef printLISTofVALUE
+#undef printLISTofStruct
+#undef printLISTofVarStruct
+#undef measure_parameters
+#undef print_parameters
@@ -0,0 +1,613 @@
+/*  This file is part of "xtrace"
+ *  Copyright (C) 2026 Bernhard R. Link
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <config.h>
+
+#include <errno.h>
+#include <stdbool.h>
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <sys/types.h>
+
+#include "xtrace.h"
+#include "decoder.h"
+#include "capture.h"
+#include "replay.h"
+#include "stats.h"
+
+/* Decode a file written with --capture, feeding the data of each
+ * connection into the parser as if it was just read. */
+
+static inline uint32_t get32(const unsigned char *p) {
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static inline uint64_t get64(const unsigned char *p) {
+	return get32(p) | ((uint64_t)get32(p + 4) << 32);
+}
+
+/* what is known about a connection with that id */
+struct replayslot {
+	struct connection *c;
+	/* closed or replaced while decoding in parallel,
+	 * chained by ->next, to be freed afterwards */
+	struct connection *closed;
+	/* its last record in the current window */
+	size_t last;
+};
+
+struct replay {
+	const char *filename;
+	FILE *f;
+	/* to get from monotonic to wall clock time */
+	uint64_t wallbase, monobase;
+	unsigned char *data;
+	size_t datasize;
+	struct replayslot *slots;
+	size_t numslots;
+	bool failed;
+};
+
+static bool replay_header(struct replay *r) {
+	unsigned char header[CAPTURE_HEADER_SIZE];
+
+	if( fread(header, CAPTURE_HEADER_SIZE, 1, r->f) != 1 ||
+	    memcmp(header, CAPTURE_MAGIC, sizeof(CAPTURE_MAGIC)) != 0 ) {
+		fprintf(stderr, "%s is not a capture file!\n", r->filename);
+		return false;
+	}
+	if( get32(header + 16) != CAPTURE_VERSION ) {
+		fprintf(stderr, "%s has unsupported format version %u!\n",
+				r->filename, (unsigned int)get32(header + 16));
+		return false;
+	}
+	r->wallbase = get64(header + 24);
+	r->monobase = get64(header + 32);
+	return true;
+}
+
+static struct replayslot *replay_slot(struct replay *r, uint32_t id) {
+	if( id >= r->numslots ) {
+		size_t i, n = r->numslots * 2;
+		struct replayslot *s;
+
+		if( n <= id )
+			n = id + 16;
+		s = realloc(r->slots, n * sizeof(struct replayslot));
+		if( s == NULL ) {
+			fputs("Out of memory!\n", stderr);
+			return NULL;
+		}
+		for( i = r->numslots ; i < n ; i++ ) {
+			s[i].c = NULL;
+			s[i].closed = NULL;
+			s[i].last = SIZE_MAX;
+		}
+		r->slots = s;
+		r->numslots = n;
+	}
+	return &r->slots[id];
+}
+
+/* free what replay_record parked, oldest first like without --jobs */
+static void replay_free_closed(struct replayslot *s) {
+	struct connection *c, *oldest = NULL;
+
+	/* the list is newest first */
+	while( s->closed != NULL ) {
+		c = s->closed;
+		s->closed = c->next;
+		c->next = oldest;
+		oldest = c;
+	}
+	while( oldest != NULL ) {
+		c = oldest;
+		oldest = c->next;
+		decode_connection_free(c);
+	}
+}
+
+/* read the next record, returns false at the end or on errors */
+static bool replay_read(struct replay *r, unsigned char *header, unsigned char **data, size_t *datasize) {
+	size_t len;
+
+	if( fread(header, CAPTURE_RECORD_SIZE, 1, r->f) != 1 ) {
+		if( ferror(r->f) ) {
+			int e = errno;
+			fprintf(stderr, "Error reading %s: %s\n",
+					r->filename, strerror(e));
+			r->failed = true;
+		}
+		return false;
+	}
+	len = get32(header + 16);
+	if( len > *datasize ) {
+		unsigned char *n = realloc(*data, len);
+		if( n == NULL ) {
+			fputs("Out of memory!\n", stderr);
+			r->failed = true;
+			return false;
+		}
+		*data = n;
+		*datasize = len;
+	}
+	if( len > 0 && fread(*data, len, 1, r->f) != 1 ) {
+		fprintf(stderr, "%s is truncated!\n", r->filename);
+		r->failed = true;
+		return false;
+	}
+	return true;
+}
+
+static bool replay_record(struct replay *r, uint32_t id, enum capture_type type, uint64_t time, const unsigned char *data, size_t len) {
+	struct replayslot *s;
+	struct connection *c;
+	uint64_t walltime = r->wallbase + (time - r->monobase);
+	char *from;
+
+	s = replay_slot(r, id);
+	if( s == NULL )
+		return false;
+	c = s->c;
+	switch( type ) {
+		case ct_CONNECT:
+			/* the id is reused, freeing would merge the atoms */
+			if( c != NULL && atoms_deferred ) {
+				c->next = s->closed;
+				s->closed = c;
+			} else if( c != NULL )
+				decode_connection_free(c);
+			from = strndup((const char *)data, len);
+			if( from == NULL ) {
+				fputs("Out of memory!\n", stderr);
+				return false;
+			}
+			c = decode_connection_new(id, from,
+					walltime / 1000000);
+			free(from);
+			s->c = c;
+			return c != NULL;
+		case ct_CLIENT:
+		case ct_SERVER:
+			if( c == NULL ) {
+				fprintf(stderr, "%s: data for unknown connection %u!\n",
+						r->filename, (unsigned int)id);
+				return false;
+			}
+			c->walltime = walltime;
+			c->monotonictime = time;
+			decode_data(c, type == ct_SERVER, data, len);
+			return true;
+		case ct_CLOSE:
+			/* printed here to keep the order with --jobs */
+			if( c != NULL )
+				stats_connection_done(c);
+			if( c != NULL && atoms_deferred ) {
+				c->next = s->closed;
+				s->closed = c;
+			} else if( c != NULL )
+				decode_connection_free(c);
+			s->c = NULL;
+			return true;
+	}
+	fprintf(stderr, "%s: unknown record type %u!\n",
+			r->filename, (unsigned int)type);
+	return false;
+}
+
+/* SIGUSR1 with --stats */
+static void replay_stats(struct replay *r) {
+	struct stats *s;
+	size_t i;
+
+	stats_requested = false;
+	s = stats_report_begin();
+	for( i = 0 ; i < r->numslots ; i++ ) {
+		if( r->slots[i].c != NULL )
+			stats_report_add(s, r->slots[i].c);
+	}
+	stats_report_print(s);
+}
+
+static bool replay_sequential(struct replay *r) {
+	unsigned char header[CAPTURE_RECORD_SIZE];
+
+	while( replay_read(r, header, &r->data, &r->datasize) ) {
+		if( !replay_record(r, get32(header), header[4],
+				get64(header + 8), r->data, get32(header + 16)) )
+			return false;
+		if( stats_requested )
+			replay_stats(r);
+	}
+	return !r->failed;
+}
+
+#ifdef HAVE_PTHREAD
+
+/* With --jobs the capture is read in windows of some megabytes.
+ * The records of each connection within a window are one task. The
+ * tasks are spread over the workers, which steal from each other when
+ * out of work, each writing into its own buffer. Afterwards those are
+ * written out in the order of the records, so the output is the same
+ * as without --jobs, except that atoms learned by one connection are
+ * only known to the others from the next window on. */
+
+#define WINDOW_SIZE (16*1024*1024)
+#define WINDOW_RECORDS 65536
+
+struct windowrecord {
+	uint32_t id;
+	uint8_t type;
+	uint64_t time;
+	/* data is at window + ofs */
+	size_t ofs, len;
+	/* the next record of the same connection */
+	size_t next;
+	/* where its output is */
+	unsigned int worker;
+	size_t outofs, outlen;
+};
+
+struct window {
+	unsigned char *data;
+	size_t used, size;
+	struct windowrecord *records;
+	size_t numrecords, maxrecords;
+	/* first records of each connection in the window */
+	size_t *tasks;
+	size_t numtasks, maxtasks;
+};
+
+struct worker {
+	pthread_t thread;
+	struct parallelreplay *p;
+	/* own tasks are taken from the end, others steal from the start */
+	pthread_mutex_t lock;
+	size_t *tasks;
+	size_t first, last;
+	FILE *out;
+	char *buffer;
+	size_t size;
+	bool failed;
+};
+
+struct parallelreplay {
+	struct replay *r;
+	struct window w;
+	struct worker *workers;
+	unsigned int numworkers;
+	pthread_mutex_t mutex;
+	pthread_cond_t start, finished;
+	unsigned int generation, running;
+	bool quit;
+};
+
+/* make room for one more element in *array */
+static bool window_add(size_t *n, size_t *max, void **array, size_t elsize) {
+	if( *n >= *max ) {
+		size_t newmax = (*max == 0)?1024:2 * *max;
+		void *a = realloc(*array, newmax * elsize);
+
+		if( a == NULL ) {
+			fputs("Out of memory!\n", stderr);
+			return false;
+		}
+		*array = a;
+		*max = newmax;
+	}
+	return true;
+}
+
+/* read the next records, returns false on errors */
+static bool window_read(struct replay *r, struct window *w) {
+	unsigned char header[CAPTURE_RECORD_SIZE];
+	struct windowrecord *rec;
+	struct replayslot *s;
+	size_t len, i;
+
+	w->used = 0;
+	w->numrecords = 0;
+	w->numtasks = 0;
+	while( w->used < WINDOW_SIZE && w->numrecords < WINDOW_RECORDS ) {
+		if( fread(header, CAPTURE_RECORD_SIZE, 1, r->f) != 1 )
+			break;
+		len = get32(header + 16);
+		if( len > w->size - w->used ) {
+			size_t n = w->size;
+			unsigned char *d;
+
+			while( len > n - w->used )
+				n = (n == 0)?WINDOW_SIZE:2*n;
+			d = realloc(w->data, n);
+			if( d == NULL ) {
+				fputs("Out of memory!\n", stderr);
+				return false;
+			}
+			w->data = d;
+			w->size = n;
+		}
+		if( len > 0 && fread(w->data + w->used, len, 1, r->f) != 1 ) {
+			fprintf(stderr, "%s is truncated!\n", r->filename);
+			return false;
+		}
+		if( !window_add(&w->numrecords, &w->maxrecords,
+				(void **)&w->records, sizeof(struct windowrecord)) )
+			return false;
+		i = w->numrecords++;
+		rec = &w->records[i];
+		rec->id = get32(header);
+		rec->type = header[4];
+		rec->time = get64(header + 8);
+		rec->ofs = w->used;
+		rec->len = len;
+		rec->next = SIZE_MAX;
+		rec->outlen = 0;
+		w->used += len;
+
+		s = replay_slot(r, rec->id);
+		if( s == NULL )
+			return false;
+		if( s->last == SIZE_MAX ) {
+			if( !window_add(&w->numtasks, &w->maxtasks,
+					(void **)&w->tasks, sizeof(size_t)) )
+				return false;
+			w->tasks[w->numtasks++] = i;
+		} else
+			w->records[s->last].next = i;
+		s->last = i;
+	}
+	if( ferror(r->f) ) {
+		int e = errno;
+		fprintf(stderr, "Error reading %s: %s\n", r->filename, strerror(e));
+		return false;
+	}
+	return true;
+}
+
+static size_t worker_nexttask(struct parallelreplay *p, struct worker *w) {
+	size_t task = SIZE_MAX;
+	unsigned int i;
+
+	pthread_mutex_lock(&w->lock);
+	if( w->first < w->last )
+		task = w->tasks[--w->last];
+	pthread_mutex_unlock(&w->lock);
+	for( i = 1 ; task == SIZE_MAX && i < p->numworkers ; i++ ) {
+		struct worker *v = &p->workers[(w - p->workers + i) % p->numworkers];
+
+		pthread_mutex_lock(&v->lock);
+		if( v->first < v->last )
+			task = v->tasks[v->first++];
+		pthread_mutex_unlock(&v->lock);
+	}
+	return task;
+}
+
+static void worker_run(struct parallelreplay *p, struct worker *w, size_t i) {
+	struct windowrecord *rec;
+	size_t before;
+
+	for( ; i != SIZE_MAX ; i = rec->next ) {
+		rec = &p->w.records[i];
+		before = w->size;
+		if( !replay_record(p->r, rec->id, rec->type, rec->time,
+					p->w.data + rec->ofs, rec->len) )
+			w->failed = true;
+		fflush(w->out);
+		rec->worker = w - p->workers;
+		rec->outofs = before;
+		rec->outlen = w->size - before;
+	}
+}
+
+static void *worker_main(void *data) {
+	struct worker *w = data;
+	struct parallelreplay *p = w->p;
+	unsigned int generation = 0;
+	size_t task;
+
+	while( true ) {
+		pthread_mutex_lock(&p->mutex);
+		while( p->generation == generation && !p->quit )
+			pthread_cond_wait(&p->start, &p->mutex);
+		generation = p->generation;
+		if( p->quit ) {
+			pthread_mutex_unlock(&p->mutex);
+			return NULL;
+		}
+		pthread_mutex_unlock(&p->mutex);
+
+		out = w->out;
+		while( (task = worker_nexttask(p, w)) != SIZE_MAX )
+			worker_run(p, w, task);
+
+		pthread_mutex_lock(&p->mutex);
+		if( --p->running == 0 )
+			pthread_cond_signal(&p->finished);
+		pthread_mutex_unlock(&p->mutex);
+	}
+}
+
+/* decode the current window and write the output */
+static bool window_decode(struct parallelreplay *p) {
+	struct window *w = &p->w;
+	struct worker *k;
+	struct replayslot *s;
+	unsigned int i;
+	size_t t;
+	bool ok = true;
+
+	for( i = 0 ; i < p->numworkers ; i++ ) {
+		k = &p->workers[i];
+		k->buffer = NULL;
+		k->size = 0;
+		k->out = open_memstream(&k->buffer, &k->size);
+		if( k->out == NULL ) {
+			fputs("Out of memory!\n", stderr);
+			abort();
+		}
+		k->tasks = realloc(k->tasks, (w->numtasks / p->numworkers + 1) * sizeof(size_t));
+		if( k->tasks == NULL ) {
+			fputs("Out of memory!\n", stderr);
+			abort();
+		}
+		k->first = 0;
+		k->last = 0;
+	}
+	for( t = 0 ; t < w->numtasks ; t++ ) {
+		k = &p->workers[t % p->numworkers];
+		k->tasks[k->last++] = w->tasks[t];
+	}
+
+	atoms_deferred = true;
+	pthread_mutex_lock(&p->mutex);
+	p->running = p->numworkers;
+	p->generation++;
+	pthread_cond_broadcast(&p->start);
+	while( p->running > 0 )
+		pthread_cond_wait(&p->finished, &p->mutex);
+	pthread_mutex_unlock(&p->mutex);
+	atoms_deferred = false;
+
+	for( i = 0 ; i < p->numworkers ; i++ ) {
+		k = &p->workers[i];
+		fclose(k->out);
+		k->out = NULL;
+		if( k->failed )
+			ok = false;
+	}
+	for( t = 0 ; t < w->numrecords ; t++ ) {
+		const struct windowrecord *rec = &w->records[t];
+
+		if( rec->outlen > 0 )
+			fwrite(p->workers[rec->worker].buffer + rec->outofs,
+					1, rec->outlen, out);
+	}
+	for( i = 0 ; i < p->numworkers ; i++ ) {
+		free(p->workers[i].buffer);
+		p->workers[i].buffer = NULL;
+	}
+	/* only now the atoms can be shared */
+	for( t = 0 ; t < w->numtasks ; t++ ) {
+		s = &p->r->slots[w->records[w->tasks[t]].id];
+		/* the replaced ones came first */
+		replay_free_closed(s);
+		if( s->c != NULL )
+			atoms_merge(s->c);
+		s->last = SIZE_MAX;
+	}
+	return ok;
+}
+
+static bool replay_parallel(struct replay *r, unsigned int jobs) {
+	struct parallelreplay p;
+	unsigned int i;
+	bool ok = true;
+	int e;
+
+	memset(&p, 0, sizeof(p));
+	p.r = r;
+	pthread_mutex_init(&p.mutex, NULL);
+	pthread_cond_init(&p.start, NULL);
+	pthread_cond_init(&p.finished, NULL);
+	p.workers = calloc(jobs, sizeof(struct worker));
+	if( p.workers == NULL ) {
+		fputs("Out of memory!\n", stderr);
+		return false;
+	}
+	for( i = 0 ; i < jobs ; i++ ) {
+		p.workers[i].p = &p;
+		pthread_mutex_init(&p.workers[i].lock, NULL);
+		e = pthread_create(&p.workers[i].thread, NULL,
+				worker_main, &p.workers[i]);
+		if( e != 0 ) {
+			fprintf(stderr, "Error starting thread: %s\n",
+					strerror(e));
+			break;
+		}
+		p.numworkers++;
+	}
+	if( p.numworkers == 0 )
+		ok = false;
+	while( ok ) {
+		ok = window_read(r, &p.w);
+		if( p.w.numrecords == 0 )
+			break;
+		if( !window_decode(&p) )
+			ok = false;
+		if( stats_requested )
+			replay_stats(r);
+	}
+
+	pthread_mutex_lock(&p.mutex);
+	p.quit = true;
+	pthread_cond_broadcast(&p.start);
+	pthread_mutex_unlock(&p.mutex);
+	for( i = 0 ; i < p.numworkers ; i++ )
+		pthread_join(p.workers[i].thread, NULL);
+	for( i = 0 ; i < jobs ; i++ ) {
+		pthread_mutex_destroy(&p.workers[i].lock);
+		free(p.workers[i].tasks);
+	}
+	free(p.workers);
+	free(p.w.data);
+	free(p.w.records);
+	free(p.w.tasks);
+	pthread_cond_destroy(&p.start);
+	pthread_cond_destroy(&p.finished);
+	pthread_mutex_destroy(&p.mutex);
+	return ok;
+}
+#endif
+
+int replay_capture(const char *filename, unsigned int jobs) {
+	struct replay r;
+	size_t i;
+	bool ok;
+
+	memset(&r, 0, sizeof(r));
+	r.filename = filename;
+	r.f = fopen(filename, "r");
+	if( r.f == NULL ) {
+		int e = errno;
+		fprintf(stderr, "Error opening %s: %s\n", filename, strerror(e));
+		return EXIT_FAILURE;
+	}
+	if( !replay_header(&r) ) {
+		fclose(r.f);
+		return EXIT_FAILURE;
+	}
+#ifdef HAVE_PTHREAD
+	if( jobs > 1 )
+		ok = replay_parallel(&r, jobs);
+	else
+#endif
+		ok = replay_sequential(&r);
+	fclose(r.f);
+	for( i = 0 ; i < r.numslots ; i++ ) {
+		if( r.slots[i].c != NULL )
+			decode_connection_free(r.slots[i].c);
+		replay_free_closed(&r.slots[i]);
+	}
+	free(r.slots);
+	free(r.data);
+	return ok?EXIT_SUCCESS:EXIT_FAILURE;
+}
@@ -0,0 +1,6 @@
+#ifndef XTRACE_REPLAY_H
+#define XTRACE_REPLAY_H
+
+int replay_capture(const char *filename, unsigned int jobs);
+
+#endif
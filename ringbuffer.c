@@ -0,0 +1,168 @@
+/*  This file is part of "xtrace"
+ *  Copyright (C) 2026 Bernhard R. Link
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <config.h>
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <sys/uio.h>
+
+#include "ringbuffer.h"
+
+bool ringbuffer_init(struct ringbuffer *b, size_t size) {
+	b->data = calloc(1, size);
+	if( b->data == NULL ) {
+		fputs("Out of memory!\n", stderr);
+		return false;
+	}
+	b->size = size;
+	b->start = 0;
+	b->count = 0;
+	b->peak = 0;
+	b->drained = 0;
+	return true;
+}
+
+void ringbuffer_done(struct ringbuffer *b) {
+	free(b->data);
+	b->data = NULL;
+	b->size = 0;
+	b->count = 0;
+}
+
+/* up to two pieces of iov describing the bytes from ofs to ofs+len
+ * (which must be < size) */
+static int ringbuffer_segments(const struct ringbuffer *b, struct iovec *iov, size_t ofs, size_t len) {
+	size_t first;
+
+	if( len == 0 )
+		return 0;
+	if( ofs >= b->size )
+		ofs -= b->size;
+	first = b->size - ofs;
+	iov[0].iov_base = b->data + ofs;
+	if( len <= first ) {
+		iov[0].iov_len = len;
+		return 1;
+	}
+	iov[0].iov_len = first;
+	iov[1].iov_base = b->data;
+	iov[1].iov_len = len - first;
+	return 2;
+}
+
+/* the free space after the data, to read into */
+int ringbuffer_space(const struct ringbuffer *b, struct iovec *iov) {
+	return ringbuffer_segments(b, iov, b->start + b->count,
+			b->size - b->count);
+}
+
+/* the first len bytes of data, to write from */
+int ringbuffer_data(const struct ringbuffer *b, struct iovec *iov, size_t len) {
+	assert( len <= b->count );
+	return ringbuffer_segments(b, iov, b->start, len);
+}
+
+void ringbuffer_added(struct ringbuffer *b, size_t len) {
+	assert( len <= b->size - b->count );
+	b->count += len;
+	if( b->count > b->peak )
+		b->peak = b->count;
+}
+
+void ringbuffer_consume(struct ringbuffer *b, size_t len) {
+	assert( len <= b->count );
+	b->count -= len;
+	if( b->count == 0 )
+		/* so that there is most likely no need to wrap */
+		b->start = 0;
+	else {
+		b->start += len;
+		if( b->start >= b->size )
+			b->start -= b->size;
+	}
+}
+
+/* move the data to the start of a new buffer of the given size */
+bool ringbuffer_resize(struct ringbuffer *b, size_t size) {
+	unsigned char *n;
+	struct iovec iov[2];
+	int i, count;
+	size_t ofs;
+
+	assert( size >= b->count );
+	n = malloc(size);
+	if( n == NULL ) {
+		fputs("Out of memory!\n", stderr);
+		return false;
+	}
+	count = ringbuffer_data(b, iov, b->count);
+	for( i = 0, ofs = 0 ; i < count ; i++ ) {
+		memcpy(n + ofs, iov[i].iov_base, iov[i].iov_len);
+		ofs += iov[i].iov_len;
+	}
+	free(b->data);
+	b->data = n;
+	b->size = size;
+	b->start = 0;
+	return true;
+}
+
+/* return the len bytes of data starting at ofs as one piece.
+ * If they wrap around the end, the data is moved within the buffer
+ * when one of their two pieces fits into the free space, otherwise to
+ * a new buffer. NULL if that fails, the data then stays as it is. */
+unsigned char *ringbuffer_contiguous(struct ringbuffer *b, size_t ofs, size_t len) {
+	size_t pos, atend, wrapped, end, space;
+
+	assert( ofs + len <= b->count );
+	pos = b->start + ofs;
+	if( pos >= b->size )
+		return b->data + pos - b->size;
+	if( pos + len <= b->size )
+		return b->data + pos;
+	atend = b->size - pos;
+	wrapped = len - atend;
+	/* where the data ends, after wrapping around */
+	end = b->start + b->count - b->size;
+	space = b->size - b->count;
+	if( wrapped <= space ) {
+		/* everything before it back, the wrapped piece to the end */
+		memmove(b->data + b->start - wrapped, b->data + b->start,
+				b->size - b->start);
+		memcpy(b->data + b->size - wrapped, b->data, wrapped);
+		memmove(b->data, b->data + wrapped, end - wrapped);
+		b->start -= wrapped;
+		return b->data + pos - wrapped;
+	}
+	if( atend <= space ) {
+		/* everything after it forward, the piece at the end to the
+		 * start and what was before it up to the end */
+		memmove(b->data + atend, b->data, end);
+		memcpy(b->data, b->data + pos, atend);
+		memmove(b->data + b->start + atend, b->data + b->start, ofs);
+		b->start += atend;
+		if( b->start == b->size )
+			b->start = 0;
+		return b->data;
+	}
+	if( !ringbuffer_resize(b, b->size) )
+		return NULL;
+	return b->data + ofs;
+}
@@ -0,0 +1,28 @@
+#ifndef XTRACE_RINGBUFFER_H
+#define XTRACE_RINGBUFFER_H
+
+struct iovec;
+
+struct ringbuffer {
+	unsigned char *data;
+	/* data is in [start, start+count) modulo size */
+	size_t size, start, count;
+	/* the most data it held and how often it got empty since
+	 * shrink_if_idle last looked at it */
+	size_t peak;
+	unsigned int drained;
+};
+
+bool ringbuffer_init(struct ringbuffer *, size_t size);
+void ringbuffer_done(struct ringbuffer *);
+int ringbuffer_space(const struct ringbuffer *, struct iovec *);
+int ringbuffer_data(const struct ringbuffer *, struct iovec *, size_t len);
+void ringbuffer_added(struct ringbuffer *, size_t len);
+void ringbuffer_consume(struct ringbuffer *, size_t len);
+bool ringbuffer_resize(struct ringbuffer *, size_t size);
+unsigned char *ringbuffer_contiguous(struct ringbuffer *, size_t ofs, size_t len);
+
+static inline bool ringbuffer_full(const struct ringbuffer *b) {
+	return b->count == b->size;
+}
+#endif
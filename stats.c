@@ -0,0 +1,433 @@
+/*  This file is part of "xtrace"
+ *  Copyright (C) 2026 Bernhard R. Link
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <config.h>
+
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
+#include "xtrace.h"
+#include "output.h"
+#include "stats.h"
+
+/* Entries are found by a key made of class, major opcode (or code) and
+ * minor opcode in a hash table with linear probing. */
+
+/* Round trip times are kept in histograms with buckets of about 3% of
+ * their value, HDR style: values below 64 ns have a bucket each, above
+ * that each power of two is split into 32 buckets. Everything above
+ * 2^40 ns (about 18 minutes) is put in the last bucket. */
+#define HISTOGRAM_SUBBITS 5
+#define HISTOGRAM_SUB (1 << HISTOGRAM_SUBBITS)
+#define HISTOGRAM_MAXBITS 40
+#define HISTOGRAM_BUCKETS ((HISTOGRAM_MAXBITS - HISTOGRAM_SUBBITS + 1) * HISTOGRAM_SUB)
+
+struct histogram {
+	unsigned long long count, sum, max;
+	unsigned long long buckets[HISTOGRAM_BUCKETS];
+};
+
+struct statsentry {
+	/* 0 if unused */
+	uint64_t key;
+	/* copies, as unknown extensions go away with their connection */
+	char *extension, *name;
+	unsigned long long count, bytes, time;
+	/* for replies: time since the request */
+	struct histogram *roundtrips;
+};
+
+struct stats {
+	struct statsentry *entries;
+	/* size is 0 or a power of two */
+	size_t size, used;
+};
+
+#define STATS_KEY(class, major, minor) \
+	(((uint64_t)(class) << 40) | ((uint64_t)((major) & 0xFF) << 32) \
+	 | (uint32_t)(minor))
+#define KEY_CLASS(key) ((unsigned int)((key) >> 40))
+#define KEY_MAJOR(key) ((unsigned int)((key) >> 32) & 0xFF)
+#define KEY_MINOR(key) ((uint32_t)(key))
+
+bool stats_enabled = false;
+volatile bool stats_requested = false;
+
+/* everything counted by connections already closed */
+static struct stats total;
+#ifdef HAVE_PTHREAD
+static pthread_mutex_t total_mutex = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+uint64_t stats_clock(void) {
+#ifdef HAVE_MONOTONIC_CLOCK
+	struct timespec ts;
+
+	if( clock_gettime(CLOCK_MONOTONIC, &ts) == 0 )
+		return ts.tv_sec * (uint64_t)1000000000 + ts.tv_nsec;
+#endif
+	{
+		struct timeval tv;
+
+		gettimeofday(&tv, NULL);
+		return tv.tv_sec * (uint64_t)1000000000 + tv.tv_usec * 1000;
+	}
+}
+
+static inline size_t stats_hash(uint64_t key, size_t size) {
+	return (size_t)((key * 0x9E3779B97F4A7C15ULL) >> 32) & (size - 1);
+}
+
+static void stats_grow(struct stats *s) {
+	struct statsentry *old = s->entries;
+	size_t oldsize = s->size, i, h;
+
+	s->size = (oldsize == 0)?64:2*oldsize;
+	s->entries = calloc(s->size, sizeof(struct statsentry));
+	if( s->entries == NULL )
+		abort();
+	for( i = 0 ; i < oldsize ; i++ ) {
+		if( old[i].key == 0 )
+			continue;
+		h = stats_hash(old[i].key, s->size);
+		while( s->entries[h].key != 0 )
+			h = (h + 1) & (s->size - 1);
+		s->entries[h] = old[i];
+	}
+	free(old);
+}
+
+static inline char *stats_strdup(const char *s) {
+	char *n;
+
+	if( s == NULL )
+		return NULL;
+	n = strdup(s);
+	if( n == NULL )
+		abort();
+	return n;
+}
+
+static struct statsentry *stats_entry(struct stats *s, uint64_t key, const char *extension, const char *name) {
+	struct statsentry *e;
+	size_t h;
+
+	if( 2 * (s->used + 1) > s->size )
+		stats_grow(s);
+	for( h = stats_hash(key, s->size) ; ; h = (h + 1) & (s->size - 1) ) {
+		e = &s->entries[h];
+		if( e->key == key )
+			return e;
+		if( e->key == 0 )
+			break;
+	}
+	e->key = key;
+	e->extension = stats_strdup(extension);
+	e->name = stats_strdup(name);
+	s->used++;
+	return e;
+}
+
+static inline unsigned int histogram_bucket(uint64_t v) {
+	unsigned int shift;
+
+	if( v < 2 * HISTOGRAM_SUB )
+		return v;
+	if( v >= (uint64_t)1 << HISTOGRAM_MAXBITS )
+		return HISTOGRAM_BUCKETS - 1;
+	/* so that v >> shift is in [HISTOGRAM_SUB, 2*HISTOGRAM_SUB) */
+	shift = 63 - __builtin_clzll(v) - HISTOGRAM_SUBBITS;
+	return shift * HISTOGRAM_SUB + (v >> shift);
+}
+
+/* the largest value put into that bucket */
+static inline uint64_t histogram_value(unsigned int bucket) {
+	unsigned int shift;
+
+	if( bucket < 2 * HISTOGRAM_SUB )
+		return bucket;
+	shift = bucket / HISTOGRAM_SUB - 1;
+	return ((uint64_t)(bucket - shift * HISTOGRAM_SUB + 1) << shift) - 1;
+}
+
+static uint64_t histogram_percentile(const struct histogram *h, unsigned int percent) {
+	unsigned long long wanted, seen = 0;
+	unsigned int i;
+
+	/* the smallest value at least percent% are not above */
+	wanted = (h->count * percent + 99) / 100;
+	if( wanted == 0 )
+		wanted = 1;
+	for( i = 0 ; i < HISTOGRAM_BUCKETS ; i++ ) {
+		seen += h->buckets[i];
+		if( seen >= wanted )
+			break;
+	}
+	if( i >= HISTOGRAM_BUCKETS || histogram_value(i) > h->max )
+		return h->max;
+	return histogram_value(i);
+}
+
+static void histogram_merge(struct histogram **into, const struct histogram *h) {
+	unsigned int i;
+
+	if( *into == NULL ) {
+		*into = calloc(1, sizeof(struct histogram));
+		if( *into == NULL )
+			abort();
+	}
+	(*into)->count += h->count;
+	(*into)->sum += h->sum;
+	if( h->max > (*into)->max )
+		(*into)->max = h->max;
+	for( i = 0 ; i < HISTOGRAM_BUCKETS ; i++ )
+		(*into)->buckets[i] += h->buckets[i];
+}
+
+void stats_count(struct connection *c, enum stats_class class, unsigned int major, unsigned int minor, const char *extension, const char *name, size_t bytes, uint64_t start) {
+	struct statsentry *e;
+	uint64_t now = stats_clock();
+
+	if( c->stats == NULL ) {
+		c->stats = calloc(1, sizeof(struct stats));
+		if( c->stats == NULL )
+			abort();
+	}
+	e = stats_entry(c->stats, STATS_KEY(class, major, minor),
+			extension, name);
+	e->count++;
+	e->bytes += bytes;
+	e->time += now - start;
+}
+
+void stats_roundtrip(struct connection *c, unsigned int major, unsigned int minor, const char *extension, const char *name, uint64_t time) {
+	struct statsentry *e;
+	struct histogram *h;
+
+	if( c->stats == NULL ) {
+		c->stats = calloc(1, sizeof(struct stats));
+		if( c->stats == NULL )
+			abort();
+	}
+	e = stats_entry(c->stats, STATS_KEY(sc_REPLY, major, minor),
+			extension, name);
+	if( e->roundtrips == NULL ) {
+		e->roundtrips = calloc(1, sizeof(struct histogram));
+		if( e->roundtrips == NULL )
+			abort();
+	}
+	h = e->roundtrips;
+	h->count++;
+	h->sum += time;
+	if( time > h->max )
+		h->max = time;
+	h->buckets[histogram_bucket(time)]++;
+}
+
+static void stats_merge(struct stats *into, const struct stats *s) {
+	const struct statsentry *e;
+	struct statsentry *n;
+	size_t i;
+
+	for( i = 0 ; i < s->size ; i++ ) {
+		e = &s->entries[i];
+		if( e->key == 0 )
+			continue;
+		n = stats_entry(into, e->key, e->extension, e->name);
+		n->count += e->count;
+		n->bytes += e->bytes;
+		n->time += e->time;
+		if( e->roundtrips != NULL )
+			histogram_merge(&n->roundtrips, e->roundtrips);
+	}
+}
+
+static void stats_free(struct stats *s) {
+	size_t i;
+
+	for( i = 0 ; i < s->size ; i++ ) {
+		free(s->entries[i].extension);
+		free(s->entries[i].name);
+		free(s->entries[i].roundtrips);
+	}
+	free(s->entries);
+	free(s);
+}
+
+/* most bytes first */
+static int stats_compare(const void *a, const void *b) {
+	const struct statsentry *x = *(const struct statsentry * const *)a;
+	const struct statsentry *y = *(const struct statsentry * const *)b;
+
+	if( x->bytes != y->bytes )
+		return (x->bytes > y->bytes)?-1:1;
+	if( x->count != y->count )
+		return (x->count > y->count)?-1:1;
+	return (x->key < y->key)?-1:(x->key > y->key);
+}
+
+/* most time spent waiting first */
+static int stats_compare_roundtrips(const void *a, const void *b) {
+	const struct statsentry *x = *(const struct statsentry * const *)a;
+	const struct statsentry *y = *(const struct statsentry * const *)b;
+
+	if( x->roundtrips->sum != y->roundtrips->sum )
+		return (x->roundtrips->sum > y->roundtrips->sum)?-1:1;
+	return (x->key < y->key)?-1:(x->key > y->key);
+}
+
+/* like in the output, e.g. RENDER-Request(139,26): FillRectangles */
+static void stats_label(struct outbuf *o, const struct statsentry *e) {
+	static const char * const kinds[] = {
+		"", "Request", "Reply", "Event", "Error" };
+	unsigned int class = KEY_CLASS(e->key);
+	uint32_t minor = KEY_MINOR(e->key);
+
+	if( e->extension != NULL ) {
+		out_string(o, e->extension);
+		out_char(o, '-');
+	}
+	out_string(o, kinds[class]);
+	out_char(o, '(');
+	out_uint(o, KEY_MAJOR(e->key));
+	if( class == sc_EVENT && minor != 0 ) {
+		/* generic event: extension opcode and event type */
+		out_char(o, ',');
+		out_uint(o, minor >> 16);
+		out_char(o, ',');
+		out_uint(o, minor & 0xFFFF);
+	} else if( e->extension != NULL && class <= sc_REPLY ) {
+		out_char(o, ',');
+		out_uint(o, minor);
+	}
+	out_string(o, "): ");
+	out_string(o, (e->name != NULL)?e->name:"UNKNOWN");
+}
+
+/* id is that of the connection or -1 for the totals */
+static void stats_print(struct outbuf *o, const struct stats *s, int id) {
+	const struct statsentry **sorted;
+	unsigned long long count = 0, bytes = 0, time = 0;
+	size_t i, n = 0, r;
+
+	sorted = malloc((s->used + 1) * sizeof(struct statsentry *));
+	if( sorted == NULL )
+		abort();
+	for( i = 0 ; i < s->size ; i++ ) {
+		const struct statsentry *e = &s->entries[i];
+
+		if( e->key == 0 )
+			continue;
+		sorted[n++] = e;
+		count += e->count;
+		bytes += e->bytes;
+		time += e->time;
+	}
+	qsort(sorted, n, sizeof(struct statsentry *), stats_compare);
+	if( id >= 0 )
+		out_printf(o, "%03d: statistics: ", id);
+	else
+		out_string(o, "statistics of all connections: ");
+	out_printf(o, "%llu messages, %llu bytes, %.3f ms\n",
+			count, bytes, time / 1000000.0);
+	for( i = 0 ; i < n ; i++ ) {
+		if( id >= 0 )
+			out_printf(o, "%03d: ", id);
+		out_printf(o, "%10llu %12llu %10.3f ms  ", sorted[i]->count,
+				sorted[i]->bytes, sorted[i]->time / 1000000.0);
+		stats_label(o, sorted[i]);
+		out_char(o, '\n');
+	}
+	for( i = 0, r = 0 ; i < n ; i++ ) {
+		if( sorted[i]->roundtrips != NULL )
+			sorted[r++] = sorted[i];
+	}
+	qsort(sorted, r, sizeof(struct statsentry *), stats_compare_roundtrips);
+	if( r > 0 ) {
+		if( id >= 0 )
+			out_printf(o, "%03d: ", id);
+		out_string(o, "round trips (count, total, p50, p90, p99, max in ms):\n");
+	}
+	for( i = 0 ; i < r ; i++ ) {
+		const struct histogram *h = sorted[i]->roundtrips;
+
+		if( id >= 0 )
+			out_printf(o, "%03d: ", id);
+		out_printf(o, "%10llu %12.3f %9.3f %9.3f %9.3f %9.3f  ",
+				h->count, h->sum / 1000000.0,
+				histogram_percentile(h, 50) / 1000000.0,
+				histogram_percentile(h, 90) / 1000000.0,
+				histogram_percentile(h, 99) / 1000000.0,
+				h->max / 1000000.0);
+		stats_label(o, sorted[i]);
+		out_char(o, '\n');
+	}
+	out_flush(o);
+	free(sorted);
+}
+
+void stats_connection_done(struct connection *c) {
+	if( c->stats == NULL )
+		return;
+	stats_print(&c->output, c->stats, c->id);
+#ifdef HAVE_PTHREAD
+	pthread_mutex_lock(&total_mutex);
+#endif
+	stats_merge(&total, c->stats);
+#ifdef HAVE_PTHREAD
+	pthread_mutex_unlock(&total_mutex);
+#endif
+	stats_free(c->stats);
+	c->stats = NULL;
+}
+
+struct stats *stats_report_begin(void) {
+	struct stats *s = calloc(1, sizeof(struct stats));
+
+	if( s == NULL )
+		abort();
+#ifdef HAVE_PTHREAD
+	pthread_mutex_lock(&total_mutex);
+#endif
+	stats_merge(s, &total);
+#ifdef HAVE_PTHREAD
+	pthread_mutex_unlock(&total_mutex);
+#endif
+	return s;
+}
+
+void stats_report_add(struct stats *s, const struct connection *c) {
+	if( c->stats != NULL )
+		stats_merge(s, c->stats);
+}
+
+void stats_report_print(struct stats *s) {
+	struct outbuf o = { NULL, 0, 0 };
+
+	stats_print(&o, s, -1);
+	out_done(&o);
+	stats_free(s);
+}
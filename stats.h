@@ -0,0 +1,38 @@
+#ifndef XTRACE_STATS_H
+#define XTRACE_STATS_H
+
+/* With --stats every message is counted per connection (by kind and
+ * opcode) together with its size and the time spent on it, and for
+ * replies the time since their request in a histogram. Each
+ * connection's table is printed and added to the totals when it is
+ * closed, the totals at exit or when SIGUSR1 arrives. */
+
+enum stats_class { sc_REQUEST = 1, sc_REPLY, sc_EVENT, sc_ERROR };
+
+extern bool stats_enabled;
+/* set by the signal handler, looked at by whoever decodes */
+extern volatile bool stats_requested;
+
+struct stats;
+
+uint64_t stats_clock(void);
+
+/* when starting with a message, 0 if not counting */
+static inline uint64_t stats_start(void) {
+	return stats_enabled?stats_clock():0;
+}
+
+/* extension is NULL for the core protocol, name NULL if not known */
+void stats_count(struct connection *, enum stats_class, unsigned int major, unsigned int minor, const char *extension, const char *name, size_t bytes, uint64_t start);
+/* time between request and reply, for the same major, minor, ... */
+void stats_roundtrip(struct connection *, unsigned int major, unsigned int minor, const char *extension, const char *name, uint64_t time);
+/* print and add to the totals (nothing if there was nothing counted) */
+void stats_connection_done(struct connection *);
+
+/* print the totals, including what the given open connections have
+ * counted so far: begin, then add for each, then print */
+struct stats *stats_report_begin(void);
+void stats_report_add(struct stats *, const struct connection *);
+void stats_report_print(struct stats *);
+
+#endif
@@ -18,11 +18,16 @@
 
 #include <assert.h>
 
+#include <stdbool.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
 
+#include "xtrace.h"
+#include "parse.h"
 #include "stringlist.h"
+#include "blocks.h"
 
 static struct string_bucket {
 	struct string_bucket *next;
@@ -74,18 +79,20 @@ void stringlist_done(void) {
 
 const void *finalize_data(const void *data, size_t len, size_t align) {
 	void *p;
-	size_t next_ofs;
+	size_t next_ofs, space;
 
 	if( buckets == NULL )
 		return NULL;
+	/* even empty data gets an address of its own (see blocks_find) */
+	space = (len > 0)?len:1;
 
 	next_ofs = ((buckets->ofs + align - 1)/align)*align;
-	if( next_ofs >= buckets->size || len > buckets->size - next_ofs ) {
+	if( next_ofs >= buckets->size || space > buckets->size - next_ofs ) {
 		struct bucket *n;
 		size_t size;
 
-		if( len >= BUCKET_SIZE/2 )
-			size = len;
+		if( space >= BUCKET_SIZE/2 )
+			size = space;
 		else
 			size = BUCKET_SIZE;
 		next_ofs = ((sizeof(struct bucket) + align - 1)/align)*align;
@@ -98,21 +105,25 @@ const void *finalize_data(const void *data, size_t len, size_t align) {
 		}
 		n->size = size;
 		n->ofs = next_ofs;
-		if( n->size - n->ofs == len ) {
+		if( n->size - n->ofs == space ) {
 			n->ofs = n->size;
-			p = ((char*)buckets) + next_ofs;
+			p = ((char*)n) + next_ofs;
 			memcpy(p, data, len);
 			n->next = buckets->next;
 			buckets->next = n;
+			if( blocks_tracking )
+				blocks_record(p, len, false);
 			return p;
 		}
 		n->next = buckets;
 		buckets = n;
 	}
-	assert( len <= buckets->size - next_ofs );
+	assert( space <= buckets->size - next_ofs );
 	p = ((char*)buckets) + next_ofs;
 	memcpy(p, data, len);
-	buckets->ofs = next_ofs + len;
+	buckets->ofs = next_ofs + space;
+	if( blocks_tracking )
+		blocks_record(p, len, false);
 	return p;
 }
 
@@ -146,6 +157,8 @@ const char *string_add_l(const char *string, size_t len) {
 			n->data[len] = '\0';
 			n->next = stringlist->next;
 			stringlist->next = n;
+			if( blocks_tracking )
+				blocks_record(n->data, len + 1, true);
 			return n->data;
 		}
 		n->next = stringlist;
@@ -157,6 +170,8 @@ const char *string_add_l(const char *string, size_t len) {
 	p = stringlist->data + stringlist->ofs;
 	memcpy(p, string, len);
 	p[len] = '\0';
+	if( blocks_tracking )
+		blocks_record(p, len + 1, true);
 	return p;
 }
 
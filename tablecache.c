@@ -0,0 +1,531 @@
+/*  This file is part of "xtrace"
+ *  Copyright (C) 2026 Bernhard R. Link
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <config.h>
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "xtrace.h"
+#include "parse.h"
+#include "translate.h"
+#include "blocks.h"
+#include "tablecache.h"
+
+/* The tables parsed from the .proto files can be kept in a file named
+ * after a hash of all .proto files in the search path (and of what
+ * the tables look like in this xtrace), to be mapped into memory on
+ * the next start instead of parsing everything again.
+ *
+ * The file consists of a header, the finalized data with offsets
+ * (from the start of the file) instead of pointers, and the list of
+ * where those offsets are (the lowest bit set if it is the index of a
+ * special function instead). The strings stay shared with other
+ * processes using the same file, the pages with pointers get private
+ * once the pointers are adjusted. */
+
+#define TABLECACHE_VERSION 5
+#define TABLECACHE_MAGIC "xtrace tables\0\0"
+
+enum tablecache_root { tr_REQUESTS, tr_EVENTS, tr_ERRORS, tr_EXTENSIONS,
+	tr_UNEXPECTED_REPLY, tr_SETUP, tr_NAMES, tr_COUNT };
+
+struct tablecache_header {
+	char magic[16];
+	uint64_t key;
+	uint32_t version, pointersize;
+	uint32_t sizes[bk_COUNT];
+	uint64_t size, numrelocs, relocs;
+	uint64_t roots[tr_COUNT];
+	uint64_t num_requests, num_events, num_errors, num_extensions;
+};
+
+#define DATA_START ((sizeof(struct tablecache_header) + 15) & ~(size_t)15)
+
+static char *cachefile = NULL;
+static uint64_t cachekey;
+static bool explicitdir;
+
+static inline void hash_data(uint64_t *h, const void *data, size_t len) {
+	const unsigned char *p = data;
+
+	while( len-- > 0 ) {
+		*h ^= *(p++);
+		*h *= 1099511628211ULL;
+	}
+}
+
+static int compare_names(const void *a, const void *b) {
+	return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+static void hash_file(uint64_t *h, const char *filename) {
+	char buffer[8192];
+	ssize_t got;
+	int fd;
+
+	fd = open(filename, O_RDONLY|O_NOCTTY);
+	if( fd < 0 )
+		return;
+	while( (got = read(fd, buffer, sizeof(buffer))) > 0 )
+		hash_data(h, buffer, got);
+	(void)close(fd);
+}
+
+/* everything find_file could find in this directory */
+static void hash_dir(void *privdata, const char *dir) {
+	uint64_t *h = privdata;
+	struct dirent *e;
+	DIR *d;
+	char **names = NULL;
+	size_t count = 0, i;
+
+	hash_data(h, dir, strlen(dir) + 1);
+	d = opendir(dir);
+	if( d == NULL )
+		return;
+	while( (e = readdir(d)) != NULL ) {
+		size_t l = strlen(e->d_name);
+		char **n;
+
+		if( l < 6 || strcmp(e->d_name + l - 6, ".proto") != 0 )
+			continue;
+		n = realloc(names, (count + 1) * sizeof(char *));
+		if( n == NULL )
+			break;
+		names = n;
+		names[count] = strdup(e->d_name);
+		if( names[count] == NULL )
+			break;
+		count++;
+	}
+	(void)closedir(d);
+	if( count > 1 )
+		qsort(names, count, sizeof(char *), compare_names);
+	for( i = 0 ; i < count ; i++ ) {
+		char *filename;
+
+		hash_data(h, names[i], strlen(names[i]) + 1);
+		if( asprintf(&filename, "%s/%s", dir, names[i]) >= 0 ) {
+			hash_file(h, filename);
+			free(filename);
+		}
+		free(names[i]);
+	}
+	free(names);
+}
+
+static uint64_t tablecache_key(struct parser *parser) {
+	uint64_t h = 14695981039346656037ULL;
+	uint32_t layout[4] = { TABLECACHE_VERSION, ft_SET, event_COUNT,
+		sizeof(void *) };
+	enum block_kind k;
+
+	hash_data(&h, PACKAGE_VERSION, strlen(PACKAGE_VERSION) + 1);
+	hash_data(&h, layout, sizeof(layout));
+	for( k = 0 ; k < bk_COUNT ; k++ )
+		hash_data(&h, &block_kinds[k].size, sizeof(size_t));
+	parser_searchpath(parser, hash_dir, &h);
+	return h;
+}
+
+static void set_pointer(char *base, uint64_t at, uintptr_t value) {
+	memcpy(base + at, &value, sizeof(value));
+}
+
+static bool load(const char *filename) {
+	const struct tablecache_header *h;
+	struct stat s;
+	char *base;
+	const uint64_t *relocs;
+	uint64_t i;
+	int fd, nfunctions;
+	enum block_kind k;
+
+	fd = open(filename, O_RDONLY|O_NOCTTY);
+	if( fd < 0 )
+		return false;
+	if( fstat(fd, &s) != 0 || s.st_size < (off_t)DATA_START ) {
+		(void)close(fd);
+		return false;
+	}
+	base = mmap(NULL, s.st_size, PROT_READ|PROT_WRITE, MAP_PRIVATE, fd, 0);
+	(void)close(fd);
+	if( base == MAP_FAILED )
+		return false;
+	h = (const struct tablecache_header *)base;
+	if( memcmp(h->magic, TABLECACHE_MAGIC, sizeof(h->magic)) != 0 ||
+			h->key != cachekey ||
+			h->version != TABLECACHE_VERSION ||
+			h->pointersize != sizeof(void *) ||
+			h->size != (uint64_t)s.st_size ||
+			h->relocs > h->size || (h->relocs & 7) != 0 ||
+			h->numrelocs > (h->size - h->relocs) / 8 )
+		goto broken;
+	for( k = 0 ; k < bk_COUNT ; k++ ) {
+		if( h->sizes[k] != block_kinds[k].size )
+			goto broken;
+	}
+	for( nfunctions = 0 ; block_functions[nfunctions].name != NULL ;
+			nfunctions++ )
+		;
+	relocs = (const uint64_t *)(base + h->relocs);
+	for( i = 0 ; i < h->numrelocs ; i++ ) {
+		uint64_t at = relocs[i] >> 1;
+		uintptr_t v;
+
+		if( at < DATA_START || at > h->relocs - sizeof(v) )
+			goto broken;
+		memcpy(&v, base + at, sizeof(v));
+		if( (relocs[i] & 1) != 0 ) {
+			generic_func *f;
+
+			if( v >= (uintptr_t)nfunctions )
+				goto broken;
+			f = block_functions[v].f;
+			memcpy(base + at, &f, sizeof(f));
+		} else {
+			if( v < DATA_START || v >= h->relocs )
+				goto broken;
+			set_pointer(base, at, (uintptr_t)(base + v));
+		}
+	}
+	for( i = 0 ; i < tr_COUNT ; i++ ) {
+		if( h->roots[i] != 0 && (h->roots[i] < DATA_START ||
+					h->roots[i] >= h->relocs) )
+			goto broken;
+	}
+#define ROOT(r) ((h->roots[r] == 0)?NULL:(const void *)(base + h->roots[r]))
+	requests = ROOT(tr_REQUESTS);
+	num_requests = h->num_requests;
+	events = ROOT(tr_EVENTS);
+	num_events = h->num_events;
+	errors = ROOT(tr_ERRORS);
+	num_errors = h->num_errors;
+	extensions = ROOT(tr_EXTENSIONS);
+	num_extensions = h->num_extensions;
+	unexpected_reply = ROOT(tr_UNEXPECTED_REPLY);
+	setup_parameters = ROOT(tr_SETUP);
+	protocol_names = ROOT(tr_NAMES);
+#undef ROOT
+	(void)mprotect(base, s.st_size, PROT_READ);
+	return index_extensions();
+broken:
+	(void)munmap(base, s.st_size);
+	return false;
+}
+
+bool tablecache_load(struct parser *parser, const char *dir) {
+	const char *e;
+	char *d = NULL;
+
+	explicitdir = dir != NULL;
+	if( dir == NULL ) {
+		e = getenv("XDG_CACHE_HOME");
+		if( e != NULL && e[0] == '/' ) {
+			if( asprintf(&d, "%s/xtrace", e) < 0 )
+				return false;
+		} else {
+			e = getenv("HOME");
+			if( e == NULL || e[0] != '/' )
+				return false;
+			if( asprintf(&d, "%s/.cache/xtrace", e) < 0 )
+				return false;
+		}
+		dir = d;
+	}
+	cachekey = tablecache_key(parser);
+	if( asprintf(&cachefile, "%s/tables-%016llx", dir,
+				(unsigned long long)cachekey) < 0 ) {
+		cachefile = NULL;
+		free(d);
+		return false;
+	}
+	free(d);
+	if( load(cachefile) ) {
+		free(cachefile);
+		cachefile = NULL;
+		return true;
+	}
+	/* to know what to write afterwards */
+	blocks_tracking = true;
+	return false;
+}
+
+/* what the file will contain */
+struct image {
+	char *data;
+	size_t size, used;
+	uint64_t *relocs;
+	size_t numrelocs;
+	/* strings not in the blocks, i.e. literals in translate.c */
+	struct literal {
+		const char *s;
+		uint64_t ofs;
+	} *literals;
+	size_t numliterals;
+	bool failed;
+};
+
+static uint64_t image_add(struct image *i, const void *data, size_t len, size_t align) {
+	uint64_t ofs = (i->used + align - 1) & ~(uint64_t)(align - 1);
+
+	if( i->failed )
+		return 0;
+	if( ofs + len > i->size ) {
+		size_t size = 2 * (ofs + len);
+		char *n = realloc(i->data, size);
+
+		if( n == NULL ) {
+			i->failed = true;
+			return 0;
+		}
+		memset(n + i->size, 0, size - i->size);
+		i->data = n;
+		i->size = size;
+	}
+	memcpy(i->data + ofs, data, len);
+	i->used = ofs + len;
+	return ofs;
+}
+
+static void image_reloc(struct image *i, uint64_t at, bool function) {
+	uint64_t *n;
+
+	if( i->failed )
+		return;
+	n = realloc(i->relocs, (i->numrelocs + 1) * sizeof(uint64_t));
+	if( n == NULL ) {
+		i->failed = true;
+		return;
+	}
+	i->relocs = n;
+	i->relocs[i->numrelocs++] = (at << 1) | (function?1:0);
+}
+
+/* where the data pointed to ends up in the file */
+static uint64_t image_target(struct image *i, const void *target) {
+	const struct block *b;
+	size_t l;
+
+	b = blocks_find(target);
+	if( b != NULL )
+		return b->index + ((const char *)target - b->data);
+	for( l = 0 ; l < i->numliterals ; l++ ) {
+		if( i->literals[l].s == target )
+			return i->literals[l].ofs;
+	}
+	/* blocks_walk already made sure only strings can be here */
+	return 0;
+}
+
+static void image_pointer(void *privdata, const struct block *b, size_t ofs, const void *target, enum block_kind kind UNUSED) {
+	struct image *i = privdata;
+	uint64_t at = b->index + ofs;
+
+	if( target == NULL )
+		return;
+	set_pointer(i->data, at, image_target(i, target));
+	image_reloc(i, at, false);
+}
+
+static void image_literal(void *privdata, const struct block *b UNUSED, size_t ofs UNUSED, const void *target, enum block_kind kind) {
+	struct image *i = privdata;
+	struct literal *n;
+	size_t l;
+
+	if( target == NULL || kind != bk_STRING || blocks_find(target) != NULL
+			|| i->failed )
+		return;
+	for( l = 0 ; l < i->numliterals ; l++ ) {
+		if( i->literals[l].s == target )
+			return;
+	}
+	n = realloc(i->literals, (i->numliterals + 1) * sizeof(struct literal));
+	if( n == NULL ) {
+		i->failed = true;
+		return;
+	}
+	i->literals = n;
+	n[i->numliterals].s = target;
+	n[i->numliterals].ofs = image_add(i, target, strlen(target) + 1, 1);
+	i->numliterals++;
+}
+
+static void image_function(struct image *i, uint64_t at, generic_func *f) {
+	int n;
+
+	if( f == NULL )
+		return;
+	n = blocks_function(f);
+	if( n < 0 ) {
+		i->failed = true;
+		return;
+	}
+	set_pointer(i->data, at, n);
+	image_reloc(i, at, true);
+}
+
+static bool image_build(struct image *i) {
+	struct tablecache_header h;
+	size_t b, e;
+	enum block_kind k;
+
+	memset(&h, 0, sizeof(h));
+	(void)image_add(i, &h, sizeof(h), 1);
+	i->used = DATA_START;
+	for( b = 0 ; b < numblocks ; b++ ) {
+		struct block *bl = &blocks[b];
+
+		if( bl->kind == bk_NONE )
+			continue;
+		bl->index = image_add(i, bl->data, (bl->len > 0)?bl->len:1,
+				(bl->kind == bk_STRING)?1:16);
+	}
+	for( b = 0 ; b < numblocks ; b++ ) {
+		const struct block *bl = &blocks[b];
+
+		if( bl->kind == bk_NONE || bl->kind == bk_STRING )
+			continue;
+		for( e = 0 ; e < bl->len / block_kinds[bl->kind].size ; e++ )
+			blocks_pointers(bl, e, image_literal, i);
+	}
+	for( b = 0 ; b < numblocks && !i->failed ; b++ ) {
+		const struct block *bl = &blocks[b];
+
+		if( bl->kind == bk_NONE || bl->kind == bk_STRING )
+			continue;
+		for( e = 0 ; e < bl->len / block_kinds[bl->kind].size ; e++ ) {
+			blocks_pointers(bl, e, image_pointer, i);
+			if( bl->kind == bk_REQUEST ) {
+				const struct request *r = (const struct request *)bl->data + e;
+				uint64_t at = bl->index + e * sizeof(struct request);
+
+				image_function(i, at + offsetof(struct request, request_func),
+						(generic_func *)r->request_func);
+				image_function(i, at + offsetof(struct request, reply_func),
+						(generic_func *)r->reply_func);
+			}
+		}
+	}
+	if( i->failed )
+		return false;
+	memcpy(h.magic, TABLECACHE_MAGIC, sizeof(h.magic));
+	h.key = cachekey;
+	h.version = TABLECACHE_VERSION;
+	h.pointersize = sizeof(void *);
+	for( k = 0 ; k < bk_COUNT ; k++ )
+		h.sizes[k] = block_kinds[k].size;
+#define ROOT(r, p) h.roots[r] = ((p) == NULL)?0:image_target(i, (p))
+	ROOT(tr_REQUESTS, requests);
+	ROOT(tr_EVENTS, events);
+	ROOT(tr_ERRORS, errors);
+	ROOT(tr_EXTENSIONS, extensions);
+	ROOT(tr_UNEXPECTED_REPLY, unexpected_reply);
+	ROOT(tr_SETUP, setup_parameters);
+	ROOT(tr_NAMES, protocol_names);
+#undef ROOT
+	h.num_requests = num_requests;
+	h.num_events = num_events;
+	h.num_errors = num_errors;
+	h.num_extensions = num_extensions;
+	h.numrelocs = i->numrelocs;
+	h.relocs = image_add(i, i->relocs, i->numrelocs * sizeof(uint64_t), 8);
+	/* (so that relocs != size even without any) */
+	h.size = i->used;
+	if( i->failed )
+		return false;
+	memcpy(i->data, &h, sizeof(h));
+	return true;
+}
+
+static bool write_all(int fd, const char *data, size_t len) {
+	while( len > 0 ) {
+		ssize_t written = write(fd, data, len);
+
+		if( written < 0 && errno == EINTR )
+			continue;
+		if( written <= 0 )
+			return false;
+		data += written;
+		len -= written;
+	}
+	return true;
+}
+
+void tablecache_store(void) {
+	struct image i;
+	char *tmpname = NULL, *slash;
+	bool ok;
+	int fd;
+
+	if( cachefile == NULL )
+		return;
+	memset(&i, 0, sizeof(i));
+	ok = blocks_walk() && image_build(&i);
+	blocks_tracking = false;
+	blocks_done();
+	if( ok ) {
+		/* create the default one (and its parent) if needed */
+		slash = strrchr(cachefile, '/');
+		*slash = '\0';
+		if( mkdir(cachefile, 0777) != 0 && errno == ENOENT &&
+				!explicitdir ) {
+			char *parent = strrchr(cachefile, '/');
+
+			*parent = '\0';
+			(void)mkdir(cachefile, 0777);
+			*parent = '/';
+			(void)mkdir(cachefile, 0777);
+		}
+		*slash = '/';
+		ok = asprintf(&tmpname, "%s.XXXXXX", cachefile) >= 0;
+	}
+	if( ok ) {
+		fd = mkstemp(tmpname);
+		if( fd < 0 )
+			ok = false;
+		else {
+			ok = write_all(fd, i.data, i.used);
+			if( close(fd) != 0 )
+				ok = false;
+			if( ok && rename(tmpname, cachefile) != 0 )
+				ok = false;
+			if( !ok )
+				(void)unlink(tmpname);
+		}
+	}
+	if( !ok && explicitdir )
+		fprintf(stderr, "Could not write %s, continuing without.\n",
+				cachefile);
+	free(tmpname);
+	free(i.data);
+	free(i.relocs);
+	free(i.literals);
+	free(cachefile);
+	cachefile = NULL;
+}
@@ -0,0 +1,13 @@
+#ifndef XTRACE_TABLECACHE_H
+#define XTRACE_TABLECACHE_H
+
+struct parser;
+
+/* Look for the tables of what the parser's search path contains in the
+ * cache in dir (NULL for the default one). If not there, start keeping
+ * track of what finalize_everything does, so tablecache_store can
+ * write them afterwards. */
+bool tablecache_load(struct parser *, const char *dir);
+void tablecache_store(void);
+
+#endif
@@ -157,8 +157,11 @@ struct variable {
 			};
 		} *parameter;
 		struct {
-			struct constant *constants;
-			size_t size;
+			struct unfinished_constant {
+				unsigned long value;
+				const char *name;
+			} *constants;
+			size_t count;
 			bool bitmask;
 		} c;
 		struct unfinished_value {
@@ -284,6 +287,12 @@ struct parser {
 		const char *dir;
 		size_t len;
 	} *searchpath;
+	/* struct compiled for every parameter list compiled */
+	void *compiled;
+	/* what will be protocol_names, and a struct name for each name */
+	char *names;
+	size_t names_len, names_allocated;
+	void *names_index;
 	bool error;
 };
 
@@ -521,6 +530,13 @@ void add_searchpath(struct parser *parser, const char *dir) {
 	(*last)->len = strlen(dir);
 }
 
+void parser_searchpath(struct parser *parser, void (*f)(void *, const char *), void *privdata) {
+	const struct searchpath_entry *r;
+
+	for( r = parser->searchpath ; r != NULL ; r = r->next )
+		f(privdata, r->dir);
+}
+
 static FILE *find_file(struct parser *parser, const char *name, char **filename_p) {
 	size_t l = strlen(name);
 	struct searchpath_entry *r;
@@ -753,7 +769,7 @@ static unsigned long parse_number(struct parser *parser, const char *value) {
 	if( value[0] == '$' ) {
 		char *v;
 		struct variable *var;
-		const struct constant *c;
+		const struct unfinished_constant *c;
 
 		e = strrchr(value, ':');
 		if( e == NULL || ( e > value && *(e-1) == ':' ) ) {
@@ -1210,7 +1226,7 @@ static bool parse_parameters(struct parser *parser, struct variable *variable, b
 				error(parser, "LATER makes no sense after all-consuming LIST (i.e. list without limiting count)");
 			if( !state->nextmarker_set )
 				error(parser, "LATER needs a command setting nextmarker before!");
-			number = (size_t)-1; //OFS_LATER;
+			number = OFS_LATER;
 		} else
 			number = parse_number(parser, position);
 		name = get_const_token(parser, false);
@@ -1317,13 +1333,13 @@ static void parse_request(struct parser *parser, bool template) {
 			if( attribute == NULL )
 				return;
 			record = strtoll(attribute, &e, 10);
-			if( *e != '\0' || record > 30 || record <= 0 )
+			if( *e != '\0' || record > MAX_RECORD_VARIABLES || record <= 0 )
 				error(parser, "Parse error: invalid number after 'transfer'!");
 		} else if( strncmp(attribute, "TRANSFER=", 9) == 0 ||
 				strncmp(attribute, "transfer=", 9) == 0 ) {
 			char *e;
 			record = strtoll(attribute + 9, &e, 10);
-			if( *e != '\0' || record > 30 || record <= 0 )
+			if( *e != '\0' || record > MAX_RECORD_VARIABLES || record <= 0 )
 				error(parser, "Parse error: invalid number after 'transfer='!");
 		} else {
 			error(parser, "Unknown REQUEST attribute '%s'!",
@@ -1859,7 +1875,7 @@ static void parse_constants(struct parser *parser, bool bitmasks) {
 	long firstline = parser->current->lineno;
 	const char *valuesname;
 	size_t count = 0;
-	struct constant *constants;
+	struct unfinished_constant *constants;
 	struct variable *v;
 
 	assert( n != NULL );
@@ -1870,7 +1886,7 @@ static void parse_constants(struct parser *parser, bool bitmasks) {
 	if( v == NULL )
 		return;
 
-	constants = malloc(sizeof(struct constant)*8);
+	constants = malloc(sizeof(struct unfinished_constant)*8);
 	if( constants == NULL ) {
 		oom(parser);
 		return;
@@ -1886,10 +1902,10 @@ static void parse_constants(struct parser *parser, bool bitmasks) {
 		if( value == NULL )
 			break;
 		if( strcmp(value, "END") == 0 ) {
-			struct constant *nc;
+			struct unfinished_constant *nc;
 
 			nc = realloc(constants,
-					sizeof(struct constant)*(count+1));
+					sizeof(struct unfinished_constant)*(count+1));
 			if( nc == NULL ) {
 				oom(parser);
 				break;
@@ -1898,7 +1914,7 @@ static void parse_constants(struct parser *parser, bool bitmasks) {
 			constants[count].name = NULL;
 			constants[count].value = 0;
 			v->c.constants = constants;
-			v->c.size = sizeof(struct constant)*(count+1);
+			v->c.count = count;
 			v->c.bitmask = bitmasks;
 			return;
 		}
@@ -1926,10 +1942,10 @@ static void parse_constants(struct parser *parser, bool bitmasks) {
 		}
 		count++;
 		if( (count & 7) == 0 ) {
-			struct constant *nc;
+			struct unfinished_constant *nc;
 
 			nc = realloc(constants,
-					sizeof(struct constant)*(count+8));
+					sizeof(struct unfinished_constant)*(count+8));
 			if( nc == NULL ) {
 				oom(parser);
 				break;
@@ -2197,6 +2213,11 @@ bool parser_free(struct parser *parser) {
 	bool success = !parser->error;
 
 	file_free(parser->current);
+#ifdef HAVE_TDESTROY
+	tdestroy(parser->compiled, free);
+	tdestroy(parser->names_index, free);
+#endif
+	free(parser->names);
 
 	while( parser->namespaces != NULL ) {
 		struct namespace *ns = parser->namespaces;
@@ -2347,17 +2368,160 @@ static const struct parameter *parameters_finalize(struct parser *parser, struct
 	return v->finalized.parameters;
 }
 
+/* All names in constants, values and instructions are offsets into
+ * one blob (protocol_names), every name only stored once. */
+
+struct name {
+	const char *name;
+	uint32_t ofs;
+};
+
+static int compare_names(const void *a, const void *b) {
+	return strcmp(((const struct name *)a)->name,
+			((const struct name *)b)->name);
+}
+
+static uint32_t name_add(struct parser *parser, const char *name) {
+	struct name key, *n;
+	void *found;
+	size_t l;
+
+	if( name == NULL )
+		return 0;
+	key.name = name;
+	found = tfind(&key, &parser->names_index, compare_names);
+	if( found != NULL )
+		return (*(const struct name **)found)->ofs;
+	l = strlen(name) + 1;
+	if( parser->names_len == 0 )
+		/* offset 0 is the empty string, so 0 can mean none */
+		parser->names_len = 1;
+	if( parser->names_len + l > parser->names_allocated ) {
+		size_t a = parser->names_allocated*2 + l + 4096;
+		char *nn;
+
+		if( a > 0xFFFFFFFFUL ) {
+			error(parser, "Too many names!");
+			return 0;
+		}
+		nn = realloc(parser->names, a);
+		if( nn == NULL ) {
+			oom(parser);
+			return 0;
+		}
+		if( parser->names_allocated == 0 )
+			nn[0] = '\0';
+		parser->names = nn;
+		parser->names_allocated = a;
+	}
+	/* (the blob might still move, so with a copy of its own) */
+	n = malloc(sizeof(struct name) + l);
+	if( n == NULL ) {
+		oom(parser);
+		return 0;
+	}
+	n->ofs = parser->names_len;
+	n->name = memcpy(n + 1, name, l);
+	memcpy(parser->names + parser->names_len, name, l);
+	if( tsearch(n, &parser->names_index, compare_names) == NULL ) {
+		free(n);
+		oom(parser);
+		return 0;
+	}
+	parser->names_len += l;
+	return n->ofs;
+}
+
+/* by value, and with equal values in the order given,
+ * so findConstant finds the first name like a linear search */
+static int compare_constants(const void *a, const void *b) {
+	const struct constant *c1 = *(const struct constant * const *)a;
+	const struct constant *c2 = *(const struct constant * const *)b;
+
+	if( c1->value != c2->value )
+		return c1->value < c2->value ? -1 : 1;
+	if( c1 != c2 )
+		return c1 < c2 ? -1 : 1;
+	return 0;
+}
+
+/* Before the list (in the order given) is a header and before that
+ * a table for findConstant (see struct constant in parse.h):
+ * indexed by value - minimum if the values are dense enough,
+ * otherwise all constants sorted by value. */
 static const struct constant *constants_finalize(struct parser *parser, struct variable *v) {
+	struct constant *constants, *list, **sorted;
+	size_t i, count, tablesize;
+	unsigned long min = 0, max = 0;
+	bool dense;
+
 	if( v == NULL )
 		return NULL;
 	assert( v->type == vt_constants );
 
 	if( v->finalized.constants != NULL )
 		return v->finalized.constants;
-	v->finalized.constants = finalize_data(v->c.constants,
-			v->c.size, __alignof__(struct constant));
-	if( v->finalized.constants == NULL )
+	count = v->c.count;
+	for( i = 0 ; i < count ; i++ ) {
+		unsigned long value = v->c.constants[i].value;
+
+		if( value > 0xFFFFFFFFUL ) {
+			fprintf(stderr, "Constant %s does not fit into 32 bit!\n",
+					v->c.constants[i].name);
+			parser->error = true;
+			return NULL;
+		}
+		if( i == 0 || value < min )
+			min = value;
+		if( i == 0 || value > max )
+			max = value;
+	}
+	dense = count > 0 && max - min < 2 * count;
+	tablesize = dense ? max - min + 1 : count;
+	constants = calloc(tablesize + 1 + count + 1, sizeof(struct constant));
+	if( constants == NULL ) {
+		oom(parser);
+		return NULL;
+	}
+	list = constants + tablesize + 1;
+	for( i = 0 ; i < count ; i++ ) {
+		list[i].value = v->c.constants[i].value;
+		list[i].name = name_add(parser, v->c.constants[i].name);
+	}
+	if( dense ) {
+		for( i = 0 ; i < tablesize ; i++ )
+			constants[i].value = min + i;
+		/* the first name given for a value wins */
+		for( i = 0 ; i < count ; i++ ) {
+			if( constants[list[i].value - min].name == 0 )
+				constants[list[i].value - min] = list[i];
+		}
+	} else {
+		sorted = malloc(count * sizeof(struct constant *));
+		if( sorted == NULL ) {
+			free(constants);
+			oom(parser);
+			return NULL;
+		}
+		for( i = 0 ; i < count ; i++ )
+			sorted[i] = &list[i];
+		qsort(sorted, count, sizeof(struct constant *),
+				compare_constants);
+		for( i = 0 ; i < count ; i++ )
+			constants[i] = *sorted[i];
+		free(sorted);
+	}
+	list[-1].value = dense ? min : 0;
+	list[-1].name = (tablesize << 1) | (dense ? 1 : 0);
+	v->finalized.constants = finalize_data(constants,
+			(tablesize + 1 + count + 1)*sizeof(struct constant),
+			__alignof__(struct constant));
+	free(constants);
+	if( v->finalized.constants == NULL ) {
 		parser->error = true;
+		return NULL;
+	}
+	v->finalized.constants += tablesize + 1;
 	return v->finalized.constants;
 }
 
@@ -2382,8 +2546,13 @@ static inline const struct value *values_finalize(struct parser *parser, struct
 	}
 	for( uv = v->values; uv != NULL ; uv = uv->next ) {
 		assert( i < count);
+		if( uv->flag > 0xFFFFFFFFUL ) {
+			fprintf(stderr, "Value flag of %s does not fit into 32 bit!\n",
+					uv->name);
+			parser->error = true;
+		}
 		values[i].flag = uv->flag;
-		values[i].name = uv->name;
+		values[i].name = name_add(parser, uv->name);
 		assert( C(uv->type.base_type, ELEMENTARY) );
 		values[i].type = uv->type.base_type->type;
 		values[i].constants = constants_finalize(
@@ -2416,7 +2585,289 @@ static void variable_finalize(struct parser *parser, struct variable *v, union p
 	}
 }
 
-static const struct request *finalize_requests(struct parser *parser, struct namespace *ns, const struct parameter *unknownrequest, const struct parameter *unknownresponse) {
+/* Each finalized parameter list is compiled to instructions for
+ * print_parameters (see struct instruction in parse.h), IFs and
+ * Structs pointing to the code of their lists. */
+
+struct compiled {
+	const struct parameter *parameters;
+	const struct instruction *code;
+};
+
+static int compare_compiled(const void *a, const void *b) {
+	const struct parameter *p1 = ((const struct compiled *)a)->parameters;
+	const struct parameter *p2 = ((const struct compiled *)b)->parameters;
+
+	if( p1 < p2 )
+		return -1;
+	return p1 > p2;
+}
+
+/* for those that are only a field to print */
+static const enum opcode field_opcodes[ft_SET + 1] = {
+	[ft_INT8] = op_INT8, [ft_INT16] = op_INT16, [ft_INT32] = op_INT32,
+	[ft_UINT8] = op_UINT8, [ft_UINT16] = op_UINT16,
+	[ft_UINT32] = op_UINT32,
+	[ft_CARD8] = op_CARD8, [ft_CARD16] = op_CARD16,
+	[ft_CARD32] = op_CARD32,
+	[ft_ENUM8] = op_ENUM8, [ft_ENUM16] = op_ENUM16,
+	[ft_ENUM32] = op_ENUM32,
+	[ft_STORE8] = op_STORE8, [ft_STORE16] = op_STORE16,
+	[ft_STORE32] = op_STORE32,
+	[ft_PUSH8] = op_PUSH8, [ft_PUSH16] = op_PUSH16,
+	[ft_PUSH32] = op_PUSH32,
+	[ft_BITMASK8] = op_BITMASK8, [ft_BITMASK16] = op_BITMASK16,
+	[ft_BITMASK32] = op_BITMASK32,
+	[ft_CARD64] = op_CARD64, [ft_ATOM] = op_ATOM, [ft_BE32] = op_BE32,
+	[ft_FIXED] = op_FIXED, [ft_FIXED3232] = op_FIXED3232,
+	[ft_FLOAT32] = op_FLOAT32,
+	[ft_FRACTION16_16] = op_FRACTION16_16,
+	[ft_FRACTION32_32] = op_FRACTION32_32,
+	[ft_UFRACTION32_32] = op_UFRACTION32_32,
+	[ft_INT32_32] = op_INT32_32, [ft_EVENT] = op_EVENT,
+	[ft_STRING8] = op_STRING8, [ft_LISTofCARD8] = op_LISTofCARD8,
+	[ft_LISTofCARD16] = op_LISTofCARD16,
+	[ft_LISTofCARD32] = op_LISTofCARD32,
+	[ft_LISTofCARD64] = op_LISTofCARD64,
+	[ft_LISTofATOM] = op_LISTofATOM,
+	[ft_LISTofUINT8] = op_LISTofUINT8,
+	[ft_LISTofUINT16] = op_LISTofUINT16,
+	[ft_LISTofUINT32] = op_LISTofUINT32,
+	[ft_LISTofINT8] = op_LISTofINT8, [ft_LISTofINT16] = op_LISTofINT16,
+	[ft_LISTofINT32] = op_LISTofINT32,
+	[ft_LISTofFIXED] = op_LISTofFIXED,
+	[ft_LISTofFIXED3232] = op_LISTofFIXED3232,
+	[ft_LISTofFLOAT32] = op_LISTofFLOAT32,
+	[ft_LISTofFormat] = op_LISTofFormat,
+	[ft_LISTofVALUE] = op_LISTofVALUE,
+	[ft_Struct] = op_Struct, [ft_LISTofStruct] = op_LISTofStruct,
+	[ft_LISTofVarStruct] = op_LISTofVarStruct,
+	[ft_FORMAT8] = op_FORMAT8,
+};
+
+/* size of fields that can be part of a RUN, 0 for all others */
+static inline size_t run_size(const struct parameter *p) {
+	if( p->offse == OFS_LATER )
+		return 0;
+	switch( p->type ) {
+		case ft_INT8:
+		case ft_UINT8:
+		case ft_CARD8:
+		case ft_ENUM8:
+			return 1;
+		case ft_INT16:
+		case ft_UINT16:
+		case ft_CARD16:
+		case ft_ENUM16:
+			return 2;
+		case ft_INT32:
+		case ft_UINT32:
+		case ft_CARD32:
+		case ft_ENUM32:
+		case ft_ATOM:
+			return 4;
+		default:
+			return 0;
+	}
+}
+
+/* how many fields starting with p can be checked at once */
+static size_t find_run(const struct parameter *p, struct instruction *in) {
+	size_t count = 0, size;
+
+	memset(in, 0, sizeof(struct instruction));
+	in->op = op_RUN;
+	for( ; p->name != NULL && (size = run_size(p)) > 0 ; p++ ) {
+		if( p->offse + size > in->ofs )
+			in->ofs = p->offse + size;
+		/* (might be more than needed if not the last one moves) */
+		if( p->offse >= 4 )
+			in->flags = IN_BIG;
+		count++;
+	}
+	in->arg = count;
+	return count;
+}
+
+static const struct instruction *compile_parameters(struct parser *, const struct parameter *, bool);
+
+static void compile_parameter(struct parser *parser, const struct parameter *p, struct instruction *in) {
+	memset(in, 0, sizeof(struct instruction));
+	if( p->offse == OFS_LATER )
+		in->flags = IN_LATER;
+	else if( p->offse > 0xFFFF && p->type != ft_SET_SIZE &&
+			p->type != ft_LASTMARKER && p->type != ft_GET &&
+			p->type != ft_DECREMENT_STORED &&
+			p->type != ft_DIVIDE_STORED && p->type != ft_SET ) {
+		fprintf(stderr, "Offset of %s too big!\n", p->name);
+		parser->error = true;
+	} else {
+		in->ofs = p->offse;
+		in->flags = (p->offse >= 4)?IN_BIG:0;
+	}
+	switch( p->type ) {
+		case ft_IF8:
+			in->op = op_IF8;
+			in->arg = (unsigned char)p->name[0];
+			break;
+		case ft_IF16:
+			in->op = op_IF16;
+			in->arg = (unsigned char)p->name[1]
+				+ 0x100UL * (unsigned char)p->name[0];
+			break;
+		case ft_IF32:
+			in->op = op_IF32;
+			in->arg = (unsigned char)p->name[3]
+				+ (((unsigned long)(unsigned char)p->name[2])<<8)
+				+ (((unsigned long)(unsigned char)p->name[1])<<16)
+				+ (((unsigned long)(unsigned char)p->name[0])<<24);
+			break;
+		case ft_IFATOM:
+			in->op = op_IFATOM;
+			in->name = name_add(parser, p->name);
+			break;
+		case ft_LASTMARKER:
+			/* (the same value as OFS_LATER) */
+			if( p->offse == (size_t)-1 ) {
+				in->op = op_ROUND;
+				in->flags = 0;
+			} else if( p->offse > 0xFFFF ) {
+				fputs("LASTMARKER too big!\n", stderr);
+				parser->error = true;
+			} else
+				in->op = op_LASTMARKER;
+			return;
+		case ft_SET_SIZE:
+			if( p->offse == (size_t)-1 )
+				in->op = op_SET_SIZE_STORED;
+			else if( (p->offse & 0x80000000U) != 0 ) {
+				in->op = op_SET_SIZE_STACK;
+				in->arg = p->offse - 0x80000000U;
+			} else {
+				in->op = op_SET_SIZE;
+				in->arg = p->offse;
+			}
+			if( p->name != NULL && p->name[0] != '\0' )
+				in->ofs = (unsigned char)p->name[0];
+			else
+				in->ofs = 1;
+			in->flags = 0;
+			return;
+		case ft_GET:
+		case ft_DECREMENT_STORED:
+		case ft_DIVIDE_STORED:
+		case ft_SET:
+			in->op = (p->type == ft_GET)?op_GET:
+				(p->type == ft_DECREMENT_STORED)?
+					op_DECREMENT_STORED:
+				(p->type == ft_DIVIDE_STORED)?
+					op_DIVIDE_STORED:op_SET;
+			if( p->offse > 0xFFFFFFFFUL ) {
+				fputs("Argument too big!\n", stderr);
+				parser->error = true;
+			}
+			in->arg = p->offse;
+			in->ofs = 0;
+			in->flags = 0;
+			return;
+		case ft_Struct:
+		case ft_LISTofStruct:
+		case ft_LISTofVarStruct:
+			in->op = field_opcodes[p->type];
+			in->name = name_add(parser, p->name);
+			in->o.code = compile_parameters(parser, p->o.parameters,
+					true);
+			return;
+		case ft_LISTofVALUE:
+			in->op = op_LISTofVALUE;
+			in->name = name_add(parser, p->name);
+			in->o.values = p->o.values;
+			return;
+		default:
+			in->op = field_opcodes[p->type];
+			assert( in->op != op_END );
+			in->o.constants = p->o.constants;
+			if( p->type != ft_FORMAT8 )
+				in->name = name_add(parser, p->name);
+			return;
+	}
+	/* only IFs get here */
+	assert( p->o.parameters != NULL );
+	in->o.code = compile_parameters(parser, p->o.parameters, false);
+}
+
+/* For Structs the list starts with the (minimum) size of an item,
+ * which is kept as arg of an op_END before the code. */
+static const struct instruction *compile_parameters(struct parser *parser, const struct parameter *parameters, bool isstruct) {
+	struct compiled key, *c;
+	void *found;
+	const struct parameter *p, *first = parameters;
+	struct instruction *code, *in;
+	size_t count = 0, run = 0;
+
+	if( parameters == NULL )
+		return NULL;
+	key.parameters = parameters;
+	found = tfind(&key, &parser->compiled, compare_compiled);
+	if( found != NULL )
+		return (*(const struct compiled **)found)->code;
+
+	if( isstruct ) {
+		assert( parameters->name == NULL && parameters->offse > 0 );
+		first++;
+		count++;
+	}
+	for( p = first ; p->name != NULL ; p++ )
+		count++;
+	/* at most one RUN for every two fields */
+	code = calloc(count + count/2 + 1, sizeof(struct instruction));
+	if( code == NULL ) {
+		oom(parser);
+		return NULL;
+	}
+	in = code;
+	if( isstruct ) {
+		in->op = op_END;
+		in->arg = parameters->offse;
+		in++;
+	}
+	for( p = first ; p->name != NULL ; p++ ) {
+		if( run > 0 )
+			run--;
+		else if( find_run(p, in) >= 2 )
+			run = (in++)->arg - 1;
+		compile_parameter(parser, p, in);
+		if( (in->op >= op_Struct && in->op <= op_IFATOM)
+				&& in->o.code == NULL )
+			parser->error = true;
+		in++;
+	}
+	memset(in, 0, sizeof(struct instruction));
+	in->op = op_END;
+	c = malloc(sizeof(struct compiled));
+	if( c == NULL ) {
+		free(code);
+		oom(parser);
+		return NULL;
+	}
+	c->parameters = parameters;
+	c->code = finalize_data(code, (in + 1 - code) * sizeof(struct instruction),
+			__alignof__(struct instruction));
+	free(code);
+	if( c->code == NULL ) {
+		free(c);
+		parser->error = true;
+		return NULL;
+	}
+	if( tsearch(c, &parser->compiled, compare_compiled) == NULL ) {
+		free(c);
+		oom(parser);
+		return NULL;
+	}
+	return c->code;
+}
+
+static const struct request *finalize_requests(struct parser *parser, struct namespace *ns, const struct instruction *unknownrequest, const struct instruction *unknownresponse) {
 	struct request *rs;
 	const struct request *f;
 	int i;
@@ -2433,8 +2884,9 @@ static const struct request *finalize_requests(struct parser *parser, struct nam
 			rs[i].parameters = unknownrequest;
 		} else {
 			assert( ns->requests[i].request != NULL);
-			rs[i].parameters = parameters_finalize(parser,
-					ns->requests[i].request);
+			rs[i].parameters = compile_parameters(parser,
+					parameters_finalize(parser,
+						ns->requests[i].request), false);
 		}
 		if( ns->requests[i].has_response ) {
 			if( ns->requests[i].unsupported ) {
@@ -2442,8 +2894,9 @@ static const struct request *finalize_requests(struct parser *parser, struct nam
 				rs[i].answers = unknownresponse;
 			} else {
 				assert( ns->requests[i].response != NULL);
-				rs[i].answers = parameters_finalize(parser,
-						ns->requests[i].response);
+				rs[i].answers = compile_parameters(parser,
+						parameters_finalize(parser,
+						ns->requests[i].response), false);
 			}
 		} else
 			assert( ns->requests[i].response == NULL);
@@ -2495,8 +2948,9 @@ static const struct event *finalize_events(struct parser *parser, struct namespa
 	}
 	for( i = 0 ; i < ns->num_events[et] ; i++ ) {
 		es[i].name = ns->events[et][i].name;
-		es[i].parameters = parameters_finalize(parser,
-				ns->events[et][i].event);
+		es[i].parameters = compile_parameters(parser,
+				parameters_finalize(parser,
+					ns->events[et][i].event), false);
 		if( !ns->events[et][i].special )
 			continue;
 		assert( es[i].name != NULL );
@@ -2520,12 +2974,12 @@ static const struct event *finalize_events(struct parser *parser, struct namespa
 	return f;
 }
 
-void finalize_everything(struct parser *parser) {
+static void finalize_tables(struct parser *parser) {
 	struct extension *es, *e;
 	size_t count = 0;
 	struct namespace *ns, *core = NULL;
 	struct variable *v;
-	const struct parameter *unknownrequest, *unknownresponse;
+	const struct instruction *unknownrequest, *unknownresponse;
 
 	if( parser->error )
 		return;
@@ -2569,9 +3023,11 @@ void finalize_everything(struct parser *parser) {
 		return;
 	}
 	v = find_variable(parser, vt_request, "core::unknown");
-	unknownrequest = parameters_finalize(parser, v);
+	unknownrequest = compile_parameters(parser,
+			parameters_finalize(parser, v), false);
 	v = find_variable(parser, vt_response, "core::unknown");
-	unknownresponse = parameters_finalize(parser, v);
+	unknownresponse = compile_parameters(parser,
+			parameters_finalize(parser, v), false);
 	unexpected_reply = unknownresponse;
 	if( parser->error )
 		return;
@@ -2617,6 +3073,8 @@ void finalize_everything(struct parser *parser) {
 			return;
 		}
 		num_extensions = count;
+		if( !index_extensions() )
+			parser->error = true;
 	}
 	requests = finalize_requests(parser, core, unknownrequest, unknownresponse);
 	num_requests = core->num_requests;
@@ -2628,7 +3086,20 @@ void finalize_everything(struct parser *parser) {
 	if( errors == NULL )
 		parser->error = true;
 	num_errors = core->num_errors;
-	setup_parameters = parameters_finalize(parser, core->setup);
+	setup_parameters = compile_parameters(parser,
+			parameters_finalize(parser, core->setup), false);
+}
+
+void finalize_everything(struct parser *parser) {
+	finalize_tables(parser);
+	if( parser->error )
+		return;
+	/* only now all names are known */
+	if( parser->names_len == 0 )
+		(void)name_add(parser, "");
+	protocol_names = finalize_data(parser->names, parser->names_len, 1);
+	if( protocol_names == NULL )
+		parser->error = true;
 }
 
 /*
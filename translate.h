@@ -6,7 +6,10 @@ struct parser;
 void finalize_everything(struct parser *);
 struct parser *parser_init(void);
 void add_searchpath(struct parser *, const char *);
+void parser_searchpath(struct parser *, void (*)(void *, const char *), void *);
 bool translate(struct parser *, const char *);
 bool parser_free(struct parser *);
+/* the tables gentables made from the .proto files at build time */
+bool use_builtin_tables(void);
 
 #endif
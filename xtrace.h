@@ -2,7 +2,12 @@
 
 extern size_t authdata_len;
 extern char *authdata;
+#ifdef HAVE_PTHREAD
+/* every thread decoding something has its own */
+extern __thread FILE *out;
+#else
 extern FILE *out;
+#endif
 
 bool generateAuthorisation(const char *displayname);
 const char *parseDisplay(const char *displayname,
@@ -15,43 +20,129 @@ const char *generateSocketName(struct sockaddr_un *addr,int display);
 uint16_t calculateTCPport(int display);
 int acceptClient(int family,int listener, char **from);
 
+#include "ringbuffer.h"
+
 #define FDQUEUE_MAX_FD 16
 struct fdqueue {
 	int fd[FDQUEUE_MAX_FD];
 	int nfd;
 };
 
+/* what is printed about a connection, see output.h */
+struct outbuf {
+	char *data;
+	size_t used, size;
+};
+
+/* a message too big for the buffer, decoded only as far as it fits
+ * and followed while the rest is read (see stream_received in parse.c) */
+struct streamed {
+	unsigned long long len, left;
+	uint32_t hash;
+	unsigned int seq;
+};
+
+struct decoderqueue;
+struct stats;
+struct extensiontables;
+struct expectedreplies;
+struct byteorder;
+struct localatoms;
 extern struct connection {
 	struct connection *next;
 	int id; char *from;
 	int client_fd,server_fd;
 	bool bigendian;
-	unsigned char clientbuffer[16*4096];
-	unsigned int clientcount,clientignore;
+	/* the decoders for that, see choose_byteorder in parse.c */
+	const struct byteorder *byteorder;
+	/* what was read from the client and not yet sent on */
+	struct ringbuffer clientring;
+	/* the part of clientring the parser currently looks at,
+	 * valid within parse_client (see client_view there) */
+	unsigned char *clientbuffer;
+	/* clientignore: how much is decoded and can be sent on,
+	 * clientstart: where the message the parser looks at starts */
+	unsigned int clientcount,clientignore,clientstart;
+	/* the ring buffer could not give the message as one piece */
+	bool clientsplit;
+	/* already warned that the next request is incomplete */
+	bool clientwaited;
 	enum client_state { c_start=0, c_normal, c_amlost } clientstate;
-	unsigned char serverbuffer[16*4096];
-	unsigned int servercount,serverignore;
+	struct ringbuffer serverring;
+	unsigned char *serverbuffer;
+	unsigned int servercount,serverignore,serverstart;
+	bool serversplit;
 	enum server_state { s_start=0, s_normal, s_amlost} serverstate;
+	struct streamed clientstreamed, serverstreamed;
 	struct fdqueue clientfdq;
 	struct fdqueue serverfdq;
-	struct expectedreply *expectedreplies;
+	struct expectedreplies *expectedreplies;
 	uint64_t seq;
 	struct usedextension *usedextensions;
 	struct unknownextension *waiting, *unknownextensions;
+	struct extensiontables *extensiontables;
 	unsigned long long starttime;
+	/* when replaying a capture the time the data was read (in ns),
+	 * otherwise 0 (but monotonictime with --decoupled and --stats) */
+	uint64_t walltime, monotonictime;
+	/* atoms not (or differently) in the global table, see atoms.c */
+	struct localatoms *atoms;
+	/* state of the main loop, see mainqueue */
+	unsigned int ready;
+	bool active;
+	struct connection *nextactive;
+	/* with --decoupled, where the decoder gets its copy */
+	struct decoderqueue *decoder;
+	/* the line currently printed */
+	struct outbuf output;
+	/* with --stats, what was seen so far */
+	struct stats *stats;
 } *connections;
 void parse_server(struct connection *c);
 void parse_client(struct connection *c);
-void free_usedextensions(struct usedextension *);
-void free_unknownextensions(struct unknownextension *);
+void parse_skipped(struct connection *c, bool fromserver, bool cut, unsigned int messages, unsigned long long bytes);
+void free_extensions(struct connection *);
+void free_expectedreplies(struct connection *);
 bool copy_authentication(const char *fakedisplay,const char *display, const char *infile, const char *outfile);
 struct atom;
-struct atom *newAtom(const char *name, size_t len);
+struct atom *newAtom(struct connection *c, const char *name, size_t len);
+void dropAtom(struct connection *c, struct atom *data);
 const char *getAtom(struct connection *c, uint32_t atom);
 void internAtom(struct connection *c, uint32_t atom, struct atom *data);
+void rememberAtom(struct connection *c, uint32_t atom, const char *name, size_t len);
+extern bool atoms_deferred;
+void atoms_merge(struct connection *c);
+void atoms_free(struct connection *c);
 
 extern bool denyallextensions;
+extern bool interactive;
 extern size_t maxshownlistlen;
+extern size_t maxbuffersize;
+extern bool checksum_streamed;
+#define INITIAL_BUFFER_SIZE 16384
+
+/* how often a buffer has to get empty before it may shrink */
+#define SHRINK_PERIOD 16
+
+/* give back what big messages needed once they stopped coming:
+ * after it got empty SHRINK_PERIOD times, a buffer more than four
+ * times as big as the most it held in that time is shrunk, so a
+ * steady stream of big messages does not grow and shrink it for
+ * every one of them */
+static inline void shrink_if_idle(struct ringbuffer *b) {
+	size_t size;
+
+	if( b->count != 0 || ++b->drained < SHRINK_PERIOD )
+		return;
+	if( b->size > INITIAL_BUFFER_SIZE && b->peak < b->size / 4 ) {
+		size = 2 * b->peak;
+		if( size < INITIAL_BUFFER_SIZE )
+			size = INITIAL_BUFFER_SIZE;
+		(void)ringbuffer_resize(b, size);
+	}
+	b->peak = 0;
+	b->drained = 0;
+}
 extern bool print_timestamps;
 extern bool print_reltimestamps;
 extern bool print_uptimestamps;